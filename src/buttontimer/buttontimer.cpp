@@ -1,120 +1,233 @@
 #include "buttontimer.hpp"
+#include "../trace/trace.h"
 
 #include <time.h>
-#ifndef CLOCK_MONOTIC
-#   define CLOCK_MONOTIC CLOCK_REALTIME
-#endif
+#include <boost/bind.hpp>
 
-ButtonTimer::ButtonTimer(uint32_t shortpress_min_ms, uint32_t longpress_ms)
+ButtonTimer::ButtonTimer(uint32_t shortpress_min_ms, uint32_t longpress_ms, uint32_t multitap_ms, uint32_t repeat_ms)
 {
     shortpressMinTime = shortpress_min_ms;
     longpressTime = longpress_ms;
+    multitapTime = multitap_ms;
+    repeatTime = repeat_ms;
+    pressSeq = 0;
     eventLock = false;
     
-    ThreadStart();
+    Thread::InitMutex(&mutex, true);
+    Stats::Instance().Register("button.longpress-lateness", &longpressLateness);
 }
 
 ButtonTimer::~ButtonTimer()
 {
-    ThreadStop();
+    // Makes sure no timed event is being fired anymore
+    TimerService::Instance().CancelAll(this);
+    Stats::Instance().Unregister(&longpressLateness);
+    
+    pthread_mutex_destroy(&mutex);
+}
 
+const char * ButtonTimer::GestureName(Gesture gesture)
+{
+    static const char * names[] = { "tap", "hold", "repeat", "release" };
+    return names[gesture];
 }
 
 void ButtonTimer::RegisterPress(uint16_t keycode)
 {
-    MutexLock();
+    pthread_mutex_lock(&mutex);
     // Prevent trouble when calling this from within one of our event listeners
-    if(eventLock) { MutexUnlock(); return; }
+    if(eventLock) { pthread_mutex_unlock(&mutex); return; }
 
-    pressRegistry[keycode] = now_ms();
-    MutexUnlock();
+    std::map<uint16_t, Button>::iterator it = buttons.find(keycode);
+    if(it == buttons.end())
+    {
+        Button b;
+        b.taps = 0;
+        b.timer = 0;
+        it = buttons.insert(std::make_pair(keycode, b)).first;
+    }
+    
+    // Stops the multitap timer, so a running tap sequence continues with this press
+    Button &b = it->second;
+    if(b.timer != 0)
+        TimerService::Instance().Cancel(b.timer);
+    
+    b.pressed = true;
+    b.held = false;
+    b.repeats = 0;
+    b.time = now_us();
+    b.seq = ++pressSeq;
+    b.timer = TimerService::Instance().Schedule(longpressTime, boost::bind(&ButtonTimer::longPress, this, keycode, b.seq), this);
+    
+    pthread_mutex_unlock(&mutex);
 }
 
 
 void ButtonTimer::RegisterRelease(uint16_t keycode)
 {
-    uint64_t now = now_ms();
-    uint64_t then;
-    MutexLock();
+    uint64_t now = now_us();
+    pthread_mutex_lock(&mutex);
     // Prevent trouble when calling this from within one of our event listeners
-    if(eventLock) { MutexUnlock(); return; }
+    if(eventLock) { pthread_mutex_unlock(&mutex); return; }
 
-    
-    
-    if(pressRegistry.count(keycode))
+    std::map<uint16_t, Button>::iterator it = buttons.find(keycode);
+    if(it != buttons.end() && it->second.pressed)
     {
-        // if it was a long press, the key code would already have been erased, so we
-        // can safely fire the onShortPress event
-        then = pressRegistry[keycode];
-        // remove from registry after release, if it was a long press, the event should have already been fired
-        pressRegistry.erase(keycode); 
+        Button &b = it->second;
+        TimerService::Instance().Cancel(b.timer);
+        b.timer = 0;
+        b.pressed = false;
+        b.seq = ++pressSeq;
         
-        if(now - then > shortpressMinTime)
+        if(b.held)
+        {
+            // if it was a long press, that was signalled already. Only the gesture remains
+            b.taps = 0;
+            gesture(keycode, kGestureRelease, b.repeats);
+        }
+        else if(now - b.time > ((uint64_t)shortpressMinTime) * 1000)
         {
             eventLock = true; // lock out trouble
             onShortPress(keycode);
             eventLock = false; // risk of trouble gone
+            
+            b.taps++;
+            if(multitapTime > 0)
+            {
+                // Wait for a next tap before reporting the sequence
+                b.timer = TimerService::Instance().Schedule(multitapTime, boost::bind(&ButtonTimer::tapsDone, this, keycode, b.seq), this);
+            }
+            else
+            {
+                b.taps = 0;
+                gesture(keycode, kGestureTap, 1);
+            }
+        }
+        else if(b.taps > 0 && multitapTime > 0)
+        {
+            // Too short to count, but the sequence still ends after the multitap time
+            b.timer = TimerService::Instance().Schedule(multitapTime, boost::bind(&ButtonTimer::tapsDone, this, keycode, b.seq), this);
         }
     }
 
-    MutexUnlock();
+    pthread_mutex_unlock(&mutex);
 }
 
 void ButtonTimer::CancelPress(uint16_t keycode)
 {
     // remove button id from map (but only if it is in the map already)
-    MutexLock();
+    pthread_mutex_lock(&mutex);
     // Prevent trouble when calling this from within one of our event listeners
-    if(eventLock) { MutexUnlock(); return; }
+    if(eventLock) { pthread_mutex_unlock(&mutex); return; }
 
-    if(pressRegistry.count(keycode))
+    std::map<uint16_t, Button>::iterator it = buttons.find(keycode);
+    if(it != buttons.end())
     {
-        pressRegistry.erase(keycode);
+        TimerService::Instance().Cancel(it->second.timer);
+        buttons.erase(it);
     }
-    MutexUnlock();
+    pthread_mutex_unlock(&mutex);
 }
 
-void ButtonTimer::ThreadLoop()
+// Called from the timer service when a press has lasted long enough
+void ButtonTimer::longPress(uint16_t keycode, uint32_t seq)
 {
-    uint64_t now = now_ms();
-    std::list<uint16_t> btnList;
+    TRACE_SCOPE("button.longpress");
     boost::optional<bool> valid;
-    MutexLock();
-    // list through all the items 
-
-    for( std::map<uint16_t,uint64_t>::iterator ii=pressRegistry.begin(); ii!=pressRegistry.end(); ++ii)
+    
+    pthread_mutex_lock(&mutex);
+    
+    // The timer may have fired just as the button was released or pressed again
+    std::map<uint16_t, Button>::iterator it = buttons.find(keycode);
+    if(it == buttons.end() || it->second.seq != seq || !it->second.pressed)
     {
-        if(now - (ii->second) >= longpressTime) // if it is in overtime
-        {
-            // Schedule to process the thing
-            btnList.push_back(ii->first);
-        }
-    }    
-
-    // Process listed items
-    for (std::list<uint16_t>::iterator it=btnList.begin(); it != btnList.end(); ++it)
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    
+    Button &b = it->second;
+    b.timer = 0;
+    int64_t late = now_us() - (int64_t)b.time - (int64_t)longpressTime * 1000;
+    longpressLateness.Record((late > 0) ? (uint64_t)late * 1000 : 0);
+    // If any validators are connected, they can retun false to indicate that this connection is not 
+    // allowed
+    eventLock = true; // lock out trouble
+    
+    valid = onValidatePress(keycode);
+    if(valid.get_value_or(true))
     {
-        pressRegistry.erase(*it);
-        // If any validators are connected, they can retun false to indicate that this connection is not 
-        // allowed
-        eventLock = true; // lock out trouble
+        onLongPress(keycode);
+        eventLock = false; // risk of trouble gone
         
-        valid = onValidatePress(*it);
-        if(valid.get_value_or(true))
+        b.held = true;
+        gesture(keycode, kGestureHold, b.taps + 1);
+        b.taps = 0;
+        if(repeatTime > 0)
         {
-            onLongPress(*it);
+            b.timer = TimerService::Instance().Schedule(repeatTime, boost::bind(&ButtonTimer::repeat, this, keycode, seq), this);
         }
+    }
+    else
+    {
         eventLock = false; // risk of trouble gone
+        
+        // Not pressed after all, forget about the press
+        buttons.erase(it);
+    }
+    
+    pthread_mutex_unlock(&mutex);
+}
+
+// Called from the timer service every repeat time while a button is held
+void ButtonTimer::repeat(uint16_t keycode, uint32_t seq)
+{
+    TRACE_SCOPE("button.repeat");
+    pthread_mutex_lock(&mutex);
+    
+    std::map<uint16_t, Button>::iterator it = buttons.find(keycode);
+    if(it != buttons.end() && it->second.seq == seq && it->second.held)
+    {
+        Button &b = it->second;
+        b.repeats++;
+        // Schedule the next one before the listeners run, so the time they take does not add up
+        b.timer = TimerService::Instance().Schedule(repeatTime, boost::bind(&ButtonTimer::repeat, this, keycode, seq), this);
+        gesture(keycode, kGestureRepeat, b.repeats);
     }
     
-    MutexUnlock();
-    usleep(50000);
+    pthread_mutex_unlock(&mutex);
+}
+
+// Called from the timer service when no next tap followed within the multitap time
+void ButtonTimer::tapsDone(uint16_t keycode, uint32_t seq)
+{
+    TRACE_SCOPE("button.taps");
+    pthread_mutex_lock(&mutex);
+    
+    std::map<uint16_t, Button>::iterator it = buttons.find(keycode);
+    if(it != buttons.end() && it->second.seq == seq && it->second.taps > 0)
+    {
+        Button &b = it->second;
+        uint32_t taps = b.taps;
+        b.taps = 0;
+        b.timer = 0;
+        gesture(keycode, kGestureTap, taps);
+    }
+    
+    pthread_mutex_unlock(&mutex);
+}
+
+// Fire a gesture. Call with the mutex held
+void ButtonTimer::gesture(uint16_t keycode, Gesture gesture, uint32_t count)
+{
+    eventLock = true; // lock out trouble
+    onGesture(keycode, gesture, count);
+    eventLock = false; // risk of trouble gone
 }
 
-int64_t ButtonTimer::now_ms(void)
+int64_t ButtonTimer::now_us(void)
 {
     struct timespec now;
-    clock_gettime(CLOCK_MONOTIC, &now);
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    return ((int64_t)now.tv_sec)*1000LL + (now.tv_nsec/1000000);
+    return ((int64_t)now.tv_sec)*1000000LL + (now.tv_nsec/1000);
 }
@@ -1,17 +1,30 @@
 #ifndef __BUTTONTIMER_HPP
 #define __BUTTONTIMER_HPP
 
-#include "../thread/thread.hpp"
+#include "../timerservice/timerservice.hpp"
+#include "../stats/stats.hpp"
 #include <stdint.h>
+#include <pthread.h>
 #include <boost/signals2.hpp>
 
 #include <map>
 
-// combiner which perfoms a kind of and function on all signal returns, returns true if no signals connected
-class ButtonTimer : protected Thread
+// Gestures reported through onGesture
+enum Gesture
+{
+    kGestureTap,        // Button was clicked count times in a row (1 is a single click, 2 a double click, etc)
+    kGestureHold,       // Button is held down. Count is the number of presses in the sequence, including this one
+    kGestureRepeat,     // Button is still held down. Count is the number of the repeat, starting at 1
+    kGestureRelease,    // Button was released after being held. Count is the number of repeats that were fired
+};
+
+// Tells short presses from long presses, and recognizes gestures. Long presses and the timed gestures are
+// fired from the timer service thread at the configured time, all others when the button is released
+class ButtonTimer
 {
     public:
-        ButtonTimer(uint32_t shortpress_min_ms, uint32_t longpress_ms);
+        //! A multitap time of 0 reports each tap directly. A repeat time of 0 disables repeats while held
+        ButtonTimer(uint32_t shortpress_min_ms, uint32_t longpress_ms, uint32_t multitap_ms = 0, uint32_t repeat_ms = 0);
         ~ButtonTimer();
         
         void RegisterPress(uint16_t keycode);
@@ -21,19 +34,41 @@ class ButtonTimer : protected Thread
         boost::signals2::signal<void (uint16_t keycode)> onShortPress;
         boost::signals2::signal<void (uint16_t keycode)> onLongPress;
         boost::signals2::signal<bool (uint16_t keycode)> onValidatePress;
-    
-    protected:
-        virtual void ThreadLoop(void);
+        boost::signals2::signal<void (uint16_t keycode, Gesture gesture, uint32_t count)> onGesture;
+        
+        static const char * GestureName(Gesture gesture);
     
     private:
-        boost::signals2::connection onThreadErrorConnection;
+        struct Button
+        {
+            bool pressed;
+            uint64_t time;                  // Time of the last press, in microseconds
+            uint32_t seq;                   // Sequence number of the last press or release, to match it with its timers
+            TimerService::TimerId timer;    // Long press or repeat timer while pressed, multitap timer while released
+            bool held;                      // Long press was fired for this press
+            uint32_t repeats;               // Number of repeats fired while held
+            uint32_t taps;                  // Number of taps in the current multitap sequence
+        };
+        
         uint32_t longpressTime;
         uint32_t shortpressMinTime;
-        std::map<uint16_t, uint64_t> pressRegistry;
+        uint32_t multitapTime;
+        uint32_t repeatTime;
+        std::map<uint16_t, Button> buttons;
+        uint32_t pressSeq;
+        Histogram longpressLateness;    // How late the long press timers fire. Only recorded in the timer thread
 
         bool eventLock;
-        static int64_t now_ms(void);
+        pthread_mutex_t mutex;          // Recursive, so the event listeners can call back in
+        
+        // Timer callbacks
+        void longPress(uint16_t keycode, uint32_t seq);
+        void repeat(uint16_t keycode, uint32_t seq);
+        void tapsDone(uint16_t keycode, uint32_t seq);
+        
+        void gesture(uint16_t keycode, Gesture gesture, uint32_t count);
+        static int64_t now_us(void);
 
 };
 
-#endif
\ No newline at end of file
+#endif
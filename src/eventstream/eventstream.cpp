@@ -0,0 +1,391 @@
+#include "eventstream.hpp"
+#include "../log/log.hpp"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <set>
+
+using namespace std;
+
+EventStream::EventStream(const std::string &path)
+{
+    this->path = path;
+    this->listenFd = -1;
+    this->wakePipe[0] = -1;
+    this->wakePipe[1] = -1;
+    this->wakePending = 0;
+    this->sequence = 0;
+    Thread::InitMutex(&this->mutex);
+    Stats::Instance().Register("piio_eventstream_events_total", "", &this->published);
+    Stats::Instance().Register("piio_eventstream_dropped_events_total", "", &this->dropped);
+    Stats::Instance().Register("piio_eventstream_clients", "", &this->connected);
+}
+
+EventStream::~EventStream()
+{
+    Stop();
+    Stats::Instance().Unregister(&this->published);
+    Stats::Instance().Unregister(&this->dropped);
+    Stats::Instance().Unregister(&this->connected);
+    pthread_mutex_destroy(&this->mutex);
+}
+
+uint16_t EventStream::GroupId(const std::string &group)
+{
+    std::map<std::string, uint16_t>::iterator it = this->groupIds.find(group);
+    if(it != this->groupIds.end())
+        return it->second;
+
+    uint16_t id = (uint16_t)this->groupIds.size();
+    this->groupIds[group] = id;
+    return id;
+}
+
+void EventStream::Register(uint16_t group, uint16_t io, const std::string &longhandle, uint32_t type)
+{
+    struct piio_events_io desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.group = group;
+    desc.io = io;
+    desc.type = type;
+    strncpy(desc.name, longhandle.c_str(), PIIO_EVENTS_NAME_LEN - 1);
+    this->ios.push_back(desc);
+}
+
+bool EventStream::Start()
+{
+    struct sockaddr_un addr;
+
+    if(this->path.size() >= sizeof(addr.sun_path))
+    {
+        clog << kLogError << "Event stream: socket path '" << this->path << "' is too long" << endl;
+        return false;
+    }
+
+    buildHandshake();
+
+    if(pipe(this->wakePipe) != 0)
+    {
+        clog << kLogError << "Event stream: could not create wake pipe: " << strerror(errno) << endl;
+        return false;
+    }
+    fcntl(this->wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(this->wakePipe[1], F_SETFL, O_NONBLOCK);
+
+    this->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, this->path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(this->path.c_str());
+
+    if(this->listenFd < 0 || bind(this->listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(this->listenFd, 4) != 0)
+    {
+        clog << kLogError << "Event stream: could not listen on '" << this->path << "': " << strerror(errno) << endl;
+        Stop();
+        return false;
+    }
+    fcntl(this->listenFd, F_SETFL, O_NONBLOCK);
+
+    clog << kLogInfo << "Event stream: streaming " << this->ios.size() << " IOs on '" << this->path << "'" << endl;
+    ThreadStart();
+    return true;
+}
+
+void EventStream::Stop()
+{
+    if(ThreadRunning())
+    {
+        ThreadStop();
+    }
+    
+    pthread_mutex_lock(&this->mutex);
+    while(!this->clients.empty())
+    {
+        dropClient(this->clients.begin());
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    if(this->listenFd >= 0)
+    {
+        close(this->listenFd);
+        unlink(this->path.c_str());
+        this->listenFd = -1;
+    }
+    if(this->wakePipe[0] >= 0)
+    {
+        close(this->wakePipe[0]);
+        close(this->wakePipe[1]);
+        this->wakePipe[0] = -1;
+        this->wakePipe[1] = -1;
+    }
+}
+
+void EventStream::Reset()
+{
+    this->ios.clear();
+}
+
+void EventStream::Reannounce()
+{
+    pthread_mutex_lock(&this->mutex);
+    buildHandshake();
+    while(!this->clients.empty())
+    {
+        dropClient(this->clients.begin());
+    }
+    pthread_mutex_unlock(&this->mutex);
+
+    clog << kLogInfo << "Event stream: now streaming " << this->ios.size() << " IOs, clients must reconnect" << endl;
+}
+
+// Build the handshake once, it is the same for every client
+void EventStream::buildHandshake()
+{
+    struct piio_events_header header;
+    header.magic = PIIO_EVENTS_MAGIC;
+    header.version = PIIO_EVENTS_VERSION;
+    header.record_size = sizeof(struct piio_event);
+    header.io_count = this->ios.size();
+    this->handshake.resize(sizeof(header) + this->ios.size() * sizeof(struct piio_events_io));
+    memcpy(&(this->handshake[0]), &header, sizeof(header));
+    if(this->ios.size() > 0)
+        memcpy(&(this->handshake[sizeof(header)]), &(this->ios[0]), this->ios.size() * sizeof(struct piio_events_io));
+}
+
+void EventStream::Publish(uint16_t group, uint16_t io, double value)
+{
+    struct piio_event event;
+    bool queued = false;
+    
+    event.group = group;
+    event.io = io;
+    event.value = value;
+    event.timestamp = now_us();
+
+    pthread_mutex_lock(&this->mutex);
+    event.sequence = this->sequence++;
+    for(std::vector<Client*>::iterator it = this->clients.begin(); it != this->clients.end(); ++it)
+    {
+        Client * c = *it;
+        if(c->count < EVENTSTREAM_QUEUE_LEN)
+        {
+            c->queue[(c->head + c->count) & (EVENTSTREAM_QUEUE_LEN - 1)] = event;
+            c->count++;
+            queued = true;
+        }
+        else
+        {
+            // Too slow, the writer thread will drop it
+            c->overflow = true;
+            this->dropped.Add();
+            queued = true;
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    this->published.Add();
+
+    // Wake the writer, once for all events queued until it gets to them
+    if(queued && __sync_bool_compare_and_swap(&this->wakePending, 0, 1))
+    {
+        char c = 0;
+        if(write(this->wakePipe[1], &c, 1) < 0) { /* pipe full means the writer is awake anyway */ }
+    }
+}
+
+void EventStream::ThreadFunc(void)
+{
+    std::vector<struct pollfd> fds;
+    std::set<int> hungUp;
+    char buffer[64];
+    
+    ApplyProfile("eventstream");
+    
+    while(ThreadRunning())
+    {
+        fds.resize(3);
+        fds[0].fd = this->wakePipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = this->listenFd;
+        fds[1].events = POLLIN;
+        fds[2].fd = ThreadWakeFd();
+        fds[2].events = POLLIN;
+
+        pthread_mutex_lock(&this->mutex);
+        for(std::vector<Client*>::iterator it = this->clients.begin(); it != this->clients.end(); ++it)
+        {
+            struct pollfd p;
+            p.fd = (*it)->fd;
+            p.events = ((*it)->count > 0 || (*it)->handshakeSent < this->handshake.size()) ? POLLOUT : 0;
+            fds.push_back(p);
+        }
+        pthread_mutex_unlock(&this->mutex);
+
+        // Stop requests wake the poll. Without a wakeup fd, the timeout is the maximum delay before the thread is stopped
+        if(poll(&fds[0], fds.size(), (fds[2].fd >= 0) ? -1 : 100) < 0 && errno != EINTR)
+        {
+            clog << kLogError << "Event stream: poll failed: " << strerror(errno) << endl;
+            break;
+        }
+
+        if(fds[0].revents & POLLIN)
+        {
+            this->wakePending = 0;
+            __sync_synchronize();
+            while(read(this->wakePipe[0], buffer, sizeof(buffer)) > 0);
+        }
+
+        // Clients that hung up are reported even when they have nothing to send, drop them or the poll keeps returning
+        hungUp.clear();
+        for(std::vector<struct pollfd>::size_type i = 3; i < fds.size(); i++)
+        {
+            if(fds[i].revents & (POLLHUP | POLLERR))
+                hungUp.insert(fds[i].fd);
+        }
+
+        if(fds[1].revents & POLLIN)
+        {
+            acceptClient();
+        }
+
+        // Flush all clients with anything to send
+        pthread_mutex_lock(&this->mutex);
+        std::vector<Client*>::iterator it = this->clients.begin();
+        while(it != this->clients.end())
+        {
+            if(hungUp.count((*it)->fd) > 0 || !flushClient(*it))
+            {
+                dropClient(it);
+                it = this->clients.begin(); // restart, dropping invalidates the iterator
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        pthread_mutex_unlock(&this->mutex);
+    }
+}
+
+void EventStream::acceptClient()
+{
+    int fd = accept(this->listenFd, NULL, NULL);
+    if(fd < 0)
+        return;
+    
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    pthread_mutex_lock(&this->mutex);
+    if(this->clients.size() >= EVENTSTREAM_MAX_CLIENTS)
+    {
+        pthread_mutex_unlock(&this->mutex);
+        clog << kLogWarning << "Event stream: too many clients, refusing connection" << endl;
+        close(fd);
+        return;
+    }
+    
+    Client * c = new Client();
+    c->fd = fd;
+    c->handshakeSent = 0;
+    c->head = 0;
+    c->count = 0;
+    c->partial = 0;
+    c->overflow = false;
+    this->clients.push_back(c);
+    this->connected.Set(this->clients.size());
+    pthread_mutex_unlock(&this->mutex);
+    
+    clog << kLogDebug << "Event stream: client connected" << endl;
+}
+
+// Called with the mutex held
+bool EventStream::flushClient(Client * client)
+{
+    struct iovec iov[3];
+    int iovcnt = 0;
+    ssize_t written;
+    
+    if(client->overflow)
+    {
+        clog << kLogWarning << "Event stream: client too slow, disconnecting it" << endl;
+        return false;
+    }
+
+    if(client->handshakeSent < this->handshake.size())
+    {
+        iov[iovcnt].iov_base = &(this->handshake[client->handshakeSent]);
+        iov[iovcnt].iov_len = this->handshake.size() - client->handshakeSent;
+        iovcnt++;
+    }
+    
+    if(client->count > 0)
+    {
+        // The queue is a ring, so the queued events are in at most two pieces
+        uint32_t first = client->count;
+        if(client->head + first > EVENTSTREAM_QUEUE_LEN)
+            first = EVENTSTREAM_QUEUE_LEN - client->head;
+        
+        iov[iovcnt].iov_base = (char *)&(client->queue[client->head]) + client->partial;
+        iov[iovcnt].iov_len = first * sizeof(struct piio_event) - client->partial;
+        iovcnt++;
+        
+        if(first < client->count)
+        {
+            iov[iovcnt].iov_base = &(client->queue[0]);
+            iov[iovcnt].iov_len = (client->count - first) * sizeof(struct piio_event);
+            iovcnt++;
+        }
+    }
+
+    if(iovcnt == 0)
+        return true;
+    
+    written = writev(client->fd, iov, iovcnt);
+    if(written < 0)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+    
+    // Account for the handshake first, then the events
+    if(client->handshakeSent < this->handshake.size())
+    {
+        size_t n = this->handshake.size() - client->handshakeSent;
+        if((size_t)written < n)
+        {
+            client->handshakeSent += written;
+            return true;
+        }
+        client->handshakeSent += n;
+        written -= n;
+    }
+    
+    size_t bytes = client->partial + written;
+    uint32_t done = bytes / sizeof(struct piio_event);
+    client->partial = bytes % sizeof(struct piio_event);
+    client->head = (client->head + done) & (EVENTSTREAM_QUEUE_LEN - 1);
+    client->count -= done;
+    
+    return true;
+}
+
+// Called with the mutex held
+void EventStream::dropClient(std::vector<Client*>::iterator it)
+{
+    close((*it)->fd);
+    delete *it;
+    this->clients.erase(it);
+    this->connected.Set(this->clients.size());
+}
+
+uint64_t EventStream::now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return ((uint64_t)now.tv_sec)*1000000ULL + (now.tv_nsec/1000);
+}
@@ -0,0 +1,83 @@
+#ifndef __EVENTSTREAM_HPP
+#define __EVENTSTREAM_HPP
+
+#include "../thread/thread.hpp"
+#include "../stats/stats.hpp"
+#include "piio-events.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#define EVENTSTREAM_QUEUE_LEN   1024    // events queued per client before it is considered too slow (must be a power of two)
+#define EVENTSTREAM_MAX_CLIENTS 16
+
+// Streams IO changes as binary records to clients on a Unix domain socket (see piio-events.h for the format)
+// Publish only queues the event for each client and wakes the writer thread, so a slow client
+// never blocks the thread reporting the change. Clients whose queue overflows are disconnected.
+class EventStream : protected Thread
+{
+public:
+    EventStream(const std::string &path);
+    ~EventStream();
+
+    //! Get the id for a group, registering it if needed
+    uint16_t GroupId(const std::string &group);
+    //! Register an IO of a group, to be described in the handshake
+    void Register(uint16_t group, uint16_t io, const std::string &longhandle, uint32_t type);
+
+    //! Open the socket and start streaming. Returns false on failure
+    bool Start();
+    //! Stop streaming and disconnect all clients
+    void Stop();
+
+    //! Forget all registered IOs, before registering them again after a configuration reload
+    void Reset();
+    //! Describe the IOs registered since Reset to clients. All clients are disconnected,
+    //! and get the new handshake when they reconnect
+    void Reannounce();
+
+    //! Queue an event for all connected clients
+    void Publish(uint16_t group, uint16_t io, double value);
+
+protected:
+    virtual void ThreadFunc(void);
+
+private:
+    struct Client
+    {
+        int fd;
+        size_t handshakeSent;                   // Bytes of the handshake sent so far
+        struct piio_event queue[EVENTSTREAM_QUEUE_LEN];
+        uint32_t head;                          // Position of the first queued event
+        uint32_t count;                         // Number of queued events
+        size_t partial;                         // Bytes of the first queued event already sent
+        bool overflow;
+    };
+
+    std::string path;
+    std::map<std::string, uint16_t> groupIds;
+    std::vector<struct piio_events_io> ios;
+    std::vector<char> handshake;
+
+    std::vector<Client*> clients;
+    int listenFd;
+    int wakePipe[2];
+    volatile uint32_t wakePending;
+    uint32_t sequence;
+    pthread_mutex_t mutex;
+
+    Counter published;                  // Events published
+    Counter dropped;                    // Events not queued for a client because its queue was full
+    Gauge connected;                    // Number of connected clients
+
+    void buildHandshake();
+    void acceptClient();
+    // Write as much of a client's queue as the socket takes. Returns false if the client should be dropped
+    bool flushClient(Client * client);
+    void dropClient(std::vector<Client*>::iterator it);
+
+    static uint64_t now_us(void);
+};
+
+#endif//__EVENTSTREAM_HPP
@@ -0,0 +1,50 @@
+/*
+ * Wire format of the PiIo binary event stream.
+ *
+ * Clients connect to the server's Unix stream socket (configured with 'event-socket' in the
+ * server settings). On connect, the server first sends a handshake: a piio_events_header
+ * followed by io_count piio_events_io descriptors, one for each IO it will report on.
+ * After that, the connection carries a stream of piio_event records, in host byte order.
+ *
+ * Each client has a bounded queue on the server. A client that does not keep up, so that its
+ * queue overflows, is disconnected. A gap in the sequence numbers therefore never happens
+ * on a live connection.
+ *
+ * When the server reloads its configuration, it disconnects all clients. Reconnect to get
+ * the new IO descriptions.
+ */
+#ifndef __PIIO_EVENTS_H
+#define __PIIO_EVENTS_H
+
+#include <stdint.h>
+
+#define PIIO_EVENTS_MAGIC       0x5650494F      /* "OIPV" */
+#define PIIO_EVENTS_VERSION     1
+#define PIIO_EVENTS_NAME_LEN    48              /* maximum length of "group.handle", including terminating null */
+
+struct piio_events_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;       /* sizeof(struct piio_event) */
+    uint32_t io_count;          /* number of piio_events_io descriptors that follow */
+};
+
+struct piio_events_io
+{
+    uint16_t group;             /* group id */
+    uint16_t io;                /* id of the IO within the group */
+    uint32_t type;              /* PIIO_STATE_* type, see piio-state.h */
+    char name[PIIO_EVENTS_NAME_LEN];    /* "group.handle" */
+};
+
+struct piio_event
+{
+    uint32_t sequence;          /* incremented for every event, over all IOs */
+    uint16_t group;             /* group id */
+    uint16_t io;                /* id of the IO within the group */
+    double value;               /* new value, booleans are 0 or 1 */
+    uint64_t timestamp;         /* time of the change, in microseconds since the epoch */
+};
+
+#endif/*__PIIO_EVENTS_H*/
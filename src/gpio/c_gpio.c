@@ -25,6 +25,8 @@ SOFTWARE.
 #include <stdlib.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <string.h>
+#include <pthread.h>
 #include "c_gpio.h"
 
 #define BCM2708_PERI_BASE_DEFAULT   0x20000000
@@ -52,6 +54,15 @@ static volatile uint32_t *gpio_map = NULL;
 static  uint8_t *gpio_mem;
 static int mem_fd;
 
+// simulated mode
+static int simulated = 0;
+static gpio_output_hook output_hook = NULL;
+static void simulate_output(int bank, uint32_t set, uint32_t clear);
+
+// Serializes the read-modify-writes of the function select and pull registers, which are shared by
+// pins that may be set up from different threads (e.g. groups starting concurrently)
+static pthread_mutex_t setup_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 // Support struct and functions
 
 void short_wait(void)
@@ -133,6 +144,62 @@ int gpio_init(void)
     return GPIO_SETUP_OK;
 }
 
+int gpio_init_simulated(void)
+{
+    if(gpio_map == NULL)
+    {
+        if ((gpio_map = (uint32_t *)calloc(1, BLOCK_SIZE)) == NULL)
+            return GPIO_SETUP_MALLOC_FAIL;
+        simulated = 1;
+    }
+    return GPIO_SETUP_OK;
+}
+
+int gpio_simulated(void)
+{
+    return simulated;
+}
+
+void gpio_set_output_hook(gpio_output_hook hook)
+{
+    output_hook = hook;
+}
+
+void gpio_simulate_input(int gpio, int value)
+{
+    if (value)
+        __sync_fetch_and_or(gpio_map+PINLEVEL_OFFSET+(gpio/32), 1 << (gpio%32));
+    else
+        __sync_fetch_and_and(gpio_map+PINLEVEL_OFFSET+(gpio/32), ~(1 << (gpio%32)));
+}
+
+// Apply a GPSET/GPCLR write to the levels of the pins that are outputs
+static void simulate_output(int bank, uint32_t set, uint32_t clear)
+{
+    uint32_t outputs = 0, before, after;
+    int i;
+
+    for (i=0; i<32; i++)
+    {
+        if (((set | clear) & (1 << i)) && gpio_function(bank*32 + i) == 1)
+            outputs |= (1 << i);
+    }
+    set &= outputs;
+    clear &= outputs;
+    if (!set && !clear)
+        return;
+
+    do
+    {
+        before = *(gpio_map+PINLEVEL_OFFSET+bank);
+        after = (before | set) & ~clear;
+    }
+    while (!__sync_bool_compare_and_swap(gpio_map+PINLEVEL_OFFSET+bank, before, after));
+
+    if (output_hook != NULL && before != after)
+        output_hook(bank, before ^ after, after);
+}
+
 void clear_event_detect(int gpio)
 {
 	int offset = EVENT_DETECT_OFFSET + (gpio/32);
@@ -210,7 +277,7 @@ void gpio_set_low_event(int gpio, int enable)
     clear_event_detect(gpio);
 }
 
-void gpio_set_pullupdn(int gpio, int pud)
+static void set_pullupdn(int gpio, int pud)
 {
     int clk_offset = PULLUPDNCLK_OFFSET + (gpio/32);
     int shift = (gpio%32);
@@ -234,7 +301,17 @@ void gpio_set_pullupdn(int gpio, int pud)
     *(gpio_map+PULLUPDN_OFFSET) &= ~3;
     *(gpio_map+clk_offset) = 0;
     
+    // An unconnected input follows its pull
+    if (simulated && pud != GPIO_PUD_OFF)
+        gpio_simulate_input(gpio, pud == GPIO_PUD_UP);
+
+}
 
+void gpio_set_pullupdn(int gpio, int pud)
+{
+    pthread_mutex_lock(&setup_mutex);
+    set_pullupdn(gpio, pud);
+    pthread_mutex_unlock(&setup_mutex);
 }
 
 void gpio_setup(int gpio, int direction, int pud)
@@ -242,12 +319,14 @@ void gpio_setup(int gpio, int direction, int pud)
     int offset = FSEL_OFFSET + (gpio/10);
     int shift = (gpio%10)*3;
 
-    gpio_set_pullupdn(gpio, pud);
+    pthread_mutex_lock(&setup_mutex);
+    set_pullupdn(gpio, pud);
 
     if (direction == GPIO_OUTPUT)
         *(gpio_map+offset) = (*(gpio_map+offset) & ~(7<<shift)) | (1<<shift);
     else  // direction == INPUT
         *(gpio_map+offset) = (*(gpio_map+offset) & ~(7<<shift));
+    pthread_mutex_unlock(&setup_mutex);
 }
 
 // Contribution by Eric Ptak <trouch@trouch.com>
@@ -273,6 +352,19 @@ void gpio_output(int gpio, int value)
     shift = (gpio%32);
 
     *(gpio_map+offset) = 1 << shift;
+    if (simulated)
+        simulate_output(gpio/32, value ? (1 << shift) : 0, value ? 0 : (1 << shift));
+}
+
+// Set and clear multiple pins in one 32-pin bank with a single GPSET and GPCLR write
+void gpio_output_bank(int bank, uint32_t set, uint32_t clear)
+{
+    if (set)
+        *(gpio_map+SET_OFFSET+bank) = set;
+    if (clear)
+        *(gpio_map+CLR_OFFSET+bank) = clear;
+    if (simulated)
+        simulate_output(bank, set, clear);
 }
 
 int gpio_input(int gpio)
@@ -286,9 +378,21 @@ int gpio_input(int gpio)
    return (value > 0);
 }
 
+// Read the levels of all pins in one 32-pin bank with a single GPLEV read
+uint32_t gpio_input_bank(int bank)
+{
+   return *(gpio_map+PINLEVEL_OFFSET+bank);
+}
+
 void gpio_cleanup(void)
 {
-    if(gpio_map != NULL)
+    if(simulated)
+    {
+        free((void *)gpio_map);
+        gpio_map = NULL;
+        simulated = 0;
+    }
+    else if(gpio_map != NULL)
     {
         // fixme - set all gpios back to input
         munmap((caddr_t)gpio_map, BLOCK_SIZE);
@@ -307,6 +411,14 @@ HwInfo HardwareInfo(void)
 
    char term;
 
+   if (simulated)
+   {
+       // Pretend to be a Pi 2, which has the most pins
+       strcpy(hwdesc.hw, "BCM2709");
+       hwdesc.rev = 0xa21041;
+       return hwdesc;
+   }
+
    filp = fopen ("/proc/cpuinfo", "r");
 
    if (filp != NULL)
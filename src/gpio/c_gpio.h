@@ -38,7 +38,9 @@ int gpio_init(void);
 void gpio_setup(int gpio, int direction, int pud);
 int gpio_function(int gpio);
 void gpio_output(int gpio, int value);
+void gpio_output_bank(int bank, uint32_t set, uint32_t clear);
 int gpio_input(int gpio);
+uint32_t gpio_input_bank(int bank);
 void gpio_set_pullupdn(int gpio, int pud);
 void gpio_set_rising_event(int gpio, int enable);
 void gpio_set_falling_event(int gpio, int enable);
@@ -47,6 +49,15 @@ void gpio_set_low_event(int gpio, int enable);
 int gpio_eventdetected(int gpio);
 void gpio_cleanup(void);
 
+// Simulated mode: the registers are an ordinary block of memory instead of the mapped peripheral.
+// Outputs change the pin levels, and inputs can be driven with gpio_simulate_input.
+typedef void (*gpio_output_hook)(int bank, uint32_t changed, uint32_t levels);
+int gpio_init_simulated(void);
+int gpio_simulated(void);
+void gpio_simulate_input(int gpio, int value);
+// Called after outputs in a bank changed level, with the bits that changed and the new levels of the bank
+void gpio_set_output_hook(gpio_output_hook hook);
+
 #define GPIO_SETUP_OK          0
 #define GPIO_SETUP_DEVMEM_FAIL 1
 #define GPIO_SETUP_MALLOC_FAIL 2
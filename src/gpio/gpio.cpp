@@ -11,6 +11,8 @@
 #include "gpio.hpp"
 #include "c_gpio.h"
 #include "../log/log.hpp"
+#include "../trace/trace.h"
+#include "../simulator/simulator.hpp"
 #include <iostream>
 
 
@@ -19,7 +21,7 @@
 #define GPIO_21_27_R1     21      /*!< \def Gpio pin 21/27 (rev1/rev2) with rev2 board code */
 
 #define RDBUF_LEN	      10      // length of read buffer
-#define POLL_TIMEOUT     100      // timeout for polling function in ms (also the maximum delay time before thread is stopped
+#define POLL_TIMEOUT     100      // timeout for polling function in ms, only used when the thread has no wakeup fd to stop it
 
 
 #define FALSE           0
@@ -55,14 +57,24 @@ GpioPin::GpioPin(int gpiopin, GpioDirection direction, GpioEdge edge)
     if(pin_id < 0)
         throw OperationFailedException("Gpio pin %d is not a valid Gpio for this Raspberry Pi board revision",gpiopin);
     
-    // ensure that the Gpio pin is exported
-    try
+    // On simulated hardware there is nothing to export
+    simulated = Simulator::Enabled();
+    simEdge = kEdgeNone;
+    if(simulated)
     {
-        pinPreExported = !(exportPin(pin_id));
+        pinPreExported = true;
     }
-    catch(OperationFailedException x)
+    else
     {
-        throw x;
+        // ensure that the Gpio pin is exported
+        try
+        {
+            pinPreExported = !(exportPin(pin_id));
+        }
+        catch(OperationFailedException x)
+        {
+            throw x;
+        }
     }
 
     // Prepare the iopin object
@@ -91,12 +103,19 @@ GpioPin::GpioPin(int gpiopin, GpioDirection direction, GpioEdge edge)
             unexportPin(pin);
         throw x;
     }
+
+    Stats::Instance().Register("interrupt.latency", &this->interruptLatency);
+    Stats::Instance().Register("interrupt.handler", &this->handlerTime);
 }
 
 
 //! Close the IOPin connection
 GpioPin::~GpioPin()
 {
+    // Join the listener thread first, it uses everything below
+    InterruptStop();
+    Stats::Instance().Unregister(&this->interruptLatency);
+    Stats::Instance().Unregister(&this->handlerTime);
     if(!pinPreExported)
         unexportPin(pin);
 }
@@ -110,6 +129,8 @@ int GpioPin::getPinNr()
 //! Get current direction of pin
 GpioDirection GpioPin::getDirection()
 {
+    if(simulated)
+        return (gpio_function(this->pin) == 1) ? kDirectionOut : kDirectionIn;
     
     std::string s = readFile(fnDirection);
     // got enough info in the first byte
@@ -122,6 +143,11 @@ GpioDirection GpioPin::getDirection()
 //! Set new value of pin
 void GpioPin::setDirection(GpioDirection direction)
 {
+    if(simulated)
+    {
+        gpio_setup(this->pin, (direction == kDirectionOut) ? GPIO_OUTPUT : GPIO_INPUT, GPIO_PUD_OFF);
+        return;
+    }
          if (direction == kDirectionIn)     writeFile(fnDirection,"in\n");
     else if (direction == kDirectionOut)    writeFile(fnDirection,"out\n");
 }
@@ -129,6 +155,8 @@ void GpioPin::setDirection(GpioDirection direction)
 //! Get current edge detection type
 GpioEdge GpioPin::getEdge()
 {
+    if(simulated)
+        return simEdge;
     std::string s = readFile(fnEdge);
 	switch(s[0]) // as the first letters of each result are all different
     {
@@ -152,6 +180,11 @@ GpioEdge GpioPin::getEdge()
 //! Set edge detection type
 void GpioPin::setEdge(GpioEdge edge)
 {
+    if(simulated)
+    {
+        simEdge = edge;
+        return;
+    }
          if (edge == kEdgeNone)     writeFile(fnEdge,"none\n"); 
     else if (edge == kEdgeRising)   writeFile(fnEdge,"rising\n"); 
     else if (edge == kEdgeFalling)  writeFile(fnEdge,"falling\n"); 
@@ -188,6 +221,8 @@ void GpioPin::setPullDown(bool pd)
 //! Get current value of pin
 bool GpioPin::getValue()
 {
+    if(simulated)
+        return (gpio_input(this->pin) != 0);
     std::string s = readFile(fnValue);
     // got enough info in the first byte
 	//if(gpio_input(this->pin) 
@@ -205,6 +240,30 @@ void GpioPin::setValue(bool value)
     //else        writeFile(fnValue,"0\n");
 }
 
+uint64_t GpioPin::getMaskedValues(uint64_t mask)
+{
+    // One GPLEV read per 32-pin bank
+    uint64_t values = 0;
+    for(int bank = 0; bank < 2; bank++)
+    {
+        if((uint32_t)(mask >> (32*bank)) != 0)
+            values |= ((uint64_t)gpio_input_bank(bank)) << (32*bank);
+    }
+    return values & mask;
+}
+
+void GpioPin::setMaskedValues(uint64_t mask, uint64_t values)
+{
+    // One GPSET/GPCLR write pair per 32-pin bank
+    for(int bank = 0; bank < 2; bank++)
+    {
+        uint32_t bmask = (uint32_t)(mask >> (32*bank));
+        uint32_t bvalues = (uint32_t)(values >> (32*bank));
+        if(bmask != 0)
+            gpio_output_bank(bank, bvalues & bmask, ~bvalues & bmask);
+    }
+}
+
 
 
 /****************************
@@ -233,17 +292,29 @@ void GpioPin::InterruptStop()
 void GpioPin::ThreadFunc()
 {
 	int fd,ret;
-	struct pollfd pfd;
+	struct pollfd pfd[2];
 	char rdbuf[RDBUF_LEN];
 
 	memset(rdbuf, 0x00, RDBUF_LEN);
 
+	ApplyProfile("interrupt");
+
+	if(simulated)
+	{
+		simulatedInterrupts();
+		return;
+	}
+
 	fd=open(fnValue.c_str(), O_RDONLY);
 	if(fd<0)
         throw OperationFailedException("Could not open file %s for reading: [%d] %s",fnValue.c_str(), errno, strerror(errno));
 
-	pfd.fd=fd;
-	pfd.events=POLLPRI;
+	pfd[0].fd=fd;
+	pfd[0].events=POLLPRI;
+	// A stop request wakes the poll, so it only needs a timeout if there is no wakeup fd
+	pfd[1].fd=ThreadWakeFd();
+	pfd[1].events=POLLIN;
+	int timeout = (pfd[1].fd >= 0) ? -1 : POLL_TIMEOUT;
 	
 	ret=read(fd, rdbuf, RDBUF_LEN-1);
 	if(ret<0)
@@ -256,7 +327,9 @@ void GpioPin::ThreadFunc()
     {
 		memset(rdbuf, 0x00, RDBUF_LEN);
 		lseek(fd, 0, SEEK_SET);
-		ret=poll(&pfd, 1, POLL_TIMEOUT);
+		ret=poll(pfd, 2, timeout);
+		if(ret<0 && errno == EINTR)
+			continue;
 		if(ret<0)   // negative result is error
         {
             close(fd);
@@ -265,7 +338,11 @@ void GpioPin::ThreadFunc()
         
 		if(ret==0) 
 			continue; // 0 bytes read is timeout, we should retry read
+		if(pfd[1].revents & POLLIN)
+			break;    // Asked to stop
         // ok, poll succeesed, now we read the value
+		uint64_t woken = Histogram::Now();
+		TRACE_INSTANT("gpio.wake");
 		ret=read(fd, rdbuf, RDBUF_LEN-1);
 		if(ret<0)
         {
@@ -278,12 +355,62 @@ void GpioPin::ThreadFunc()
             break;
         // Continue with doing the callback, if we're still enabled.
         // Now, rdbuf[0] contains 0 or 1 depending on the trigger
+        uint64_t handlerStart = Histogram::Now();
         onInterrupt(this, kEdgeFalling, !(rdbuf[0] == '0'));
+        this->handlerTime.RecordSince(handlerStart);
+        this->interruptLatency.RecordSince(woken);
 	}
 	close(fd);
     
 }
 
+// Interrupt loop on simulated hardware: the simulator signals an eventfd on the edges of the pin
+void GpioPin::simulatedInterrupts()
+{
+	struct pollfd pfd[2];
+	uint64_t events;
+	int ret;
+
+	pfd[0].fd=Simulator::Instance().Listen(pin, simEdge);
+	pfd[0].events=POLLIN;
+	if(pfd[0].fd<0)
+        throw OperationFailedException("Could not listen to simulated gpio %d: [%d] %s", pin, errno, strerror(errno));
+	pfd[1].fd=ThreadWakeFd();
+	pfd[1].events=POLLIN;
+	int timeout = (pfd[1].fd >= 0) ? -1 : POLL_TIMEOUT;
+
+	while(ThreadRunning())
+    {
+		ret=poll(pfd, 2, timeout);
+		if(ret<0 && errno == EINTR)
+			continue;
+		if(ret<0)
+        {
+            Simulator::Instance().Unlisten(pfd[0].fd);
+            throw OperationFailedException("Could not poll simulated gpio %d: [%d] %s", pin, errno, strerror(errno));
+        }
+		if(ret==0)
+			continue;
+		if(pfd[1].revents & POLLIN)
+			break;    // Asked to stop
+
+		uint64_t woken = Histogram::Now();
+		TRACE_INSTANT("gpio.wake");
+		// Edges that came in while the handlers ran are folded into one interrupt, like sysfs does
+		if(read(pfd[0].fd, &events, sizeof(events)) != sizeof(events))
+			continue;
+		Simulator::Instance().Acknowledge(pfd[0].fd, events);
+        if(!ThreadRunning())
+            break;
+
+        uint64_t handlerStart = Histogram::Now();
+        onInterrupt(this, kEdgeFalling, (gpio_input(pin) != 0));
+        this->handlerTime.RecordSince(handlerStart);
+        this->interruptLatency.RecordSince(woken);
+	}
+	Simulator::Instance().Unlisten(pfd[0].fd);
+}
+
 
 
 
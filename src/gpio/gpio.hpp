@@ -3,8 +3,10 @@
 
 #include "../exception/baseexceptions.hpp"
 #include "../thread/thread.hpp"
+#include "../stats/stats.hpp"
 
 #include <boost/signals2.hpp>
+#include <stdint.h>
 
 /*! \file Gpio interrupt capture functions. Header file.
 */
@@ -87,6 +89,10 @@ class GpioPin : public Thread
         bool getValue();
         //! Set new value of pin
         void setValue(bool value);
+        //! Set new values for all pins in mask (bit n is gpio pin n) at once
+        static void setMaskedValues(uint64_t mask, uint64_t values);
+        //! Get current values of all pins in mask (bit n is gpio pin n) at once
+        static uint64_t getMaskedValues(uint64_t mask);
         
         
 
@@ -114,10 +120,17 @@ class GpioPin : public Thread
         std::string     fnEdge;         // File name for Edge file
         std::string     fnValue;        // File name for Value file
         bool            pinPreExported;                 // Bool indicates if the pin was already exported
+        bool            simulated;                      // Simulated hardware, the sysfs files are not used
+        GpioEdge        simEdge;                        // Edge detection type of a simulated pin
+        Histogram       interruptLatency;               // From the poll waking up to the handlers being done
+        Histogram       handlerTime;                    // Time spent in the onInterrupt handlers
 
         
 
 
+        //! Interrupt loop for simulated hardware, run from ThreadFunc
+        void simulatedInterrupts();
+
         //! Export a certain Gpio pin
         static bool exportPin(int gpiopin);
 
@@ -1,37 +1,49 @@
 #include "gpioregistry.hpp"
 #include "gpio/gpio.hpp"
+#include "thread/thread.hpp"
+#include <vector>
+#include <boost/algorithm/string.hpp>
 
 using namespace std;
 
 GpioRegistry::GpioRegistry()
 {
-
+    Thread::InitMutex(&this->mutex);
 }
 
 GpioRegistry::~GpioRegistry()
 {
-
+    pthread_mutex_destroy(&this->mutex);
 }
 
 bool GpioRegistry::requestExclusiveLease(uint16_t pin, std::string &user, std::string &usage)
 {
+    bool result;
+    
+    pthread_mutex_lock(&this->mutex);
     if(!GpioPin::CheckPin(pin) || this->exclusiveLease.count(pin) > 0 || this->sharedLease.count(pin) > 0)
     {
-        return false;
+        result = false;
     }
     else
     {
+        this->exclusiveLease.insert(pin);
         this->leasers[pin] = user;
         this->usages[pin] = usage;
-        return true;
+        result = true;
     }
+    pthread_mutex_unlock(&this->mutex);
+    return result;
 }
 
 bool GpioRegistry::requestSharedLease(uint16_t pin, std::string &user, std::string &usage)
 {
+    bool result;
+    
+    pthread_mutex_lock(&this->mutex);
     if(!GpioPin::CheckPin(pin) || this->exclusiveLease.count(pin) > 0 )
     {
-        return false;
+        result = false;
     }
     else
     {
@@ -42,59 +54,107 @@ bool GpioRegistry::requestSharedLease(uint16_t pin, std::string &user, std::stri
         }
         else
         {
+            this->sharedLease.insert(pin);
             this->leasers[pin] = user;
             this->usages[pin]  = usage;
         }
-        return true;
+        result = true;
     }
+    pthread_mutex_unlock(&this->mutex);
+    return result;
 }
 
 bool GpioRegistry::isExclusivelyLeased(uint16_t pin)
 {
-    if(this->exclusiveLease.count(pin) > 0)
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    pthread_mutex_lock(&this->mutex);
+    bool result = (this->exclusiveLease.count(pin) > 0);
+    pthread_mutex_unlock(&this->mutex);
+    return result;
 }
 
 std::string GpioRegistry::getCurrentLeaser(uint16_t pin)
 {
+    std::string result;
+    
+    pthread_mutex_lock(&this->mutex);
     if(GpioPin::CheckPin(pin))
     {
         if(this->exclusiveLease.count(pin) > 0 || this->sharedLease.count(pin) > 0)
         {
-            return this->leasers[pin];
+            result = this->leasers[pin];
         }
         else
         {
-            return "no one";
+            result = "no one";
         }
     }
     else
     {
-        return "n/a";
+        result = "n/a";
     }
+    pthread_mutex_unlock(&this->mutex);
+    return result;
 }
 
 std::string GpioRegistry::getCurrentUsage(uint16_t pin)
 {
+    std::string result;
+    
+    pthread_mutex_lock(&this->mutex);
     if(GpioPin::CheckPin(pin))
     {
         if(this->exclusiveLease.count(pin) > 0 || this->sharedLease.count(pin) > 0)
         {
-            return this->usages[pin] ;
+            result = this->usages[pin];
         }
         else
         {
-            return "pin unclaimed";
+            result = "pin unclaimed";
         }
     }
     else
     {
-        return "Invalid pin number";
+        result = "Invalid pin number";
+    }
+    pthread_mutex_unlock(&this->mutex);
+    return result;
+}
+
+void GpioRegistry::releaseLeases(const std::string &user)
+{
+    pthread_mutex_lock(&this->mutex);
+    std::map<uint16_t, std::string>::iterator it = this->leasers.begin();
+    while(it != this->leasers.end())
+    {
+        uint16_t pin = it->first;
+        // Shared leases keep their users and usages as comma separated lists, in the same order
+        std::vector<std::string> users, usages;
+        boost::split(users, it->second, boost::is_any_of(","));
+        boost::split(usages, this->usages[pin], boost::is_any_of(","));
+        
+        std::string newUsers, newUsages;
+        for(std::vector<std::string>::size_type i = 0; i != users.size(); i++)
+        {
+            if(boost::trim_copy(users[i]) != user)
+            {
+                newUsers += (newUsers.empty() ? "" : ", ") + boost::trim_copy(users[i]);
+                newUsages += (newUsages.empty() ? "" : ", ") + (i < usages.size() ? boost::trim_copy(usages[i]) : std::string());
+            }
+        }
+        
+        ++it;
+        if(newUsers.empty())
+        {
+            this->leasers.erase(pin);
+            this->usages.erase(pin);
+            this->exclusiveLease.erase(pin);
+            this->sharedLease.erase(pin);
+        }
+        else
+        {
+            this->leasers[pin] = newUsers;
+            this->usages[pin] = newUsages;
+        }
     }
-}
\ No newline at end of file
+    pthread_mutex_unlock(&this->mutex);
+}
@@ -5,6 +5,7 @@
 #include <string>
 #include <map>
 #include <set>
+#include <pthread.h>
 
 class GpioRegistry 
 {
@@ -18,6 +19,8 @@ public:
     std::string getCurrentLeaser(uint16_t pin);
     std::string getCurrentUsage(uint16_t pin);
     bool isExclusivelyLeased(uint16_t pin);
+    //! Release all leases held by a user
+    void releaseLeases(const std::string &user);
     
 
 private:
@@ -25,6 +28,7 @@ private:
     std::map<uint16_t, std::string> usages;
     std::set<uint16_t> exclusiveLease;
     std::set<uint16_t> sharedLease;
+    pthread_mutex_t mutex;
 };
 
 #endif//__IOGROUP_BASE_HPP
\ No newline at end of file
@@ -10,8 +10,21 @@
 #include <unistd.h>
 
 #include "i2c.h"
+#include "../trace/trace.h"
 
 static unsigned int HardwareRevision(void);
+static int failed(int error);
+
+volatile uint64_t i2cTransfers = 0;
+volatile uint64_t i2cErrors = 0;
+
+static const struct i2c_sim_ops *sim = NULL;
+
+static int failed(int error)
+{
+	__sync_fetch_and_add(&i2cErrors, 1);
+	return error;
+}
 
 static unsigned int HardwareRevision(void)
 {
@@ -42,11 +55,19 @@ static unsigned int HardwareRevision(void)
    return rev;
 }
 
+void i2cSimulate(const struct i2c_sim_ops *ops)
+{
+	sim = ops;
+}
+
 int i2cInit(unsigned char address)
 {
 	int fd;														// File descrition
 	char *fileName = "/dev/i2c-1";								// Name of the port we will be using (using revision 2 board's /dev/i2c-1 by default)
 
+	if (sim != NULL)
+		return sim->open(address);
+
 	unsigned int rev = HardwareRevision();
 	if (rev < 4){												// Switch to revision 1 board's /dev/i2c-0 if revision number is below 4;
 		strcpy(fileName,"/dev/i2c-0");
@@ -65,20 +86,27 @@ int i2cInit(unsigned char address)
 
 void i2cClose(int fd)
 {
-    close(fd);
+    if (sim != NULL)
+        sim->close(fd);
+    else
+        close(fd);
 }
 
 int i2cReadReg8(int fd, unsigned char reg)
 {
+	TRACE_SCOPE("i2c.read8");
 	unsigned char buf[1];										// Buffer for data being read/ written on the i2c bus
+	__sync_fetch_and_add(&i2cTransfers, 1);
+	if (sim != NULL)
+		return (sim->read(fd, reg, buf, 1) < 0) ? failed(-2) : buf[0];
 	buf[0] = reg;													// This is the register we wish to read from
 	
 	if ((write(fd, buf, 1)) != 1) {								// Send register to read from
-		return -1;
+		return failed(-1);
 	}
 	
 	if (read(fd, buf, 1) != 1) {								// Read back data into buf[]
-		return -2;
+		return failed(-2);
 	}
 	
 	return buf[0];
@@ -86,27 +114,35 @@ int i2cReadReg8(int fd, unsigned char reg)
 
 int i2cWriteReg8(int fd, unsigned char reg, unsigned char value)
 {
+	TRACE_SCOPE("i2c.write8");
 	unsigned char buf[2];
+	__sync_fetch_and_add(&i2cTransfers, 1);
+	if (sim != NULL)
+		return (sim->write(fd, reg, &value, 1) < 0) ? failed(-1) : 0;
 	buf[0] = reg;													// Commands for performing a ranging on the SRF08
 	buf[1] = value;
 	
 	if ((write(fd, buf, 2)) != 2) {								// Write commands to the i2c port
-		return -1;
+		return failed(-1);
 	}
 	return 0;
 }
 
 int i2cReadReg16(int fd, unsigned char reg)
 {
+	TRACE_SCOPE("i2c.read16");
 	unsigned char buf[2];										// Buffer for data being read/ written on the i2c bus
+	__sync_fetch_and_add(&i2cTransfers, 1);
+	if (sim != NULL)
+		return (sim->read(fd, reg, buf, 2) < 0) ? failed(-2) : ((int)(buf[1] << 8) | (int)buf[0]);
 	buf[0] = reg;													// This is the register we wish to read from
 	
 	if ((write(fd, buf, 1)) != 1) {								// Send register to read from
-		return -1;
+		return failed(-1);
 	}
 	
 	if (read(fd, buf, 2) != 2) {								// Read back data into buf[]
-		return -2;
+		return failed(-2);
 	}
 	return (int)(buf[1] << 8) | (int)buf[0];
 	
@@ -115,13 +151,17 @@ int i2cReadReg16(int fd, unsigned char reg)
 
 int i2cWriteReg16(int fd, unsigned char reg,unsigned short value)
 {
+	TRACE_SCOPE("i2c.write16");
 	unsigned char buf[3];
+	__sync_fetch_and_add(&i2cTransfers, 1);
 	buf[0] = reg;													// Commands for performing a ranging on the SRF08
 	buf[1] = (unsigned char)( ( value >> 0 ) & 0xFF );
 	buf[2] = (unsigned char)( ( value >> 8 ) & 0xFF ); 
+	if (sim != NULL)
+		return (sim->write(fd, reg, buf+1, 2) < 0) ? failed(-1) : 0;
 	
 	if ((write(fd, buf, 3)) != 3) {								// Write commands to the i2c port
-		return -1;
+		return failed(-1);
 	}
 	return 0;
 }
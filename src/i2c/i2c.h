@@ -1,10 +1,16 @@
 #ifndef __USER_I2C_H__
 #define __USER_I2C_H__
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Number of register reads and writes, and how many of them failed, on all buses
+extern volatile uint64_t i2cTransfers;
+extern volatile uint64_t i2cErrors;
+
 int i2cInit(unsigned char address);
 void i2cClose(int fd);
 int i2cReadReg8(int fd, unsigned char reg);
@@ -12,6 +18,18 @@ int i2cWriteReg8(int fd, unsigned char reg, unsigned char value);
 int i2cReadReg16(int fd, unsigned char reg);
 int i2cWriteReg16(int fd, unsigned char reg,unsigned short value);
 
+// Device models to use instead of the i2c bus, for the simulated mode. Open returns a file descriptor 
+// like i2cInit, read and write transfer len bytes starting at a register and return 0 or a negative error
+struct i2c_sim_ops
+{
+    int (*open)(unsigned char address);
+    void (*close)(int fd);
+    int (*read)(int fd, unsigned char reg, unsigned char *buf, int len);
+    int (*write)(int fd, unsigned char reg, const unsigned char *buf, int len);
+};
+
+void i2cSimulate(const struct i2c_sim_ops *ops);
+
 #ifdef __cplusplus
 }
 #endif
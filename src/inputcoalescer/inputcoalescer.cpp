@@ -0,0 +1,165 @@
+#include "inputcoalescer.hpp"
+#include "../trace/trace.h"
+
+#include <time.h>
+#include <boost/bind.hpp>
+
+InputCoalescer::InputCoalescer()
+{
+    timer = 0;
+    timerAt = 0;
+    stopping = false;
+    Thread::InitMutex(&mutex);
+}
+
+InputCoalescer::~InputCoalescer()
+{
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_mutex_unlock(&mutex);
+    
+    // Makes sure no flush is running anymore
+    TimerService::Instance().CancelAll(this);
+    pthread_mutex_destroy(&mutex);
+}
+
+void InputCoalescer::Configure(uint16_t id, uint32_t window_ms, uint32_t min_interval_ms)
+{
+    Entry e;
+    e.window = window_ms;
+    e.interval = min_interval_ms;
+    e.pending = false;
+    e.value = 0;
+    e.timestamp = 0;
+    e.flushAt = 0;
+    e.lastFlush = 0;
+    e.flushed = false;
+    e.lastValue = 0;
+
+    pthread_mutex_lock(&mutex);
+    entries[id] = e;
+    pthread_mutex_unlock(&mutex);
+}
+
+bool InputCoalescer::IsCoalesced(uint16_t id)
+{
+    bool result;
+    pthread_mutex_lock(&mutex);
+    result = (entries.count(id) > 0);
+    pthread_mutex_unlock(&mutex);
+    return result;
+}
+
+void InputCoalescer::RegisterChange(uint16_t id, uint32_t value)
+{
+    int64_t now = now_ms();
+    pthread_mutex_lock(&mutex);
+    
+    std::map<uint16_t, Entry>::iterator it = entries.find(id);
+    if(it != entries.end())
+    {
+        Entry &e = it->second;
+        e.value = value;
+        e.timestamp = now_us_realtime();
+        
+        if(!e.pending)
+        {
+            // Open a new window, but never flush sooner than the rate limit allows
+            e.pending = true;
+            e.flushAt = now + e.window;
+            if(e.flushed && e.lastFlush + e.interval > e.flushAt)
+            {
+                e.flushAt = e.lastFlush + e.interval;
+            }
+            scheduleFlush(e.flushAt);
+        }
+    }
+    
+    pthread_mutex_unlock(&mutex);
+}
+
+void InputCoalescer::scheduleFlush(int64_t flushAt)
+{
+    if(stopping || (timer != 0 && timerAt <= flushAt))
+        return;
+    
+    // An earlier window was opened than the timer is set for
+    if(timer != 0)
+        TimerService::Instance().Cancel(timer);
+    
+    int64_t now = now_ms();
+    timerAt = flushAt;
+    timer = TimerService::Instance().Schedule((flushAt > now) ? (uint32_t)(flushAt - now) : 0, boost::bind(&InputCoalescer::flush, this), this);
+}
+
+void InputCoalescer::flush()
+{
+    TRACE_SCOPE("coalescer.flush");
+    std::vector<CoalescedChange> batch;
+    int64_t now = now_ms();
+    int64_t next = 0;
+    
+    pthread_mutex_lock(&mutex);
+    if(timer != 0 && timerAt <= now)
+    {
+        // This is the timer that was set
+        timer = 0;
+    }
+    
+    for(std::map<uint16_t, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        Entry &e = it->second;
+        if(!e.pending)
+            continue;
+        
+        if(e.flushAt <= now)
+        {
+            e.pending = false;
+            e.lastFlush = now;
+            
+            // Skip the flush if the input ended up at the value that was last passed on
+            if(!e.flushed || e.value != e.lastValue)
+            {
+                CoalescedChange c;
+                c.id = it->first;
+                c.value = e.value;
+                c.timestamp = e.timestamp;
+                batch.push_back(c);
+                
+                e.flushed = true;
+                e.lastValue = e.value;
+            }
+        }
+        else if(next == 0 || e.flushAt < next)
+        {
+            next = e.flushAt;
+        }
+    }
+    
+    if(next != 0)
+    {
+        scheduleFlush(next);
+    }
+    pthread_mutex_unlock(&mutex);
+    
+    if(batch.size() > 0)
+    {
+        onFlush(batch);
+    }
+}
+
+int64_t InputCoalescer::now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((int64_t)now.tv_sec)*1000LL + (now.tv_nsec/1000000);
+}
+
+uint64_t InputCoalescer::now_us_realtime(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return ((uint64_t)now.tv_sec)*1000000ULL + (now.tv_nsec/1000);
+}
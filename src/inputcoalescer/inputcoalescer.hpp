@@ -0,0 +1,68 @@
+#ifndef __INPUTCOALESCER_HPP
+#define __INPUTCOALESCER_HPP
+
+#include "../timerservice/timerservice.hpp"
+#include <stdint.h>
+#include <pthread.h>
+#include <boost/signals2.hpp>
+
+#include <map>
+#include <vector>
+
+// A single coalesced input change, as passed to onFlush
+struct CoalescedChange
+{
+    uint16_t id;
+    uint32_t value;         // Latest value in the window
+    uint64_t timestamp;     // Time of the latest change, in microseconds since the epoch
+};
+
+// Collects input changes per id and passes on only the latest value of each id, at most
+// once per coalescing window and no more often than the configured rate limit allows.
+// All changes that become due at the same time are passed on in one onFlush call, from the timer service thread.
+class InputCoalescer
+{
+    public:
+        InputCoalescer();
+        ~InputCoalescer();
+        
+        //! Enable coalescing for an id. Changes are held for window_ms after the first change, and 
+        //! flushes are spaced at least min_interval_ms apart
+        void Configure(uint16_t id, uint32_t window_ms, uint32_t min_interval_ms);
+        //! Check if coalescing is enabled for an id
+        bool IsCoalesced(uint16_t id);
+        //! Register a changed value for an id
+        void RegisterChange(uint16_t id, uint32_t value);
+        
+        boost::signals2::signal<void (std::vector<CoalescedChange>)> onFlush;
+    
+    private:
+        struct Entry
+        {
+            uint32_t window;
+            uint32_t interval;
+            bool pending;           // A window is open for this id
+            uint32_t value;
+            uint64_t timestamp;
+            int64_t flushAt;
+            int64_t lastFlush;
+            bool flushed;           // A value was passed on before
+            uint32_t lastValue;     // Last value that was passed on
+        };
+        
+        std::map<uint16_t, Entry> entries;
+        TimerService::TimerId timer;    // Timer for the earliest closing window, or 0
+        int64_t timerAt;
+        bool stopping;
+        pthread_mutex_t mutex;
+
+        // Pass on the changes of all windows that have closed
+        void flush();
+        // Make sure the timer fires for the window that closes at flushAt. Call with the mutex held
+        void scheduleFlush(int64_t flushAt);
+
+        static int64_t now_ms(void);
+        static uint64_t now_us_realtime(void);
+};
+
+#endif
@@ -1,4 +1,7 @@
 #include "iogroup-base.hpp"
+#include "trace/trace.h"
+
+using namespace std;
 
 
 IoGroupBase::IoGroupBase(DBus::Connection &connection,std::string &dbuspath, GpioRegistry &registry)
@@ -6,6 +9,12 @@ IoGroupBase::IoGroupBase(DBus::Connection &connection,std::string &dbuspath, Gpi
    gpioRegistry(registry)
 {
     this->path = DBus::Path(dbuspath);
+    this->subscriptions = NULL;
+    this->statePage = NULL;
+    this->eventStream = NULL;
+    this->eventGroupId = 0;
+    this->stateStore = NULL;
+    Thread::InitMutex(&this->propertyMutex);
 }
 
 void IoGroupBase::Initialize(libconfig::Setting &setting)
@@ -13,8 +22,15 @@ void IoGroupBase::Initialize(libconfig::Setting &setting)
     this->name = setting.getName();
 }
 
+void IoGroupBase::Start()
+{
+}
+
 IoGroupBase::~IoGroupBase()
 {
+    // Let a group created on a configuration reload use the pins again
+    this->gpioRegistry.releaseLeases(this->name);
+    pthread_mutex_destroy(&this->propertyMutex);
 
 }
 
@@ -34,3 +50,134 @@ DBus::Path IoGroupBase::Path()
     return this->path;
 }   
 
+void IoGroupBase::Subscriptions(SignalSubscriptions *s)
+{
+    this->subscriptions = s;
+}
+
+void IoGroupBase::PublishState(StatePage *page)
+{
+    this->statePage = page;
+}
+
+void IoGroupBase::PublishEvents(EventStream *stream)
+{
+    this->eventStream = stream;
+    if(stream != NULL)
+        this->eventGroupId = stream->GroupId(this->Name());
+}
+
+void IoGroupBase::PersistState(StateStore *store)
+{
+    this->stateStore = store;
+}
+
+std::map<std::string, std::vector<size_t> > IoGroupBase::batchRecipients(const std::vector<std::string> &handles, bool &broadcast)
+{
+    std::map<std::string, std::vector<size_t> > result;
+    broadcast = false;
+    
+    for(size_t i = 0; i < handles.size(); i++)
+    {
+        std::vector<std::string> recipients;
+        if(this->subscriptions == NULL || this->subscriptions->Recipients(this->Name(), handles[i], recipients))
+        {
+            if(recipients.empty())
+            {
+                broadcast = true;
+                return result;
+            }
+            
+            for(std::vector<std::string>::iterator it = recipients.begin(); it != recipients.end(); ++it)
+            {
+                result[*it].push_back(i);
+            }
+        }
+    }
+    return result;
+}
+
+::DBus::Variant IoGroupBase::Get(const std::string& interface, const std::string& name)
+{
+    std::map< std::string, ::DBus::Variant > all = this->GetAll(interface);
+    std::map< std::string, ::DBus::Variant >::iterator it = all.find(name);
+    if(it == all.end())
+    {
+        clog << kLogWarning << this->Name() << ": Attempt to get nonexisting property '" << interface << "." << name << "'" << endl;
+        throw ::DBus::ErrorInvalidArgs("No such property");
+    }
+    return it->second;
+}
+
+std::map< std::string, ::DBus::Variant > IoGroupBase::GetAll(const std::string& interface)
+{
+    if(interface == this->Interface())
+    {
+        // Read all inputs in a single go
+        return this->properties(true);
+    }
+    else
+    {
+        return std::map< std::string, ::DBus::Variant >();
+    }
+}
+
+void IoGroupBase::Set(const std::string& interface, const std::string& name, const ::DBus::Variant& value)
+{
+    if(interface == this->Interface())
+    {
+        this->setProperty(name, value);
+    }
+    else
+    {
+        clog << kLogWarning << this->Name() << ": Attempt to set nonexisting property '" << interface << "." << name << "'" << endl;
+        throw ::DBus::ErrorInvalidArgs("No such property");
+    }
+}
+
+void IoGroupBase::FlushPropertyChanges()
+{
+    TRACE_SCOPE("dbus.properties");
+    std::set<std::string> dirty;
+    
+    pthread_mutex_lock(&this->propertyMutex);
+    dirty.swap(this->dirtyProperties);
+    pthread_mutex_unlock(&this->propertyMutex);
+    
+    if(dirty.empty())
+        return;
+    
+    std::map< std::string, ::DBus::Variant > all = this->properties(false);
+    std::map< std::string, ::DBus::Variant > changed;
+    for(std::set<std::string>::iterator it = dirty.begin(); it != dirty.end(); ++it)
+    {
+        if(all.count(*it) > 0)
+            changed[*it] = all[*it];
+    }
+
+    this->PropertiesChanged(this->Interface(), changed, std::vector< std::string >());
+}
+
+std::map< std::string, ::DBus::Variant > IoGroupBase::properties(bool snapshot)
+{
+    return std::map< std::string, ::DBus::Variant >();
+}
+
+void IoGroupBase::setProperty(const std::string &name, const ::DBus::Variant &value)
+{
+    clog << kLogWarning << this->Name() << ": Attempt to set read-only property '" << name << "'" << endl;
+    throw ::DBus::ErrorAccessDenied("Property is read-only");
+}
+
+void IoGroupBase::propertyChanged(const std::string &name)
+{
+    bool first;
+    
+    pthread_mutex_lock(&this->propertyMutex);
+    first = this->dirtyProperties.empty();
+    this->dirtyProperties.insert(name);
+    pthread_mutex_unlock(&this->propertyMutex);
+    
+    if(first)
+        this->onPropertiesDirty(this);
+}
@@ -5,16 +5,23 @@
 #include <libconfig.h++>
 #include <dbus-c++/dbus.h>
 #include <boost/signals2.hpp>
+#include <pthread.h>
+#include <set>
 #include "exception/baseexceptions.hpp"
 #include "log/log.hpp"
 #include "pi-io-server-glue.hpp"
 #include "gpioregistry.hpp"
+#include "signalsubscriptions.hpp"
+#include "statepage/statepage.hpp"
+#include "eventstream/eventstream.hpp"
+#include "statestore/statestore.hpp"
 
 DefineNewMsgException(FeatureNotImplementedException);
 DefineNewMsgException(IoPinInvalidException);
 DefineNewMsgException(ConfigInvalidException);
 
 class IoGroupBase : public nl::miqra::PiIo::IoGroup_adaptor, // << This will be generated by the makefile using dbusxx-xml2cpp on pi-io-introspect.xml
+  public org::freedesktop::DBus::Properties_adaptor,
   public DBus::IntrospectableAdaptor,
   public DBus::ObjectAdaptor
 {
@@ -25,10 +32,31 @@ public:
     
     virtual void Initialize(libconfig::Setting &setting);
 
+    // Bring up the hardware configured in Initialize. Initialize only reads the settings and takes
+    // the pin leases, so that groups on different buses can be started concurrently
+    virtual void Start();
+
+    // Name of the bus the hardware of the group is on. Groups on the same bus are started one by one
+    virtual std::string Bus() { return ""; }
+
     // Return the name of this iogroup
     std::string Name();
     
     void Name(std::string s);
+
+    // Set the subscriptions used to decide where signals go. Without it, signals are broadcast.
+    void Subscriptions(SignalSubscriptions *s);
+
+    // Register the IOs of this group in the shared memory state page, and keep their values up to date in it
+    virtual void PublishState(StatePage *page);
+
+    // Register the IOs of this group with the binary event stream, and report their changes to it.
+    // NULL stops reporting to the stream, e.g. before it is deleted
+    virtual void PublishEvents(EventStream *stream);
+
+    // Restore the saved values of the outputs of this group from the state store, and keep them saved in it.
+    // Called after Initialize and before Start, so restored values become the initial values of the hardware
+    virtual void PersistState(StateStore *store);
     
     // Return the dbus path of the group
     DBus::Path Path();
@@ -38,12 +66,73 @@ public:
 
     boost::signals2::signal<void (IoGroupBase *, std::string)> onCriticalError;
 
+    // org.freedesktop.DBus.Properties on the group's interface
+    virtual ::DBus::Variant Get(const std::string& interface, const std::string& name);
+    virtual std::map< std::string, ::DBus::Variant > GetAll(const std::string& interface);
+    virtual void Set(const std::string& interface, const std::string& name, const ::DBus::Variant& value);
+
+    // Emit one PropertiesChanged signal for all properties changed since the last call. 
+    // Should be called from the dispatcher thread
+    void FlushPropertyChanges();
+    
+    // Fired when the first property changes after a flush
+    boost::signals2::signal<void (IoGroupBase *)> onPropertiesDirty;
+
 protected:
     GpioRegistry &gpioRegistry;
+    SignalSubscriptions *subscriptions;
+    StatePage *statePage;
+    EventStream *eventStream;
+    uint16_t eventGroupId;
+    StateStore *stateStore;
+
+    // Emit a signal about a handle on one of the group's interfaces, to the subscribed clients only
+    template<class T1> void emitSignal(DBus::InterfaceAdaptor &iface, const char *member, const std::string &handle, const T1 &a1)
+    {
+        std::vector<std::string> recipients;
+        if(this->subscriptions == NULL || this->subscriptions->Recipients(this->Name(), handle, recipients))
+            SignalSubscriptions::Send(iface, member, recipients, a1);
+    }
+
+    template<class T1, class T2> void emitSignal(DBus::InterfaceAdaptor &iface, const char *member, const std::string &handle, const T1 &a1, const T2 &a2)
+    {
+        std::vector<std::string> recipients;
+        if(this->subscriptions == NULL || this->subscriptions->Recipients(this->Name(), handle, recipients))
+            SignalSubscriptions::Send(iface, member, recipients, a1, a2);
+    }
+
+    template<class T1, class T2, class T3> void emitSignal(DBus::InterfaceAdaptor &iface, const char *member, const std::string &handle, const T1 &a1, const T2 &a2, const T3 &a3)
+    {
+        std::vector<std::string> recipients;
+        if(this->subscriptions == NULL || this->subscriptions->Recipients(this->Name(), handle, recipients))
+            SignalSubscriptions::Send(iface, member, recipients, a1, a2, a3);
+    }
+
+    // Override in child to return the properties of the group's interface. If snapshot is true, input
+    // states should be read from the hardware, otherwise the last known states can be used.
+    virtual std::map< std::string, ::DBus::Variant > properties(bool snapshot);
+    // Override in child to set a writable property. Throws a DBus error by default
+    virtual void setProperty(const std::string &name, const ::DBus::Variant &value);
+    // Call this function when a property has changed
+    void propertyChanged(const std::string &name);
+
+    template<class T> static ::DBus::Variant toVariant(const T &value)
+    {
+        ::DBus::Variant v;
+        ::DBus::MessageIter wi = v.writer();
+        wi << value;
+        return v;
+    }
+
+    // For signals carrying multiple handles: find which of the handles go to which client.
+    // Sets broadcast to true if all of them should be broadcast instead.
+    std::map<std::string, std::vector<size_t> > batchRecipients(const std::vector<std::string> &handles, bool &broadcast);
 
 private:
     std::string name;
     DBus::Path path;
+    std::set<std::string> dirtyProperties;
+    pthread_mutex_t propertyMutex;
 };
 
 #endif//__IOGROUP_BASE_HPP
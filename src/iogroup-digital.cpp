@@ -1,4 +1,5 @@
 #include "iogroup-digital.hpp"
+#include "trace/trace.h"
 #include <boost/algorithm/string.hpp>
 #include <algorithm>
 #include <vector>
@@ -10,15 +11,24 @@ using namespace libconfig;
 IoGroupDigital::IoGroupDigital(DBus::Connection &connection, std::string &dbuspath, GpioRegistry &registry) 
     : IoGroupBase(connection, dbuspath, registry)//, DBus::ObjectAdaptor(connection, dbuspath)
 {
-
+    this->btnTimer = NULL;
+    this->coalescer = NULL;
+    this->coalesceDefault = 0;
+    this->rateLimitDefault = 0;
 }
 
 void IoGroupDigital::Initialize(libconfig::Setting &setting)
 {
     IoGroupBase::Initialize(setting);
     
+    std::string labels = "group=\"" + this->Name() + "\"";
+    Stats::Instance().Register("piio_io_changes_total", labels, &this->ioChanges);
+    Stats::Instance().Register("piio_button_events_total", labels, &this->buttonEvents);
+
 	uint32_t time_shortPress = 25;
 	uint32_t time_longPress = 6000;
+	uint32_t time_multiTap = 0;
+	uint32_t time_repeat = 0;
 
     // Check if we have an IO, and if we have defined ios, otherwise just ignore everything here
     if(setting.exists("io"))
@@ -30,12 +40,19 @@ void IoGroupDigital::Initialize(libconfig::Setting &setting)
 			// Read button timer settings from setting
 			setting.lookupValue("button-shortpress-time",time_shortPress);
 			setting.lookupValue("button-longpress-time",time_longPress);
+			setting.lookupValue("button-multitap-time",time_multiTap);
+			setting.lookupValue("button-repeat-time",time_repeat);
+
+			// Read default input coalescing settings from setting
+			setting.lookupValue("input-coalesce-time",this->coalesceDefault);
+			setting.lookupValue("input-rate-limit",this->rateLimitDefault);
 
 			// Initialize button timer
-			this->btnTimer = new ButtonTimer(time_shortPress,time_longPress); // Short press should take at leas 25 ms, and a Long press takes 6 seconds
+			this->btnTimer = new ButtonTimer(time_shortPress,time_longPress,time_multiTap,time_repeat); // Short press should take at leas 25 ms, and a Long press takes 6 seconds
 			onShortPressConnection = this->btnTimer->onShortPress.connect(boost::bind(&IoGroupDigital::onShortPress, this, _1));
 			onLongPressConnection = this->btnTimer->onLongPress.connect(boost::bind(&IoGroupDigital::onLongPress, this, _1));
 			onValidatePressConnection = this->btnTimer->onValidatePress.connect(boost::bind(&IoGroupDigital::onValidatePress, this, _1));
+			onGestureConnection = this->btnTimer->onGesture.connect(boost::bind(&IoGroupDigital::onGesture, this, _1, _2, _3));
 
 			// Nofify subclass of start of configuration iteration
 			this->beginConfig(setting);
@@ -96,28 +113,50 @@ void IoGroupDigital::Initialize(libconfig::Setting &setting)
 
 }
 
+void IoGroupDigital::Start()
+{
+    IoGroupBase::Start();
+    
+    // Take the initial state of the inputs, for the properties
+    if(!this->ioTable.empty())
+        this->properties(true);
+
+    // Pwm values restored from the state store can only be applied once the hardware is up
+    for(std::vector<IoEntry>::iterator it = this->ioTable.begin(); it != this->ioTable.end(); ++it)
+    {
+        if(it->type == IoPwm && it->valueSet)
+            this->setPwm(it->pins[0], (uint8_t)it->value);
+    }
+}
+
 IoGroupDigital::~IoGroupDigital()
 {
+    Stats::Instance().Unregister(&this->ioChanges);
+    Stats::Instance().Unregister(&this->buttonEvents);
 	if (btnTimer != NULL)
 	{
 		delete btnTimer; 
 		btnTimer = NULL;
 	}
+	if (coalescer != NULL)
+	{
+		delete coalescer;
+		coalescer = NULL;
+	}
 }
 
 std::vector<std::string> IoGroupDigital::Buttons()
 {
-    std::vector<std::string> output(this->buttonList.begin(), this->buttonList.end());
-    return output;
+    return this->listIo(IoButton);
 }
 
 bool IoGroupDigital::GetButton(const std::string &handle)
 {
-    if(this->buttonList.count(handle) > 0)
+    IoEntry * io = this->findIo(handle, IoButton);
+    if(io != NULL)
     {
         clog << kLogDebug << this->Name() << ": Getting button state on handle '" << handle << "'" << endl;
-        uint16_t id = this->idMap[handle];
-        return this->getInputPin(id);
+        return this->getInputPin(io->pins[0]);
     }
     else
     {
@@ -128,17 +167,16 @@ bool IoGroupDigital::GetButton(const std::string &handle)
 
 std::vector<std::string> IoGroupDigital::Inputs()
 {
-    std::vector<std::string> output(this->inputList.begin(), this->inputList.end());
-    return output;
+    return this->listIo(IoInput);
 }
 
 bool IoGroupDigital::GetInput(const std::string &handle)
 {
-    if(this->inputList.count(handle) > 0)
+    IoEntry * io = this->findIo(handle, IoInput);
+    if(io != NULL)
     {
         clog << kLogDebug << this->Name() << ": Getting input on handle '" << handle << "'" << endl;
-        uint16_t id = this->idMap[handle];
-        return this->getInputPin(id);
+        return this->getInputPin(io->pins[0]);
     }
     else
     {
@@ -149,23 +187,23 @@ bool IoGroupDigital::GetInput(const std::string &handle)
 
 std::vector<std::string> IoGroupDigital::Outputs()
 {
-    std::vector<std::string> output(this->outputList.begin(), this->outputList.end());
-    return output;
+    return this->listIo(IoOutput);
 }
 
 void IoGroupDigital::SetOutput(const std::string &handle, const bool &value)
 {
-    if(this->outputList.count(handle) > 0)
+    IoEntry * io = this->findIo(handle, IoOutput);
+    if(io != NULL)
     {
-        if(value != this->outputValueMap[handle])
+        if(value != (bool)io->value)
         {
         
             clog << kLogDebug << this->Name() << ": Setting output on handle '" << handle << "' to '" << value << "'" << endl;
-            uint16_t id = this->idMap[handle];
-            this->setOutputPin(id,value);
-            this->outputValueMap[handle] = value;
+            this->setOutputPin(io->pins[0],value);
+            io->value = value;
             this->onOutputChanged(this,handle,value);
-            this->OutputChanged(handle,value);
+            this->ioValueChanged(io);
+            this->emitSignal(this->digitalAdaptor(),"OutputChanged",handle,handle,value);
         }
         else
         {
@@ -180,49 +218,105 @@ void IoGroupDigital::SetOutput(const std::string &handle, const bool &value)
 
 bool IoGroupDigital::GetOutput(const std::string &handle)
 {
-    if(this->outputList.count(handle) > 0)
+    IoEntry * io = this->findIo(handle, IoOutput);
+    if(io != NULL)
     {
         clog << kLogDebug << this->Name() << ": Getting output on handle '" << handle << "'" << endl;
-        if(this->outputValueMap.count(handle) > 0)
+        return (bool)io->value;
+    }
+    else
+    {
+        clog << kLogWarning << this->Name() << ": Attempt to call GetOuput for nonexisting handle '" << handle << "'" << endl;    
+        return false;
+    }
+}
+
+void IoGroupDigital::SetOutputs(const std::map< std::string, bool > &values)
+{
+    std::map<std::string, bool> changed;
+    std::vector<IoEntry*> changedIo;
+    uint64_t mask = 0;
+    uint64_t pinvalues = 0;
+    
+    // Resolve all handles first, so the outputs can be set in one go
+    for(std::map<std::string, bool>::const_iterator it = values.begin(); it != values.end(); ++it)
+    {
+        IoEntry * io = this->findIo(it->first, IoOutput);
+        if(io == NULL)
         {
-            return this->outputValueMap[handle];
+            clog << kLogWarning << this->Name() << ": Attempt to call SetOutputs for nonexisting handle '" << it->first << "'" << endl;
         }
-        else
+        else if(io->pins[0] >= 64)
         {
-            clog << kLogDebug << this->Name() << ": Debug - value not previously set for output handle '" << handle << "', returning false" << endl;
-            return false;
+            clog << kLogWarning << this->Name() << ": Output on handle '" << it->first << "' cannot be set in a batch" << endl;
+        }
+        else if(it->second != (bool)io->value)
+        {
+            mask |= ((uint64_t)1) << io->pins[0];
+            if(it->second)
+                pinvalues |= ((uint64_t)1) << io->pins[0];
+            changed[it->first] = it->second;
+            changedIo.push_back(io);
         }
     }
+    
+    if(mask == 0)
+    {
+        clog << kLogDebug << this->Name() << ": No change for outputs in SetOutputs" << endl;
+        return;
+    }
+    
+    clog << kLogDebug << this->Name() << ": Setting " << changed.size() << " outputs at once" << endl;
+    this->setOutputPins(mask, pinvalues);
+    
+    for(std::vector<IoEntry*>::iterator it = changedIo.begin(); it != changedIo.end(); ++it)
+    {
+        (*it)->value = changed[(*it)->handle];
+        this->ioValueChanged(*it);
+    }
+
+    this->onOutputsChanged(this,changed);
+
+    // Send each subscriber only the outputs it subscribed to
+    std::vector<std::string> handles;
+    for(std::map<std::string, bool>::iterator it = changed.begin(); it != changed.end(); ++it)
+    {
+        handles.push_back(it->first);
+    }
+    
+    bool broadcast;
+    std::map<std::string, std::vector<size_t> > recipients = this->batchRecipients(handles, broadcast);
+    if(broadcast)
+    {
+        SignalSubscriptions::Send(this->digitalAdaptor(), "OutputsChanged", std::vector<std::string>(), changed);
+    }
     else
     {
-        clog << kLogWarning << this->Name() << ": Attempt to call GetOuput for nonexisting handle '" << handle << "'" << endl;    
-        return false;
+        for(std::map<std::string, std::vector<size_t> >::iterator r = recipients.begin(); r != recipients.end(); ++r)
+        {
+            std::map<std::string, bool> subset;
+            for(std::vector<size_t>::iterator i = r->second.begin(); i != r->second.end(); ++i)
+            {
+                subset[handles[*i]] = changed[handles[*i]];
+            }
+            SignalSubscriptions::Send(this->digitalAdaptor(), "OutputsChanged", std::vector<std::string>(1, r->first), subset);
+        }
     }
 }
 
 std::vector<std::string> IoGroupDigital::MbInputs()
 {
-    std::vector<std::string> output(this->mbInputList.begin(), this->mbInputList.end());
-    return output;
+    return this->listIo(IoMbInput);
 }
 
 uint32_t IoGroupDigital::GetMbInput(const std::string &handle)
 {
-    uint32_t value = 0;
+    IoEntry * io = this->findIo(handle, IoMbInput);
     
-    if(this->mbInputList.count(handle) > 0)
+    if(io != NULL)
     {
         clog << kLogDebug << this->Name() << ": Getting multibit input on handle '" << handle << "'" << endl;
-        for(std::vector<uint16_t>::size_type i = 0; i != this->mbIdMap[handle].size(); i++)
-        {
-            uint16_t pinid = this->mbIdMap[handle][i];
-            if(this->getInputPin(pinid))
-            {
-                value |= 1 << i;
-            }
-        }
-        
-        return value;
+        return this->readMbInput(io);
     }
     else
     {
@@ -233,35 +327,34 @@ uint32_t IoGroupDigital::GetMbInput(const std::string &handle)
 
 std::vector<std::string> IoGroupDigital::MbOutputs()
 {
-    std::vector<std::string> output(this->mbOutputList.begin(), this->mbOutputList.end());
-    return output;
+    return this->listIo(IoMbOutput);
 }
 
 void IoGroupDigital::SetMbOutput(const std::string &handle, const uint32_t &value)
 {
-    if(this->mbInputList.count(handle) > 0)
+    IoEntry * io = this->findIo(handle, IoMbOutput);
+    if(io != NULL)
     {
         clog << kLogDebug << this->Name() << ": Setting multibit output on handle '" << handle << "' to '" << value << "'" << endl;
-        if(value != this->mbOutputValueMap[handle])
+        if(value != io->value)
         {
-            this->mbOutputValueMap[handle] = value;
-            for(std::vector<uint16_t>::size_type i = 0; i != this->mbIdMap[handle].size(); i++)
+            io->value = value;
+            for(std::vector<uint16_t>::size_type i = 0; i != io->pins.size(); i++)
             {
-                uint16_t pinid = this->mbIdMap[handle][i];
-                
                 // Loop through the pins and set the value
                 if(value & (1 << i))
                 {
-                    this->setOutputPin(pinid,true);
+                    this->setOutputPin(io->pins[i],true);
                 }
                 else
                 {
-                    this->setOutputPin(pinid,false);
+                    this->setOutputPin(io->pins[i],false);
                 }
             }
             
             this->onMbOutputChanged(this,handle,value);
-            this->MbOutputChanged(handle,value);
+            this->ioValueChanged(io);
+            this->emitSignal(this->digitalAdaptor(),"MbOutputChanged",handle,handle,value);
         }
         else
         {
@@ -276,10 +369,11 @@ void IoGroupDigital::SetMbOutput(const std::string &handle, const uint32_t &valu
 
 uint32_t IoGroupDigital::GetMbOutput(const std::string &handle)
 {
-    if(this->outputValueMap.count(handle) > 0)
+    IoEntry * io = this->findIo(handle, IoMbOutput);
+    if(io != NULL)
     {
-        clog << kLogDebug << this->Name() << ": Getting multibit input on handle '" << handle << "'" << endl;
-        return this->mbOutputValueMap[handle];
+        clog << kLogDebug << this->Name() << ": Getting multibit output on handle '" << handle << "'" << endl;
+        return io->value;
     }
     else
     {
@@ -290,8 +384,7 @@ uint32_t IoGroupDigital::GetMbOutput(const std::string &handle)
 
 std::vector<std::string> IoGroupDigital::Pwms()
 {
-    std::vector<std::string> output(this->pwmList.begin(), this->pwmList.end());
-    return output;
+    return this->listIo(IoPwm);
 }
 
 void IoGroupDigital::SetLedPwm(const std::string &handle, const uint8_t &value)
@@ -333,11 +426,14 @@ void IoGroupDigital::SetLedPwm(const std::string &handle, const uint8_t &value)
     241, 243, 245, 247, 249, 252, 254, 255
     };
 
-    if(this->pwmList.count(handle) > 0)
+    IoEntry * io = this->findIo(handle, IoPwm);
+    if(io != NULL)
     {
         clog << kLogDebug << this->Name() << ": Setting LED pwm on handle '" << handle << "' to '" << (int32_t)value << "'" << endl;
-        uint16_t id = this->idMap[handle];
-        this->setPwm(id,GammaToLinear[value]);
+        this->setPwm(io->pins[0],GammaToLinear[value]);
+        io->value = GammaToLinear[value];
+        io->valueSet = true;
+        this->ioValueChanged(io);
     }
     else
     {
@@ -351,14 +447,17 @@ void IoGroupDigital::SetPwm(const std::string &handle, const uint8_t &value)
 {
     try
     {
-        if(this->pwmList.count(handle) > 0)
+        IoEntry * io = this->findIo(handle, IoPwm);
+        if(io != NULL)
         {
             clog << kLogDebug << this->Name() << ": Setting pwm on handle '" << handle << "' to '" << (int32_t)value << "'" << endl;
-            uint16_t id = this->idMap[handle];
-            this->setPwm(id,value);
+            this->setPwm(io->pins[0],value);
+            io->value = value;
+            io->valueSet = true;
+            this->ioValueChanged(io);
      
             this->onPwmValueChanged(this,handle,value);
-            this->PwmValueChanged(handle,value);
+            this->emitSignal(this->digitalAdaptor(),"PwmValueChanged",handle,handle,value);
         }
         else
         {
@@ -373,14 +472,15 @@ void IoGroupDigital::SetPwm(const std::string &handle, const uint8_t &value)
 
 uint8_t IoGroupDigital::GetPwm(const std::string &handle)
 {
-    if(this->pwmValueMap.count(handle) > 0)
+    IoEntry * io = this->findIo(handle, IoPwm);
+    if(io != NULL && io->valueSet)
     {
         clog << kLogDebug << this->Name() << ": Getting LED pwm on handle '" << handle << "'" << endl;
-        return this->pwmValueMap[handle];
+        return (uint8_t)io->value;
     }
     else
     {
-        if(this->pwmList.count(handle) > 0)
+        if(io != NULL)
         {
             clog << kLogInfo << this->Name() << ": Attempt to call GetPwm before value was set for handle '" << handle << "'" << endl;    
         }
@@ -392,6 +492,196 @@ uint8_t IoGroupDigital::GetPwm(const std::string &handle)
     }
 }
 
+//protected
+bool IoGroupDigital::setOutputPins(uint64_t mask, uint64_t values)
+{
+    bool result = true;
+    for(uint16_t id = 0; id < 64; id++)
+    {
+        if(mask & (((uint64_t)1) << id))
+        {
+            if(!this->setOutputPin(id, (values & (((uint64_t)1) << id)) != 0))
+                result = false;
+        }
+    }
+    return result;
+}
+
+std::map< std::string, ::DBus::Variant > IoGroupDigital::properties(bool snapshot)
+{
+    std::map< std::string, bool > buttons, inputs, outputs;
+    std::map< std::string, uint32_t > mbinputs, mboutputs;
+    std::map< std::string, uint8_t > pwms;
+
+    // Values to report, the last known ones unless read from the hardware below
+    std::vector<uint32_t> values(this->ioTable.size());
+    for(std::vector<IoEntry>::size_type i = 0; i != this->ioTable.size(); i++)
+    {
+        values[i] = this->ioTable[i].value;
+    }
+
+    if(snapshot)
+    {
+        // Read all input pins at once. Only the reply gets the read values: the io table is kept up
+        // to date by the interrupt path, which may already have a newer value than this read
+        uint64_t mask = 0;
+        for(std::vector<IoEntry>::iterator it = this->ioTable.begin(); it != this->ioTable.end(); ++it)
+        {
+            if(it->type == IoButton || it->type == IoInput || it->type == IoMbInput)
+            {
+                for(std::vector<uint16_t>::size_type i = 0; i != it->pins.size(); i++)
+                {
+                    if(it->pins[i] < 64)
+                        mask |= ((uint64_t)1) << it->pins[i];
+                }
+            }
+        }
+
+        try
+        {
+            uint64_t pinvalues = (mask != 0) ? this->getInputPins(mask) : 0;
+            for(std::vector<IoEntry>::size_type n = 0; n != this->ioTable.size(); n++)
+            {
+                IoEntry &io = this->ioTable[n];
+                if(io.type == IoButton || io.type == IoInput || io.type == IoMbInput)
+                {
+                    uint32_t value = 0;
+                    for(std::vector<uint16_t>::size_type i = 0; i != io.pins.size(); i++)
+                    {
+                        if(io.pins[i] < 64 && (pinvalues & (((uint64_t)1) << io.pins[i])))
+                            value |= 1 << i;
+                    }
+                    values[n] = value;
+                }
+            }
+        }
+        catch(std::exception &x)
+        {
+            clog << kLogWarning << this->Name() << ": Could not read input states - " << x.what() << endl;
+        }
+    }
+
+    for(std::vector<IoEntry>::size_type n = 0; n != this->ioTable.size(); n++)
+    {
+        const std::string &handle = this->ioTable[n].handle;
+        switch(this->ioTable[n].type)
+        {
+            case IoButton:      buttons[handle] = (values[n] != 0); break;
+            case IoInput:       inputs[handle] = (values[n] != 0); break;
+            case IoOutput:      outputs[handle] = (values[n] != 0); break;
+            case IoMbInput:     mbinputs[handle] = values[n]; break;
+            case IoMbOutput:    mboutputs[handle] = values[n]; break;
+            case IoPwm:         pwms[handle] = (uint8_t)values[n]; break;
+        }
+    }
+
+    std::map< std::string, ::DBus::Variant > result;
+    result["ButtonValues"] = toVariant(buttons);
+    result["InputValues"] = toVariant(inputs);
+    result["OutputValues"] = toVariant(outputs);
+    result["MbInputValues"] = toVariant(mbinputs);
+    result["MbOutputValues"] = toVariant(mboutputs);
+    result["PwmValues"] = toVariant(pwms);
+    return result;
+}
+
+void IoGroupDigital::setProperty(const std::string &name, const ::DBus::Variant &value)
+{
+    if(name == "OutputValues")
+    {
+        std::map< std::string, bool > outputs = value;
+        this->SetOutputs(outputs);
+    }
+    else if(name == "MbOutputValues")
+    {
+        std::map< std::string, uint32_t > mboutputs = value;
+        for(std::map< std::string, uint32_t >::iterator it = mboutputs.begin(); it != mboutputs.end(); ++it)
+        {
+            this->SetMbOutput(it->first, it->second);
+        }
+    }
+    else if(name == "PwmValues")
+    {
+        std::map< std::string, uint8_t > pwms = value;
+        for(std::map< std::string, uint8_t >::iterator it = pwms.begin(); it != pwms.end(); ++it)
+        {
+            this->SetPwm(it->first, it->second);
+        }
+    }
+    else
+    {
+        IoGroupBase::setProperty(name, value);
+    }
+}
+
+//protected
+uint64_t IoGroupDigital::getInputPins(uint64_t mask)
+{
+    uint64_t values = 0;
+    for(uint16_t id = 0; id < 64; id++)
+    {
+        if((mask & (((uint64_t)1) << id)) && this->getInputPin(id))
+        {
+            values |= ((uint64_t)1) << id;
+        }
+    }
+    return values;
+}
+
+// State page and event stream types by IoType
+static const uint32_t ioStateTypes[] = { PIIO_STATE_BUTTON, PIIO_STATE_INPUT, PIIO_STATE_OUTPUT, PIIO_STATE_PWM, PIIO_STATE_MBINPUT, PIIO_STATE_MBOUTPUT };
+
+void IoGroupDigital::PublishState(StatePage * page)
+{
+    IoGroupBase::PublishState(page);
+    for(std::vector<IoEntry>::iterator it = this->ioTable.begin(); it != this->ioTable.end(); ++it)
+    {
+        it->stateIndex = page->Register(this->Name() + "." + it->handle, ioStateTypes[it->type]);
+        page->Update(it->stateIndex, it->value);
+    }
+}
+
+void IoGroupDigital::PublishEvents(EventStream * stream)
+{
+    IoGroupBase::PublishEvents(stream);
+    if(stream == NULL)
+        return;
+    // The index in the io table is used as io id in the stream
+    for(std::vector<IoEntry>::size_type i = 0; i != this->ioTable.size(); i++)
+    {
+        stream->Register(this->eventGroupId, i, this->Name() + "." + this->ioTable[i].handle, ioStateTypes[this->ioTable[i].type]);
+    }
+}
+
+void IoGroupDigital::PersistState(StateStore * store)
+{
+    IoGroupBase::PersistState(store);
+    for(std::vector<IoEntry>::iterator it = this->ioTable.begin(); it != this->ioTable.end(); ++it)
+    {
+        if(it->type != IoOutput && it->type != IoMbOutput && it->type != IoPwm)
+            continue;
+        
+        double value = it->value;
+        bool restored;
+        it->storeIndex = store->Register(this->Name() + "." + it->handle, ioStateTypes[it->type], value, restored);
+        if(!restored)
+            continue;
+        
+        it->value = (uint32_t)value;
+        it->valueSet = true;
+        clog << kLogDebug << this->Name() << "." << it->handle << ": restored value '" << it->value << "'" << endl;
+        
+        // Before Start, outputs set here become the initial values of the pins
+        if(it->type != IoPwm)
+        {
+            for(std::vector<uint16_t>::size_type i = 0; i != it->pins.size(); i++)
+            {
+                this->setOutputPin(it->pins[i], (it->value & (1 << i)) != 0);
+            }
+        }
+    }
+}
+
 // Button timer callback functions
 bool IoGroupDigital::onValidatePress(uint16_t id)
 {
@@ -406,31 +696,137 @@ bool IoGroupDigital::onValidatePress(uint16_t id)
 
 void IoGroupDigital::onShortPress(uint16_t id)
 {
-    // Send the button press signal
-    string handle = this->handleMap[id];
+    IoEntry * io = this->findIo(id);
+    if(io == NULL)
+        return;
 
-    clog << kLogDebug << this->Name() << ": Event - Short press on pin id '" <<  id << "' - handle '" << handle << "'" << endl;
+    clog << kLogDebug << this->Name() << ": Event - Short press on pin id '" <<  id << "' - handle '" << io->handle << "'" << endl;
 
-    this->onButtonPress(this,handle);
-    this->ButtonPress(handle);
+    // Send the button press signal
+    this->onButtonPress(this,io->handle);
+    this->emitSignal(this->digitalAdaptor(),"ButtonPress",io->handle,io->handle);
+    this->buttonEvents.Add();
 }
 
 void IoGroupDigital::onLongPress(uint16_t id)
 {
-    // Send the button press signal
-    string handle = this->handleMap[id];
+    IoEntry * io = this->findIo(id);
+    if(io == NULL)
+        return;
+
+    clog << kLogDebug << this->Name() << ": Event - Long press on pin id '" <<  id << "' - handle '" << io->handle << "'" << endl;
+
+    // Send the button hold signal
+    this->onButtonHold(this,io->handle);
+    this->emitSignal(this->digitalAdaptor(),"ButtonHold",io->handle,io->handle);
+    this->buttonEvents.Add();
+}
+
+void IoGroupDigital::onGesture(uint16_t id, Gesture gesture, uint32_t count)
+{
+    IoEntry * io = this->findIo(id);
+    if(io == NULL)
+        return;
+
+    std::string name = ButtonTimer::GestureName(gesture);
+    clog << kLogDebug << this->Name() << ": Event - Gesture '" << name << "' (" << count << ") on pin id '" <<  id << "' - handle '" << io->handle << "'" << endl;
+
+    this->onButtonGesture(this,io->handle,name,count);
+    this->emitSignal(this->digitalAdaptor(),"ButtonGesture",io->handle,io->handle,name,count);
+    this->buttonEvents.Add();
+}
+
+// Input coalescer callback function
+void IoGroupDigital::onCoalescedChanges(std::vector<CoalescedChange> changes)
+{
+    TRACE_SCOPE("digital.coalesced");
+    std::vector< ::DBus::Struct< std::string, bool, uint64_t > > inputs;
+    std::vector<std::string> handles;
 
-    clog << kLogDebug << this->Name() << ": Event - Long press on pin id '" <<  id << "' - handle '" << handle << "'" << endl;
+    for(std::vector<CoalescedChange>::iterator it = changes.begin(); it != changes.end(); ++it)
+    {
+        if(it->id >= this->ioTable.size())
+            continue;
+        
+        IoEntry * io = &(this->ioTable[it->id]);
+        clog << kLogDebug << this->Name() << ": Event - Coalesced change on handle '" << io->handle << "' to '" << it->value << "'" << endl;
+
+        io->value = it->value;
+        io->valueSet = true;
+
+        if(io->type == IoMbInput)
+        {
+            this->ioValueChanged(io);
+            this->onMbInputChanged(this,io->handle,it->value);
+            this->emitSignal(this->digitalAdaptor(),"MbInputChanged",io->handle,io->handle,it->value);
+        }
+        else if(io->type == IoInput)
+        {
+            ::DBus::Struct< std::string, bool, uint64_t > change;
+            change._1 = io->handle;
+            change._2 = (it->value != 0);
+            change._3 = it->timestamp;
+            inputs.push_back(change);
+            handles.push_back(io->handle);
+
+            this->ioValueChanged(io);
 
-    this->onButtonHold(this,handle);
-    this->ButtonHold(handle);
+            this->onInputChanged(this,io->handle,(it->value != 0));
+            this->emitSignal(this->digitalAdaptor(),"InputChanged",io->handle,io->handle,(it->value != 0));
+        }
+    }
+
+    // Send all single-bit inputs that changed in this window in one signal
+    if(inputs.size() > 0)
+    {
+        // Send each subscriber only the inputs it subscribed to
+        bool broadcast;
+        std::map<std::string, std::vector<size_t> > recipients = this->batchRecipients(handles, broadcast);
+        if(broadcast)
+        {
+            SignalSubscriptions::Send(this->digitalAdaptor(), "InputsChanged", std::vector<std::string>(), inputs);
+        }
+        else
+        {
+            for(std::map<std::string, std::vector<size_t> >::iterator r = recipients.begin(); r != recipients.end(); ++r)
+            {
+                std::vector< ::DBus::Struct< std::string, bool, uint64_t > > subset;
+                for(std::vector<size_t>::iterator i = r->second.begin(); i != r->second.end(); ++i)
+                {
+                    subset.push_back(inputs[*i]);
+                }
+                SignalSubscriptions::Send(this->digitalAdaptor(), "InputsChanged", std::vector<std::string>(1, r->first), subset);
+            }
+        }
+    }
 }
 
 //protected
 void IoGroupDigital::inputChanged(uint16_t id, bool value)
 {
-    if(this->buttonIdList.find(id) != this->buttonIdList.end())
+    TRACE_SCOPE("digital.input");
+    IoEntry * io = this->findIo(id);
+    if(io == NULL)
+        return;
+
+    if(io->coalesced)
+    {
+        // Coalesced inputs are signalled when their coalescing window closes
+        if(io->type == IoMbInput)
+        {
+            this->coalescer->RegisterChange((uint16_t)(io - &(this->ioTable[0])), this->readMbInput(io));
+        }
+        else
+        {
+            this->coalescer->RegisterChange((uint16_t)(io - &(this->ioTable[0])), value);
+        }
+    }
+    else if(io->type == IoButton)
     {
+        io->value = value;
+        io->valueSet = true;
+        this->ioValueChanged(io);
+
         // It's  button - that is handled by the button timer
         if(value)
         {
@@ -441,22 +837,25 @@ void IoGroupDigital::inputChanged(uint16_t id, bool value)
             btnTimer->RegisterRelease(id);
         }
     }
-    else if(this->mbInputIdList.find(id) != this->mbInputIdList.end())
+    else if(io->type == IoMbInput)
     {
-        // It's part of a multibit input
-        string handle = this->handleMap[id];
-        // read the value of the mb input
-        uint32_t mb_value = this->GetMbInput(handle);
+        // It's part of a multibit input, read the value of the mb input
+        uint32_t mb_value = this->readMbInput(io);
+        io->value = mb_value;
+        io->valueSet = true;
+        this->ioValueChanged(io);
         // And send the signal
-        this->onMbInputChanged(this,handle,mb_value);
-        this->MbInputChanged(handle,mb_value);
+        this->onMbInputChanged(this,io->handle,mb_value);
+        this->emitSignal(this->digitalAdaptor(),"MbInputChanged",io->handle,io->handle,mb_value);
     }
-    else
+    else if(io->type == IoInput)
     {
+        io->value = value;
+        io->valueSet = true;
+        this->ioValueChanged(io);
         // It's an input. Send the signal and the new value
-        string handle = this->handleMap[id];
-        this->onInputChanged(this,handle,value);
-        this->InputChanged(handle,value);
+        this->onInputChanged(this,io->handle,value);
+        this->emitSignal(this->digitalAdaptor(),"InputChanged",io->handle,io->handle,value);
     }
 }
 
@@ -475,11 +874,9 @@ void IoGroupDigital::registerButton(std::string handle, libconfig::Setting &io)
         io.lookupValue("pulldown", pulldown);
         io.lookupValue("int-enabled", inten);
                 
-		if(this->registerHandle(handle, id))
+		if(this->registerHandle(handle, IoButton, std::vector<uint16_t>(1, id)))
 		{
 			this->prepareInputPin(id,invert,pullup,pulldown,inten);
-			this->buttonList.insert(handle);
-			this->buttonIdList.insert(id);
 		}
         else
         {
@@ -510,10 +907,10 @@ void IoGroupDigital::registerInput(std::string handle, libconfig::Setting &io)
         io.lookupValue("pulldown", pulldown);
         io.lookupValue("int-enabled", inten);
 
-		if(this->registerHandle(handle, id))
+		if(this->registerHandle(handle, IoInput, std::vector<uint16_t>(1, id)))
 		{
             this->prepareInputPin(id,invert,pullup,pulldown,inten);
-			this->inputList.insert(handle);
+            this->configureCoalescing(handle,io);
 		}
         else
         {
@@ -535,14 +932,12 @@ void IoGroupDigital::registerOutput(std::string handle, libconfig::Setting &io)
 	try
 	{
 		uint16_t id = this->getPinId(io);
-		if(this->registerHandle(handle, id))
+		if(this->registerHandle(handle, IoOutput, std::vector<uint16_t>(1, id)))
 		{
 			this->prepareOutputPin(id);
-			this->outputList.insert(handle);
             
             // Initialize output to false;
             this->setOutputPin(id,false);
-            this->outputValueMap[handle] = false;
 		}
         else
         {
@@ -565,11 +960,9 @@ void IoGroupDigital::registerPwm(std::string handle, libconfig::Setting &io)
 	{
 		uint16_t id = this->getPinId(io);
 
-		if(this->registerHandle(handle, id))
+		if(this->registerHandle(handle, IoPwm, std::vector<uint16_t>(1, id)))
 		{
 			this->preparePwmPin(id);
-			this->pwmList.insert(handle);
-			this->pwmIdList.insert(id);
 		}
         else
         {
@@ -604,14 +997,13 @@ void IoGroupDigital::registerMultiBitInput(std::string handle, libconfig::Settin
             
             std::vector<uint16_t> v_pins = this->getMbPinIds(io["pins"]);
             
-            if(this->registerMbHandle(handle,v_pins))
+            if(this->registerHandle(handle, IoMbInput, v_pins))
             {
                 for(std::vector<uint16_t>::size_type i = 0; i != v_pins.size(); i++)
                 {
                     this->prepareInputPin(v_pins[i],invert,pullup,pulldown,inten);
-                    this->mbInputIdList.insert(v_pins[i]);
                 }
-                this->mbInputList.insert(handle);
+                this->configureCoalescing(handle,io);
             }
             else
             {
@@ -641,7 +1033,7 @@ void IoGroupDigital::registerMultiBitOutput(std::string handle, libconfig::Setti
         {
             std::vector<uint16_t> v_pins = this->getMbPinIds(io["pins"]);
             
-            if(this->registerMbHandle(handle,v_pins))
+            if(this->registerHandle(handle, IoMbOutput, v_pins))
             {
                 for(std::vector<uint16_t>::size_type i = 0; i != v_pins.size(); i++)
                 {
@@ -649,8 +1041,6 @@ void IoGroupDigital::registerMultiBitOutput(std::string handle, libconfig::Setti
                     // Initialize output to false;
                     this->setOutputPin(v_pins[i],false);
                 }
-                this->mbInputList.insert(handle);
-                this->mbOutputValueMap[handle] = 0;
             }
             else
             {
@@ -674,62 +1064,152 @@ void IoGroupDigital::registerMultiBitOutput(std::string handle, libconfig::Setti
 
 // private
 
-bool IoGroupDigital::registerHandle(std::string handle, uint16_t id)
+IoGroupDigital::IoEntry * IoGroupDigital::findIo(const std::string &handle, IoType type)
 {
-    if(this->idMap.count(handle) > 0 || this->mbIdMap.count(handle) > 0)
+    boost::unordered_map<std::string, uint16_t>::iterator it = this->handleIndex.find(handle);
+    if(it != this->handleIndex.end() && this->ioTable[it->second].type == type)
     {
-        // handle already in use
-        return false;
+        return &(this->ioTable[it->second]);
     }
-    else if(this->handleMap.count(id) > 0)
+    else
     {
-        // id already in use
-        return false;
+        return NULL;
+    }
+}
+
+IoGroupDigital::IoEntry * IoGroupDigital::findIo(uint16_t pinid)
+{
+    if(pinid < this->pinIndex.size() && this->pinIndex[pinid] >= 0)
+    {
+        return &(this->ioTable[this->pinIndex[pinid]]);
     }
     else
     {
-        this->idMap[handle] = id;
-        this->handleMap[id] = handle;
-        return true;
+        return NULL;
+    }
+}
+
+std::vector<std::string> IoGroupDigital::listIo(IoType type)
+{
+    std::vector<std::string> output;
+    for(std::vector<IoEntry>::iterator it = this->ioTable.begin(); it != this->ioTable.end(); ++it)
+    {
+        if(it->type == type)
+        {
+            output.push_back(it->handle);
+        }
     }
+    // Keep the lists sorted by handle name
+    std::sort(output.begin(), output.end());
+    return output;
 }
 
-bool IoGroupDigital::registerMbHandle(std::string handle, std::vector<uint16_t> ids)
+bool IoGroupDigital::registerHandle(std::string handle, IoType type, std::vector<uint16_t> ids)
 {
-    if(this->idMap.count(handle) > 0 || this->mbIdMap.count(handle) > 0)
+    if(this->handleIndex.count(handle) > 0)
     {
         // handle already in use
         return false;
     }
-    else 
+    
+    for(std::vector<uint16_t>::size_type i = 0; i != ids.size(); i++)
     {
-        bool ids_inuse = false;
-        
-        for(std::vector<uint16_t>::size_type i = 0; i != ids.size(); i++)
-        {
-            if(this->handleMap.count(ids[i]) > 0)
-            {
-                ids_inuse = true;
-            }
-        }
-        
-        if(ids_inuse)
+        if(this->findIo(ids[i]) != NULL)
         {
             // id already in use
             return false;
         }
-        else
+    }
+
+    IoEntry entry;
+    entry.handle = handle;
+    entry.type = type;
+    entry.pins = ids;
+    entry.value = 0;
+    entry.valueSet = (type == IoOutput || type == IoMbOutput); // outputs are initialized to 0 on registration
+    entry.coalesced = false;
+    entry.stateIndex = -1;
+    entry.storeIndex = -1;
+
+    uint16_t index = (uint16_t)this->ioTable.size();
+    this->ioTable.push_back(entry);
+    this->handleIndex[handle] = index;
+
+    for(std::vector<uint16_t>::size_type i = 0; i != ids.size(); i++)
+    {
+        if(ids[i] >= this->pinIndex.size())
         {
-            this->mbIdMap[handle] = ids;
+            this->pinIndex.resize(ids[i] + 1, -1);
+        }
+        this->pinIndex[ids[i]] = index;
+    }
 
-            for(std::vector<uint16_t>::size_type i = 0; i != ids.size(); i++)
-            {
-                this->handleMap[ ids[i] ] = handle;
-            }            
-            
-            return true;
+    return true;
+}
+
+void IoGroupDigital::configureCoalescing(std::string handle, libconfig::Setting &io)
+{
+    uint32_t window = this->coalesceDefault;
+    uint32_t ratelimit = this->rateLimitDefault;
+    
+    io.lookupValue("coalesce-time", window);
+    io.lookupValue("rate-limit", ratelimit);
+    
+    if(window == 0 && ratelimit == 0)
+        return; // Signal every change directly
+    
+    // The coalescer spaces signals in whole milliseconds
+    if(ratelimit > 1000)
+    {
+        clog << kLogWarning << this->Name() << "." << handle << ": rate-limit " << ratelimit << " is above the maximum of 1000 signals per second, using 1000" << endl;
+        ratelimit = 1000;
+    }
+    
+    if(this->coalescer == NULL)
+    {
+        this->coalescer = new InputCoalescer();
+        onCoalescedChangesConnection = this->coalescer->onFlush.connect(boost::bind(&IoGroupDigital::onCoalescedChanges, this, _1));
+    }
+    
+    uint16_t index = this->handleIndex[handle];
+    this->coalescer->Configure(index, window, (ratelimit > 0) ? (1000 / ratelimit) : 0);
+    this->ioTable[index].coalesced = true;
+    
+    clog << kLogDebug << this->Name() << "." << handle << ": coalescing changes over " << window << " ms, at most " << ratelimit << " signals per second" << endl;
+}
+
+void IoGroupDigital::ioValueChanged(IoEntry * io)
+{
+    // Property names by IoType
+    static const char * propertyNames[] = { "ButtonValues", "InputValues", "OutputValues", "PwmValues", "MbInputValues", "MbOutputValues" };
+    
+    this->ioChanges.Add();
+    this->propertyChanged(propertyNames[io->type]);
+    if(this->statePage != NULL)
+    {
+        this->statePage->Update(io->stateIndex, io->value);
+    }
+    if(this->eventStream != NULL)
+    {
+        this->eventStream->Publish(this->eventGroupId, io - &(this->ioTable[0]), io->value);
+    }
+    if(this->stateStore != NULL)
+    {
+        this->stateStore->Update(io->storeIndex, io->value);
+    }
+}
+
+uint32_t IoGroupDigital::readMbInput(IoEntry * io)
+{
+    uint32_t value = 0;
+    for(std::vector<uint16_t>::size_type i = 0; i != io->pins.size(); i++)
+    {
+        if(this->getInputPin(io->pins[i]))
+        {
+            value |= 1 << i;
         }
     }
+    return value;
 }
 
 uint16_t IoGroupDigital::getPinId(libconfig::Setting &io)
@@ -4,10 +4,13 @@
 #include "pi-io-server-glue.hpp"
 #include "iogroup-base.hpp"
 #include "buttontimer/buttontimer.hpp"
+#include "inputcoalescer/inputcoalescer.hpp"
+#include "stats/stats.hpp"
 #include <stdint.h>
 #include <map>
 #include <set>
 #include <vector>
+#include <boost/unordered_map.hpp>
 
 class IoGroupDigital : public IoGroupBase,
     //public DBus::IntrospectableAdaptor,
@@ -22,6 +25,10 @@ public:
     virtual ~IoGroupDigital();
 
     virtual void Initialize(libconfig::Setting &setting);
+    virtual void Start();
+    virtual void PublishState(StatePage * page);
+    virtual void PublishEvents(EventStream * stream);
+    virtual void PersistState(StateStore * store);
 
     virtual std::vector< std::string > Buttons();
     virtual bool GetButton(const std::string& handle);
@@ -32,6 +39,7 @@ public:
     virtual std::vector< std::string > Outputs();
     virtual void SetOutput(const std::string& handle, const bool& value);
     virtual bool GetOutput(const std::string& handle);
+    virtual void SetOutputs(const std::map< std::string, bool >& values);
 
     virtual std::vector< std::string > MbInputs();
     virtual uint32_t GetMbInput(const std::string& handle);
@@ -48,9 +56,11 @@ public:
 
     boost::signals2::signal<void (IoGroupDigital*, std::string)> onButtonHold;
     boost::signals2::signal<void (IoGroupDigital*, std::string)> onButtonPress;
+    boost::signals2::signal<void (IoGroupDigital*, std::string, std::string, uint32_t)> onButtonGesture;
     
     boost::signals2::signal<void (IoGroupDigital*, std::string, bool)> onInputChanged;
     boost::signals2::signal<void (IoGroupDigital*, std::string, bool)> onOutputChanged;
+    boost::signals2::signal<void (IoGroupDigital*, std::map<std::string, bool>)> onOutputsChanged;
 
     boost::signals2::signal<void (IoGroupDigital*, std::string, uint32_t)> onMbInputChanged;
     boost::signals2::signal<void (IoGroupDigital*, std::string, uint32_t)> onMbOutputChanged;
@@ -61,15 +71,25 @@ public:
     bool onValidatePress(uint16_t id);
     void onShortPress(uint16_t id);
     void onLongPress(uint16_t id);
+    void onGesture(uint16_t id, Gesture gesture, uint32_t count);
+
+    // Input coalescer callback function
+    void onCoalescedChanges(std::vector<CoalescedChange> changes);
 
 protected:
     // Override in child to get input value by id
     virtual bool getInputPin(uint16_t id) = 0;
     // Override in child to actually set the output by id
     virtual bool setOutputPin(uint16_t id, bool value) = 0;
+    // Override in child to set multiple outputs at once (bit n in mask/values is pin id n)
+    // Defaults to calling setOutputPin for every pin in the mask
+    virtual bool setOutputPins(uint64_t mask, uint64_t values);
     // Override in child to actually set the PWM value
     // Throws FeatureNotImplementedException unless overridden in subclass
     virtual bool setPwm(uint16_t id, uint8_t value) = 0;
+    // Override in child to read multiple inputs at once (bit n in mask/result is pin id n)
+    // Defaults to calling getInputPin for every pin in the mask
+    virtual uint64_t getInputPins(uint64_t mask);
     // Call this function when an input value has changed
     void inputChanged(uint16_t id, bool value);
 
@@ -88,28 +108,46 @@ protected:
     // finalize configuration
     virtual void endConfig(void);
 
+    // Properties of the Digital interface
+    virtual std::map< std::string, ::DBus::Variant > properties(bool snapshot);
+    virtual void setProperty(const std::string &name, const ::DBus::Variant &value);
+
 
 private:
-    ButtonTimer *btnTimer; 
+    // The Digital interface, for emitting its signals
+    DBus::InterfaceAdaptor & digitalAdaptor() { return *static_cast<nl::miqra::PiIo::IoGroup::Digital_adaptor*>(this); }
 
-    // Maps for the different ID Types
-    std::map<uint16_t, std::string> handleMap;
-
-    std::map<std::string,uint16_t> idMap;
-    std::set<std::string> inputList;
-    std::set<std::string> buttonList;
-    std::set<uint16_t> buttonIdList;
-    std::set<std::string> outputList;
-    std::set<std::string> pwmList;
-    std::set<uint16_t> pwmIdList;
-    std::map<std::string,bool> outputValueMap;
-    std::map<std::string,uint8_t> pwmValueMap;
-
-    std::map< std::string,std::vector< uint16_t > > mbIdMap;
-    std::set<std::string> mbInputList;
-    std::set<uint16_t> mbInputIdList;
-    std::set<std::string> mbOutputList;
-    std::map<std::string,uint32_t> mbOutputValueMap;
+    ButtonTimer *btnTimer; 
+    InputCoalescer *coalescer;
+    uint32_t coalesceDefault;       // Default coalescing window for inputs in ms
+    uint32_t rateLimitDefault;      // Default maximum number of change signals per second for inputs
+    Counter ioChanges;              // Value changes of all IOs
+    Counter buttonEvents;           // Presses, holds and gestures
+
+    // The different IO types a handle can be registered as
+    enum IoType { IoButton, IoInput, IoOutput, IoPwm, IoMbInput, IoMbOutput };
+
+    // Entry in the IO table. The index of an entry in the table is the interned id of its handle
+    struct IoEntry
+    {
+        std::string handle;
+        IoType type;
+        std::vector<uint16_t> pins;     // Pin id(s) of the IO, lsb first for multibit IOs
+        uint32_t value;                 // Last value set on outputs, multibit outputs and pwms, or last known value of inputs
+        bool valueSet;                  // False until a value has been set
+        bool coalesced;                 // Changes are passed through the input coalescer
+        int32_t stateIndex;             // Index in the state page, or -1
+        int32_t storeIndex;             // Slot in the state store, or -1
+    };
+
+    // Table of all IOs in this group, and the lookups into it. Filled once during Initialize.
+    std::vector<IoEntry> ioTable;
+    boost::unordered_map<std::string, uint16_t> handleIndex;   // handle -> index in ioTable
+    std::vector<int16_t> pinIndex;                              // pin id -> index in ioTable, or -1 
+
+    IoEntry * findIo(const std::string &handle, IoType type);
+    IoEntry * findIo(uint16_t pinid);
+    std::vector<std::string> listIo(IoType type);
 
     // Registration functions
     
@@ -124,12 +162,18 @@ private:
 	void registerMultiBitInput(std::string handle, libconfig::Setting &setting);
 	void registerMultiBitOutput(std::string handle, libconfig::Setting &setting);
 
-    bool registerHandle(std::string handle, uint16_t id);
-    bool registerMbHandle(std::string handle, std::vector<uint16_t> ids); 
+    bool registerHandle(std::string handle, IoType type, std::vector<uint16_t> ids);
+    void configureCoalescing(std::string handle, libconfig::Setting &io);
+    // Call this function when the value of an IO has changed
+    void ioValueChanged(IoEntry * io);
+    uint32_t readMbInput(IoEntry * io);
     // Button timer connections
     boost::signals2::connection onShortPressConnection;
     boost::signals2::connection onLongPressConnection;
     boost::signals2::connection onValidatePressConnection;
+    boost::signals2::connection onGestureConnection;
+    // Input coalescer connection
+    boost::signals2::connection onCoalescedChangesConnection;
 
 };
 
@@ -1,4 +1,5 @@
 #include "iogroup-gpio.hpp"
+#include "trace/trace.h"
 #include <sstream>
 
 using namespace std;
@@ -7,6 +8,7 @@ using namespace std;
 IoGroupGpio::IoGroupGpio(DBus::Connection &connection,std::string &dbuspath, GpioRegistry &registry)
  : IoGroupSoftPWM(connection,dbuspath, registry)
  { 
+    this->started = false;
  }
 
 // Called at the start of the configuration round to allow for subclass
@@ -46,61 +48,84 @@ uint16_t IoGroupGpio::getPinId(int32_t pinid)
 	}
 }
 
+// Pins are only recorded here, they are opened in Start
 void IoGroupGpio::prepareInputPin(uint16_t pinid, bool invert, bool pullup, bool pulldown, bool inten)
 {
-    clog << kLogDebug << "Opening input pin " << pinid << endl; 
-    GpioPin * pin = new GpioPin(    pinid,   		            // Pin number
-                                    kDirectionIn,               // Data direction
-                                    (inten)?kEdgeBoth:kEdgeNone // Interrupt edge - using both edges on interrupt, or none on no interrupt
-                                );  
-    clog << kLogDebug << "Appending pin data to pin maps for pin" << pinid << endl; 
-    this->gpioPins[pinid] = pin;
     this->gpioInvert[pinid] = invert;
+    this->gpioPullUp[pinid] = pullup;
+    this->gpioPullDown[pinid] = pulldown;
     this->gpioInputPins.insert(pinid);
-    
-    // Set the internal pullup on or off
-    //clog << kLogDebug << "Setting pullup to " << pullup << " for pin " << pinid << endl; 
-    
-    if(pullup)
-    {        
-        pin->setPullUp(true);
-    }
-    else if(pulldown)
-    {
-        pin->setPullDown(true);
-    }
-    else
-    {
-        pin->setPullUp(false);
-    }
-    
-
     if(inten)
     {
-        clog << kLogDebug << "Registering interrupts for pin " << pinid << endl; 
-
         this->gpioIntPins.insert(pinid);
-        this->gpioIntConnection[pinid] = pin->onInterrupt.connect(boost::bind(&IoGroupGpio::onInterrupt, this, _1, _2, _3));
-        this->gpioIntErrorConnection[pinid] = pin->onThreadError.connect(boost::bind(&IoGroupGpio::onInterruptError, this, _1, _2));
-
-        clog << kLogDebug << "Starting interrup listener for pin " << pinid << endl; 
-        pin->InterruptStart();
     }
-
-    clog << kLogDebug << "Preparation done for pin " << pinid << endl; 
-
 }
 
 void IoGroupGpio::prepareOutputPin(uint16_t pinid)
 {
-    GpioPin * pin = new GpioPin(    pinid,   		    // Pin number
-                                    kDirectionOut,      // Data direction
-                                    kEdgeNone           // Interrupt edge - using both edges on interrupt, or none on no interrupt
-                                );  
-    this->gpioPins[pinid] = pin;
     this->gpioOutputPins.insert(pinid);
 }
 
+void IoGroupGpio::Start()
+{
+    std::set<uint16_t>::iterator it;
+    
+    for(it = this->gpioInputPins.begin(); it != this->gpioInputPins.end(); ++it)
+    {
+        uint16_t pinid = *it;
+        bool inten = (this->gpioIntPins.count(pinid) > 0);
+        
+        clog << kLogDebug << "Opening input pin " << pinid << endl; 
+        GpioPin * pin = new GpioPin(    pinid,   		            // Pin number
+                                        kDirectionIn,               // Data direction
+                                        (inten)?kEdgeBoth:kEdgeNone // Interrupt edge - using both edges on interrupt, or none on no interrupt
+                                    );  
+        this->gpioPins[pinid] = pin;
+        
+        // Set the internal pullup on or off
+        if(this->gpioPullUp[pinid])
+        {        
+            pin->setPullUp(true);
+        }
+        else if(this->gpioPullDown[pinid])
+        {
+            pin->setPullDown(true);
+        }
+        else
+        {
+            pin->setPullUp(false);
+        }
+
+        if(inten)
+        {
+            clog << kLogDebug << "Registering interrupts for pin " << pinid << endl; 
+
+            this->gpioIntConnection[pinid] = pin->onInterrupt.connect(boost::bind(&IoGroupGpio::onInterrupt, this, _1, _2, _3));
+            this->gpioIntErrorConnection[pinid] = pin->onThreadError.connect(boost::bind(&IoGroupGpio::onInterruptError, this, _1, _2));
+
+            clog << kLogDebug << "Starting interrup listener for pin " << pinid << endl; 
+            pin->InterruptStart();
+        }
+    }
+
+    for(it = this->gpioOutputPins.begin(); it != this->gpioOutputPins.end(); ++it)
+    {
+        uint16_t pinid = *it;
+        
+        clog << kLogDebug << "Opening output pin " << pinid << endl; 
+        GpioPin * pin = new GpioPin(    pinid,   		    // Pin number
+                                        kDirectionOut,      // Data direction
+                                        kEdgeNone           // Interrupt edge - using both edges on interrupt, or none on no interrupt
+                                    );  
+        this->gpioPins[pinid] = pin;
+        pin->setValue(this->initialOutputs[pinid]);
+    }
+    this->initialOutputs.clear();
+    this->started = true;
+
+    IoGroupSoftPWM::Start();
+}
+
 
 // Called at the end of the configuration round to allow the subclass to 
 // finalize configuration
@@ -113,8 +138,24 @@ void IoGroupGpio::endConfig(void)
 // destructor
 IoGroupGpio::~IoGroupGpio()
 {
-    // delete all pins
     typedef std::map<uint16_t, GpioPin*>::iterator it_type;
+    
+    // Stop all interrupt listeners before any pin goes, they call back into the group
+    for(it_type iterator = this->gpioPins.begin(); iterator != this->gpioPins.end(); iterator++) 
+    {
+        if(iterator->second != NULL)
+            iterator->second->InterruptStop();
+    }
+    for(std::map<uint16_t, boost::signals2::connection>::iterator it = this->gpioIntConnection.begin(); it != this->gpioIntConnection.end(); ++it)
+    {
+        it->second.disconnect();
+    }
+    for(std::map<uint16_t, boost::signals2::connection>::iterator it = this->gpioIntErrorConnection.begin(); it != this->gpioIntErrorConnection.end(); ++it)
+    {
+        it->second.disconnect();
+    }
+    
+    // delete all pins
     for(it_type iterator = this->gpioPins.begin(); iterator != this->gpioPins.end(); iterator++) 
     {
         uint16_t pinid = iterator->first;
@@ -131,7 +172,7 @@ IoGroupGpio::~IoGroupGpio()
 // Override in child to get input value by id
 bool IoGroupGpio::getInputPin(uint16_t id)
 {
-    if(this->gpioInputPins.count(id) > 0)
+    if(this->gpioInputPins.count(id) > 0 && this->started)
     {
         bool value = this->gpioPins[id]->getValue();
         if(this->gpioInvert[id])
@@ -145,12 +186,32 @@ bool IoGroupGpio::getInputPin(uint16_t id)
     }
 }
 
+uint64_t IoGroupGpio::getInputPins(uint64_t mask)
+{
+    uint64_t invert = 0;
+    for(uint16_t id = 0; id < 64; id++)
+    {
+        if(mask & (((uint64_t)1) << id))
+        {
+            if(this->gpioInputPins.count(id) == 0)
+                mask &= ~(((uint64_t)1) << id);
+            else if(this->gpioInvert[id])
+                invert |= ((uint64_t)1) << id;
+        }
+    }
+
+    return (GpioPin::getMaskedValues(mask) ^ invert) & mask;
+}
+
 // Override in child to actually set the output by id
 bool IoGroupGpio::setOutputPin(uint16_t id, bool value)
 {
     if(this->gpioOutputPins.count(id) > 0)
     {
-        this->gpioPins[id]->setValue(value);
+        if(this->started)
+            this->gpioPins[id]->setValue(value);
+        else
+            this->initialOutputs[id] = value;
         return true;
     }
     else
@@ -160,10 +221,36 @@ bool IoGroupGpio::setOutputPin(uint16_t id, bool value)
     }
 }
 
+bool IoGroupGpio::setOutputPins(uint64_t mask, uint64_t values)
+{
+    for(uint16_t id = 0; id < 64; id++)
+    {
+        if((mask & (((uint64_t)1) << id)) && this->gpioOutputPins.count(id) == 0)
+        {
+            clog << kLogDebug << this->Name() << ".iogroup-gpio:  Output pin '" << id << "' not recognized as an output pin" << endl;
+            mask &= ~(((uint64_t)1) << id);
+        }
+    }
+    
+    if(this->started)
+    {
+        GpioPin::setMaskedValues(mask, values);
+    }
+    else
+    {
+        for(uint16_t id = 0; id < 64; id++)
+        {
+            if(mask & (((uint64_t)1) << id))
+                this->initialOutputs[id] = ((values & (((uint64_t)1) << id)) != 0);
+        }
+    }
+    return true;
+}
 
 // Generic interrupt handler for all pins
 void IoGroupGpio::onInterrupt(GpioPin * sender, GpioEdge edge, bool pinval)
 {
+    TRACE_SCOPE("gpio.interrupt");
     uint16_t pinid = (uint16_t)sender->getPinNr();
     bool value = pinval;
     if(this->gpioInvert[pinid])
@@ -11,11 +11,19 @@ public:
     IoGroupGpio(DBus::Connection &connection,std::string &dbuspath, GpioRegistry &registry);
     ~IoGroupGpio();
 
+    // Export and configure the pins
+    virtual void Start();
+    virtual std::string Bus() { return "gpio"; }
+
 protected:
     // Override in child to get input value by id
     virtual bool getInputPin(uint16_t id);
+    // Read multiple inputs with a single GPLEV read
+    virtual uint64_t getInputPins(uint64_t mask);
     // Override in child to actually set the output by id
     virtual bool setOutputPin(uint16_t id, bool value);
+    // Set multiple outputs with a single GPSET/GPCLR write
+    virtual bool setOutputPins(uint64_t mask, uint64_t values);
     // Override in child to actually set the PWM value
     
     // Called at the start of the configuration round to allow for subclass
@@ -38,6 +46,10 @@ private:
     std::set<uint16_t> gpioInputPins;
     std::set<uint16_t> gpioIntPins;
     std::set<uint16_t> gpioOutputPins;
+    std::map<uint16_t, bool> gpioPullUp;
+    std::map<uint16_t, bool> gpioPullDown;
+    std::map<uint16_t, bool> initialOutputs;    // Values set before the output pins were opened
+    bool started;
     
     std::map<uint16_t, boost::signals2::connection> gpioIntConnection;
     std::map<uint16_t, boost::signals2::connection> gpioIntErrorConnection;
@@ -419,6 +419,75 @@ void IoGroupHwPwm::Initialize(libconfig::Setting &setting)
 }
 
 
+void IoGroupHwPwm::PublishState(StatePage * page)
+{
+    IoGroupBase::PublishState(page);
+    for(std::map<std::string, PwmPin*>::iterator it = this->handleMap.begin(); it != this->handleMap.end(); ++it)
+    {
+        this->stateIndex[it->first] = page->Register(this->Name() + "." + it->first, PIIO_STATE_PWMVALUE);
+        page->Update(this->stateIndex[it->first], it->second->GetValue());
+    }
+}
+
+void IoGroupHwPwm::PublishEvents(EventStream * stream)
+{
+    IoGroupBase::PublishEvents(stream);
+    if(stream == NULL)
+        return;
+    for(std::map<std::string, PwmPin*>::iterator it = this->handleMap.begin(); it != this->handleMap.end(); ++it)
+    {
+        uint16_t id = this->eventIndex.size();
+        this->eventIndex[it->first] = id;
+        stream->Register(this->eventGroupId, id, this->Name() + "." + it->first, PIIO_STATE_PWMVALUE);
+    }
+}
+
+void IoGroupHwPwm::PersistState(StateStore * store)
+{
+    IoGroupBase::PersistState(store);
+    for(std::map<std::string, PwmPin*>::iterator it = this->handleMap.begin(); it != this->handleMap.end(); ++it)
+    {
+        double value = it->second->GetValue();
+        bool restored;
+        this->storeIndex[it->first] = store->Register(this->Name() + "." + it->first, PIIO_STATE_PWMVALUE, value, restored);
+        if(restored)
+        {
+            // Applied to the hardware when the group is started
+            it->second->SetValue(value);
+            clog << kLogDebug << this->Name() << "." << it->first << ": restored value '" << it->second->GetValue() << "'" << endl;
+        }
+    }
+}
+
+std::map< std::string, ::DBus::Variant > IoGroupHwPwm::properties(bool snapshot)
+{
+    std::map< std::string, double > pwms;
+    for(std::map<std::string, PwmPin*>::iterator it = this->handleMap.begin(); it != this->handleMap.end(); ++it)
+    {
+        pwms[it->first] = it->second->GetValue();
+    }
+
+    std::map< std::string, ::DBus::Variant > result;
+    result["PwmValues"] = toVariant(pwms);
+    return result;
+}
+
+void IoGroupHwPwm::setProperty(const std::string &name, const ::DBus::Variant &value)
+{
+    if(name == "PwmValues")
+    {
+        std::map< std::string, double > pwms = value;
+        for(std::map< std::string, double >::iterator it = pwms.begin(); it != pwms.end(); ++it)
+        {
+            this->SetValue(it->first, it->second);
+        }
+    }
+    else
+    {
+        IoGroupBase::setProperty(name, value);
+    }
+}
+
 std::vector<std::string> IoGroupHwPwm::Pwms()
 {
     std::vector<std::string> output(this->pwmList.begin(), this->pwmList.end());
@@ -437,7 +506,20 @@ void IoGroupHwPwm::SetValue(const std::string &handle, const double &value)
             pin->SetValue(value);
             this->setPwmPin(pin);
 
-            this->PwmValueChanged(handle,value);
+            this->emitSignal(*static_cast<nl::miqra::PiIo::IoGroup::Pwm_adaptor*>(this),"PwmValueChanged",handle,handle,value);
+            this->propertyChanged("PwmValues");
+            if(this->statePage != NULL)
+            {
+                this->statePage->Update(this->stateIndex[handle], pin->GetValue());
+            }
+            if(this->eventStream != NULL)
+            {
+                this->eventStream->Publish(this->eventGroupId, this->eventIndex[handle], pin->GetValue());
+            }
+            if(this->stateStore != NULL)
+            {
+                this->stateStore->Update(this->storeIndex[handle], pin->GetValue());
+            }
         }
         else
         {
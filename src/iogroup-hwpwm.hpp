@@ -68,6 +68,9 @@ public:
     virtual ~IoGroupHwPwm();
 
     virtual void Initialize(libconfig::Setting &setting);
+    virtual void PublishState(StatePage * page);
+    virtual void PublishEvents(EventStream * stream);
+    virtual void PersistState(StateStore * store);
 
     virtual std::vector< std::string > Pwms();
     virtual void SetValue(const std::string& handle, const double& value);
@@ -98,6 +101,9 @@ protected:
     // finalize configuration
     virtual void endConfig(void);
 
+    // Properties of the Pwm interface
+    virtual std::map< std::string, ::DBus::Variant > properties(bool snapshot);
+    virtual void setProperty(const std::string &name, const ::DBus::Variant &value);
 
 public:
     double GetPwmPeriodMs();
@@ -116,6 +122,9 @@ private:
     std::set<std::string> pwmList;
     std::set<uint16_t> pwmIdList;
     std::set<PwmPin*> pwmPins;
+    std::map<std::string, int32_t> stateIndex;
+    std::map<std::string, uint16_t> eventIndex;
+    std::map<std::string, int32_t> storeIndex;
 
     // Registration functions
     
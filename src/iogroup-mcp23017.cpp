@@ -1,31 +1,16 @@
 #include "iogroup-mcp23017.hpp"
+#include "trace/trace.h"
 #include <sstream>
 
-// For getting current time
-#include <time.h>
-#ifndef CLOCK_MONOTIC
-#   define CLOCK_MONOTIC CLOCK_REALTIME
-#endif
-
 
 using namespace std;
 
-// function to get current time in ms
-int64_t now_ms(void);
-
-// get current time in milliseconds
-int64_t now_ms(void)
-{
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTIC, &now);
-
-    return ((int64_t)now.tv_sec)*1000LL + (now.tv_nsec/1000000);
-}
-
-
 IoGroupMCP23017::IoGroupMCP23017(DBus::Connection &connection,std::string &dbuspath, GpioRegistry &registry)
  : IoGroupDigital(connection,dbuspath, registry)
 {
+    this->mcp = NULL;
+    this->inNoiseTimeout = false;
+    this->intpin = NULL;
 	this->hw_intpin = 0xFF;
 	this->hw_use_gpioint = false;
 	
@@ -195,120 +180,140 @@ void IoGroupMCP23017::endConfig(void)
         this->gpioRegistry.requestSharedLease(GpioPin::VerifyPin(3),name,usage_scl)
        )
     {
-        clog << kLogInfo << "Opening MCP23017 IO expander on I2C address " << this->hw_address << endl;
-        this->noiseTimeout = 0; // Value of 0 means: no noise timeout
-        
-        try
+        if (this->hw_use_gpioint)
         {
-            
-            HWConfig hwConfig;
-            unsigned short value;
-            hwConfig.DISSLEW = false;   // Leave slew rate control enabled
-            hwConfig.INT_MIRROR = true; // Interconnect I/O pins
-            hwConfig.INT_ODR = this->hw_intodr;   // Interrupt is not an open drain
-            hwConfig.INT_POL = this->hw_intpol;    // Interrupt is Active-Low 
-            
-            // Initialize chip system
-            this->mcp = new Mcp23017( this->hw_address,   // adr
-                                     this->hw_iodir,     // iodir
-                                     this->hw_ipol,      // ipol
-                                     this->hw_pullup,    // pullup
-                                     hwConfig,       	// Hardware Config
-                                     this->hw_swapab);  	// Swap A/B
-
-            // apply pwm config settings
-            this->mcp->setPwmConfig(hw_tick_delay_us, hw_ticks);  
-
-            try
+            string usage_int = "MCP23017 Interrupt";
+            if(!this->gpioRegistry.requestSharedLease(this->hw_intpin,name,usage_int))
             {
+                clog << kLogError << "Could not use pin " << this->hw_intpin << " for interrupt listening, because it is already registered by io group " << this->gpioRegistry.getCurrentLeaser(this->hw_intpin) << " for use as " << this->gpioRegistry.getCurrentUsage(this->hw_intpin) << endl;
+                this->hw_use_gpioint = false;
+            }
+        }
+    }
+    else
+    {   
+        clog << kLogError << "I2C Pins are already registered for exclusive use" << endl;
+        throw OperationFailedException("I2C Pins are already registered for exclusive use");
+    }
+}
 
-                if (this->hw_use_gpioint)
-                {
-                    string usage_int = "MCP23017 Interrupt";
-                    if(this->gpioRegistry.requestSharedLease(this->hw_intpin,name,usage_int))
-                    {
-                        clog << kLogInfo << "Opening GPIO pin " << this->hw_intpin << " for interrupt listening" << endl;
-                        // open pin
-                        // Hardware config
-                        intpin = new GpioPin(   this->hw_intpin,   							// Pin number
-                                                kDirectionIn,   							// Data direction
-                                                (this->hw_intpol)?kEdgeRising:kEdgeFalling	// Interrupt edge
-                                            );  
-
-                        // Start interrupt event on interrupt pin
-                        intpin->InterruptStart();
-                        // Initialize interrupts
-                       
-                        onInterruptErrorConnection.disconnect();
-                        onInterruptConnection.disconnect();
-                        onInterruptErrorConnection = intpin->onThreadError.connect(boost::bind(&IoGroupMCP23017::onInterruptError, this, _1, _2));
-                        onInterruptConnection = intpin->onInterrupt.connect(boost::bind(&IoGroupMCP23017::onInterrupt, this, _1, _2, _3));
-
-                        clog << kLogInfo << "Enabling interrupts on IO Expander" << endl;
-
-                        // Configure interrupt
-                        mcp->IntConfig( 0x0000,  		// defval
-                                        0x0000,  		// intcon
-                                        this->hw_inten); // int enable
-
-
-                        clog << kLogInfo << "Starting interrupt listener on GPIO pin " <<  this->hw_intpin << endl;
-
-                    }
-                    else
-                    {
-                        clog << kLogError << "Could not use pin " << this->hw_intpin << " for interrupt listening, because it is already registered by io group " << this->gpioRegistry.getCurrentLeaser(this->hw_intpin) << " for use as " << this->gpioRegistry.getCurrentUsage(this->hw_intpin) << endl;
-                    }
-                }
+void IoGroupMCP23017::Start()
+{
+    this->startChip();
+    IoGroupDigital::Start();
+}
 
+// Open and configure the chip, and start listening for interrupts
+void IoGroupMCP23017::startChip(void)
+{
+    clog << kLogInfo << "Opening MCP23017 IO expander on I2C address " << this->hw_address << endl;
+    this->inNoiseTimeout = false;
+    
+    try
+    {
+        
+        HWConfig hwConfig;
+        unsigned short value;
+        hwConfig.DISSLEW = false;   // Leave slew rate control enabled
+        hwConfig.INT_MIRROR = true; // Interconnect I/O pins
+        hwConfig.INT_ODR = this->hw_intodr;   // Interrupt is not an open drain
+        hwConfig.INT_POL = this->hw_intpol;    // Interrupt is Active-Low 
+        
+        // Initialize chip system
+        this->mcp = new Mcp23017( this->hw_address,   // adr
+                                 this->hw_iodir,     // iodir
+                                 this->hw_ipol,      // ipol
+                                 this->hw_pullup,    // pullup
+                                 hwConfig,       	// Hardware Config
+                                 this->hw_swapab);  	// Swap A/B
 
-                clog << kLogInfo << "Performing initial read of IO Expander values to clear any pending interrupts and initialize Jack state" << endl;
-                // Read initial value to clear any current interrupts
-                value = mcp->getValue();
+        // apply pwm config settings
+        this->mcp->setPwmConfig(hw_tick_delay_us, hw_ticks);  
 
-                // Now setup the PWM pins
-                std::set<uint16_t>::iterator p;
-                for(p = this->pwm_pins.begin(); p != this->pwm_pins.end(); ++p) 
-                {
-                    this->mcp->setPwmState(*p,true);
-                }
-                
-                // And set up initialization values for output pins
-                std::map<uint16_t, bool>::iterator it;
-                for(it = initial_outputvalue.begin(); it != initial_outputvalue.end(); it++) {
-                    // it->first = key
-                    // it->second = value
-                    this->mcp->setPin(it->first, it->second);
-                }
-                
-                // clear list
-                initial_outputvalue.clear();
+        try
+        {
 
+            if (this->hw_use_gpioint)
+            {
+                clog << kLogInfo << "Opening GPIO pin " << this->hw_intpin << " for interrupt listening" << endl;
+                // open pin
+                // Hardware config
+                intpin = new GpioPin(   this->hw_intpin,   							// Pin number
+                                        kDirectionIn,   							// Data direction
+                                        (this->hw_intpol)?kEdgeRising:kEdgeFalling	// Interrupt edge
+                                    );  
+
+                // Start interrupt event on interrupt pin
+                intpin->InterruptStart();
+                // Initialize interrupts
+               
+                onInterruptErrorConnection.disconnect();
+                onInterruptConnection.disconnect();
+                onInterruptErrorConnection = intpin->onThreadError.connect(boost::bind(&IoGroupMCP23017::onInterruptError, this, _1, _2));
+                onInterruptConnection = intpin->onInterrupt.connect(boost::bind(&IoGroupMCP23017::onInterrupt, this, _1, _2, _3));
+
+                clog << kLogInfo << "Enabling interrupts on IO Expander" << endl;
+
+                // Configure interrupt
+                mcp->IntConfig( 0x0000,  		// defval
+                                0x0000,  		// intcon
+                                this->hw_inten); // int enable
+
+
+                clog << kLogInfo << "Starting interrupt listener on GPIO pin " <<  this->hw_intpin << endl;
             }
-            catch(OperationFailedException x)
+
+
+            clog << kLogInfo << "Performing initial read of IO Expander values to clear any pending interrupts and initialize Jack state" << endl;
+            // Read initial value to clear any current interrupts
+            value = mcp->getValue();
+
+            // Now setup the PWM pins
+            std::set<uint16_t>::iterator p;
+            for(p = this->pwm_pins.begin(); p != this->pwm_pins.end(); ++p) 
             {
-                clog << kLogError << this->Name() << ": Error setting up MCP interface: " << x.Message() << endl;
-                delete mcp; mcp = NULL;
-                throw x;
+                this->mcp->setPwmState(*p,true);
             }
-                
+            
+            // And set up initialization values for output pins
+            std::map<uint16_t, bool>::iterator it;
+            for(it = initial_outputvalue.begin(); it != initial_outputvalue.end(); it++) {
+                // it->first = key
+                // it->second = value
+                this->mcp->setPin(it->first, it->second);
+            }
+            
+            // clear list
+            initial_outputvalue.clear();
+
         }
         catch(OperationFailedException x)
         {
             clog << kLogError << this->Name() << ": Error setting up MCP interface: " << x.Message() << endl;
-            delete intpin; intpin = NULL;
+            delete mcp; mcp = NULL;
             throw x;
         }
+            
     }
-    else
-    {   
-        clog << kLogError << "I2C Pins are already registered for exclusive use" << endl;
-        throw OperationFailedException("I2C Pins are already registered for exclusive use");
+    catch(OperationFailedException x)
+    {
+        clog << kLogError << this->Name() << ": Error setting up MCP interface: " << x.Message() << endl;
+        delete intpin; intpin = NULL;
+        throw x;
     }
 }
 
 IoGroupMCP23017::~IoGroupMCP23017()
 {
+    // Stop the interrupt listener first, it can schedule a new noise timeout until it is joined
+    if(intpin != NULL)
+        intpin->InterruptStop();
+    onInterruptConnection.disconnect();
+    onInterruptErrorConnection.disconnect();
+
+    // Then stop the noise timeout, before anything it uses goes away
+    TimerService::Instance().CancelAll(this);
+
     // Make sure the gpiopin and the mcp object are removed
 	if(intpin != NULL)
 		delete intpin; intpin = NULL;
@@ -322,6 +327,13 @@ bool IoGroupMCP23017::getInputPin(uint16_t id)
 {
 	return this->mcp->getPin(id);
 }
+uint64_t IoGroupMCP23017::getInputPins(uint64_t mask)
+{
+    if(this->mcp != NULL)
+        return ((uint64_t)this->mcp->getValue()) & mask;
+    else
+        return 0;
+}
 // Override in child to actually set the output by id
 bool IoGroupMCP23017::setOutputPin(uint16_t id, bool value)
 {
@@ -337,6 +349,24 @@ bool IoGroupMCP23017::setOutputPin(uint16_t id, bool value)
     }
 }
 
+bool IoGroupMCP23017::setOutputPins(uint64_t mask, uint64_t values)
+{
+    if(this->mcp != NULL)
+    {
+        this->mcp->setMaskedValue((uint16_t)values, (uint16_t)mask);
+        return true;
+    }
+    else
+    {
+        for(uint16_t id = 0; id < 16; id++)
+        {
+            if(mask & (1 << id))
+                this->initial_outputvalue[id] = ((values & (1 << id)) != 0);
+        }
+        return true;
+    }
+}
+
 // Override in child to actually set the PWM value
 // Throws FeatureNotImplementedException unless overridden in subclass
 bool IoGroupMCP23017::setPwm(uint16_t id, uint8_t value)
@@ -377,6 +407,7 @@ bool IoGroupMCP23017::setPwm(uint16_t id, uint8_t value)
 
 void IoGroupMCP23017::onInterrupt(GpioPin * sender, GpioEdge edge, bool pinval)
 {
+    TRACE_SCOPE("mcp23017.interrupt");
     uint16_t intf,intcap, keycode;
     uint8_t i, bitcount;
     
@@ -388,10 +419,8 @@ void IoGroupMCP23017::onInterrupt(GpioPin * sender, GpioEdge edge, bool pinval)
     intcap = this->mcp->getIntCap();
 
     // Check if we are in a noise timeout, and cancel if so.
-    if(this->noiseTimeout !=0 && this->noiseTimeout > now_ms())
+    if(this->inNoiseTimeout)
         return;
-    else
-        this->noiseTimeout = 0;
 
 
     // Count the number of interrupt pins that changed
@@ -425,11 +454,20 @@ void IoGroupMCP23017::onInterrupt(GpioPin * sender, GpioEdge edge, bool pinval)
         else
         {
             clog << kLogDebug << "!!! Input Noise !!! (Timeout: " << this->hw_noisetimeout_ms << "ms)" << endl;
-            this->noiseTimeout = now_ms() + this->hw_noisetimeout_ms;
+            this->inNoiseTimeout = true;
+            TimerService::Instance().Schedule(this->hw_noisetimeout_ms, boost::bind(&IoGroupMCP23017::endNoiseTimeout, this), this);
         }
     }
 }
 
+// Called from the timer service when the noise timeout is over
+void IoGroupMCP23017::endNoiseTimeout(void)
+{
+    clog << kLogDebug << this->Name() << ": Noise timeout over" << endl;
+    __sync_synchronize();
+    this->inNoiseTimeout = false;
+}
+
 void IoGroupMCP23017::onInterruptError(Thread* sender, ThreadException x)
 {
     // When this function is called, the interrupt thread will have stopped
@@ -439,7 +477,7 @@ void IoGroupMCP23017::onInterruptError(Thread* sender, ThreadException x)
     {
         delete mcp; mcp = NULL;
         delete intpin; intpin = NULL;
-        endConfig(); // Attempt to re-init the chip system. Quit on failure
+        startChip(); // Attempt to re-init the chip system. Quit on failure
         clog << kLogInfo << "Succesfully restarted interrupt listener" << endl;
     }
     catch(std::exception x2)
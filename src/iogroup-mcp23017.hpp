@@ -5,6 +5,7 @@
 #include "mcp23017/mcp23017.hpp"
 #include "gpio/gpio.hpp"
 #include "thread/thread.hpp"
+#include "timerservice/timerservice.hpp"
 
 
 class IoGroupMCP23017: public IoGroupDigital
@@ -13,6 +14,10 @@ public:
     IoGroupMCP23017(DBus::Connection &connection,std::string &dbuspath, GpioRegistry &registry);
     ~IoGroupMCP23017();
 
+    // Open the chip
+    virtual void Start();
+    virtual std::string Bus() { return "i2c"; }
+
     void onInterrupt(GpioPin * sender, GpioEdge edge, bool pinval);
     void onInterruptError(Thread * sender, ThreadException x);
 
@@ -21,6 +26,10 @@ protected:
     virtual bool getInputPin(uint16_t id);
     // Override in child to actually set the output by id
     virtual bool setOutputPin(uint16_t id, bool value);
+    // Set multiple outputs with a single masked register write
+    virtual bool setOutputPins(uint64_t mask, uint64_t values);
+    // Read multiple inputs with a single register read
+    virtual uint64_t getInputPins(uint64_t mask);
     // Override in child to actually set the PWM value
     // Throws FeatureNotImplementedException unless overridden in subclass
     virtual bool setPwm(uint16_t id, uint8_t value);
@@ -40,6 +49,9 @@ protected:
     virtual void endConfig(void);
 
 private:
+    void startChip(void);
+    void endNoiseTimeout(void);
+
     Mcp23017 * mcp;
     GpioPin * intpin;
     
@@ -64,7 +76,7 @@ private:
 
     uint32_t hw_noisetimeout_ms; 
     uint16_t hw_noisemargin;
-    int64_t noiseTimeout;
+    volatile bool inNoiseTimeout;               // Interrupts are ignored until the noise timer ends it
     
     boost::signals2::connection onInterruptConnection;
 	boost::signals2::connection onInterruptErrorConnection;    
@@ -11,8 +11,7 @@ using namespace std;
 IoGroupPCA9685::IoGroupPCA9685(DBus::Connection &connection,std::string &dbuspath, GpioRegistry &registry)
  : IoGroupHwPwm(connection,dbuspath, registry)
 {
-
-
+    this->pca = NULL;
 }
 
 // Called at the start of the configuration round to allow for subclass
@@ -155,52 +154,44 @@ void IoGroupPCA9685::endConfig(void)
 
     clog << "Finalizing PCA9685 config" << endl;
     if(
-        this->gpioRegistry.requestSharedLease(GpioPin::VerifyPin(2),name,usage_sda) &&
-        this->gpioRegistry.requestSharedLease(GpioPin::VerifyPin(3),name,usage_scl)
+        !this->gpioRegistry.requestSharedLease(GpioPin::VerifyPin(2),name,usage_sda) ||
+        !this->gpioRegistry.requestSharedLease(GpioPin::VerifyPin(3),name,usage_scl)
        )
-    {
-        clog << kLogInfo << "Opening PCA9685 PWM driver on I2C address " << hex << (uint32_t)this->hw_address << dec <<endl;
-        
-        try
-        {
-
-        	this->pca = new Pca9685(this->hw_address, this->cfg);
+    {   
+        clog << kLogError << "I2C Pins are already registered for exclusive use" << endl;
+        throw OperationFailedException("I2C Pins are already registered for exclusive use");
+    }
+}
 
-            try
-            {
+void IoGroupPCA9685::Start()
+{
+    clog << kLogInfo << "Opening PCA9685 PWM driver on I2C address " << hex << (uint32_t)this->hw_address << dec <<endl;
+    
+    this->pca = new Pca9685(this->hw_address, this->cfg);
 
-                clog << kLogInfo << "Initializing all pwm pins to proper value" << endl;
-                // Read initial value to clear any current interrupts
+    try
+    {
 
-                // Now setup the PWM pins
-                std::set<PwmPin*>::iterator p;
-                std::set<PwmPin*> pins = this->GetPwmPins();
+        clog << kLogInfo << "Initializing all pwm pins to proper value" << endl;
 
-                for(p = pins.begin(); p != pins.end(); ++p)
-                {
-                    this->setPwmPin(*p);
-                }
+        // Now setup the PWM pins
+        std::set<PwmPin*>::iterator p;
+        std::set<PwmPin*> pins = this->GetPwmPins();
 
-            }
-            catch(OperationFailedException x)
-            {
-                clog << kLogError << this->Name() << ": Error setting up MCP interface: " << x.Message() << endl;
-                delete pca; pca = NULL;
-                throw x;
-            }
-                
-        }
-        catch(OperationFailedException x)
+        for(p = pins.begin(); p != pins.end(); ++p)
         {
-            clog << kLogError << this->Name() << ": Error setting up MCP interface: " << x.Message() << endl;
-            throw x;
+            this->setPwmPin(*p);
         }
+
     }
-    else
-    {   
-        clog << kLogError << "I2C Pins are already registered for exclusive use" << endl;
-        throw OperationFailedException("I2C Pins are already registered for exclusive use");
+    catch(OperationFailedException x)
+    {
+        clog << kLogError << this->Name() << ": Error setting up PCA9685 interface: " << x.Message() << endl;
+        delete pca; pca = NULL;
+        throw x;
     }
+
+    IoGroupHwPwm::Start();
 }
 
 IoGroupPCA9685::~IoGroupPCA9685()
@@ -11,6 +11,10 @@ public:
     IoGroupPCA9685(DBus::Connection &connection,std::string &dbuspath, GpioRegistry &registry);
     ~IoGroupPCA9685();
 
+    // Open the chip and set all pins to their initial values
+    virtual void Start();
+    virtual std::string Bus() { return "i2c"; }
+
 protected:
     // Overridden to set the actual PWM value
     virtual void setPwmPin(PwmPin *pin);
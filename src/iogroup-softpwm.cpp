@@ -9,13 +9,14 @@ using namespace std;
 IoGroupSoftPWM::IoGroupSoftPWM(DBus::Connection &connection,std::string &dbuspath, GpioRegistry &registry)
  : IoGroupDigital(connection,dbuspath, registry)
 {
-
+    Stats::Instance().Register("pwm.tick-lateness", &this->tickLateness);
 
 }
 
 void IoGroupSoftPWM::Initialize(libconfig::Setting &setting)
 {
     IoGroupDigital::Initialize(setting);
+    Stats::Instance().Register("piio_pwm_active_channels", "driver=\"softpwm\",group=\"" + this->Name() + "\"", &this->activeChannels);
 
     uint32_t tick_delay_us = 800; //us
     uint32_t ticks = 16; // tucks
@@ -33,6 +34,8 @@ void IoGroupSoftPWM::Initialize(libconfig::Setting &setting)
 IoGroupSoftPWM::~IoGroupSoftPWM()
 {
     PwmStop();   // try to stop the PWM driver;
+    Stats::Instance().Unregister(&this->tickLateness);
+    Stats::Instance().Unregister(&this->activeChannels);
 }
 
 //! Start the PWM routine for this I/O expander
@@ -93,6 +96,8 @@ bool IoGroupSoftPWM::setPwm(uint16_t id, uint8_t value)
 
         }
 
+        this->activeChannels.Set(this->active_pwms.size());
+
         // See if PWM for the mcp chip should be enabled or not
         if(this->active_pwms.empty())
         {
@@ -138,7 +143,7 @@ void IoGroupSoftPWM::ThreadFunc(void)
     // 
     clog << kLogDebug << this->Name() <<".PWM.Threadfunc: Starting" << endl;  
 
-    MakeRealtime();
+    ApplyProfile("pwm");
 
     while(ThreadRunning())
     {
@@ -166,7 +171,9 @@ void IoGroupSoftPWM::ThreadFunc(void)
             ctr = 0;
         }
 
+        uint64_t sleepStart = Histogram::Now();
         usleep(this->pwm_tick_delay_us);
+        this->tickLateness.RecordLateness(sleepStart, this->pwm_tick_delay_us * 1000ULL);
     }
     clog << kLogDebug << this->Name() <<".PWM.ThreadFunc: Stopping" << endl;  
 
@@ -3,6 +3,7 @@
 
 #include "iogroup-digital.hpp"
 #include "thread/thread.hpp"
+#include "stats/stats.hpp"
 
 
 class IoGroupSoftPWM: public IoGroupDigital, protected Thread
@@ -42,6 +43,9 @@ private:
     uint8_t     pwm_ticks;          // Number of PWM steps before coming full circle
     uint16_t    pwm_prev_val;       // Keeps state of pwm output;
 
+    Histogram   tickLateness;       // How much longer than pwm_tick_delay_us the ticks take
+    Gauge       activeChannels;     // Number of pins driven by the PWM thread
+
 };
 
 #endif//__IOGROUP_PWMDRIVER_HPP
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "log.hpp"
+#include "logsink.hpp"
 #include <string.h>
 #include <stdio.h>
 #include <cstdarg>
@@ -23,33 +24,64 @@ std::string logPrintf(std::string &format,...)
 
 Log::Log(std::string ident, int facility) {
     facility_ = facility;
-    priority_ = LOG_DEBUG;
     strncpy(ident_, ident.c_str(), sizeof(ident_));
     ident_[sizeof(ident_)-1] = '\0';
 
+    // Every thread gets its own line buffer and priority, so concurrent log lines don't mix
+    pthread_key_create(&lineKey_, &Log::freeLine);
+
     openlog(ident_, LOG_PID, facility_);
+
+    // Lines are handed to the async sink, so logging never waits on the syslog socket
+    sink_ = new LogSink();
+    closed_ = false;
+    sink_->Start();
+}
+
+Log::LogLine * Log::line() {
+    LogLine * l = static_cast<LogLine *>(pthread_getspecific(lineKey_));
+    if (l == NULL) {
+        l = new LogLine();
+        l->priority = LOG_DEBUG;
+        pthread_setspecific(lineKey_, l);
+    }
+    return l;
+}
+
+void Log::freeLine(void * line) {
+    delete static_cast<LogLine *>(line);
 }
 
 int Log::sync() {
-    if (buffer_.length()) {
-        syslog(priority_, "%s", buffer_.c_str());
-        buffer_.erase();
-        priority_ = LOG_DEBUG; // default to debug for each message
+    LogLine * l = line();
+    if (l->buffer.length()) {
+        if (closed_)
+            syslog(l->priority, "%.*s", (int)l->buffer.length(), l->buffer.data());
+        else
+            sink_->Push(l->priority, l->buffer.data(), l->buffer.length());
+        l->buffer.erase();
+        l->priority = LOG_DEBUG; // default to debug for each message
     }
     return 0;
 }
 
 int Log::overflow(int c) {
     if (c != EOF) {
-        buffer_ += static_cast<char>(c);
+        line()->buffer += static_cast<char>(c);
     } else {
         sync();
     }
     return c;
 }
 
+std::streamsize Log::xsputn(const char * s, std::streamsize n) {
+    // Append whole strings at once instead of going through overflow() per character
+    line()->buffer.append(s, n);
+    return n;
+}
+
 std::ostream& operator<< (std::ostream& os, const LogPriority& log_priority) {
-    static_cast<Log *>(os.rdbuf())->priority_ = (int)log_priority;
+    static_cast<Log *>(os.rdbuf())->line()->priority = (int)log_priority;
     return os;
 }
 
@@ -60,6 +92,20 @@ void Log::Init(std::string ident, int facility)
 
 }
 
+// Static cleanup function
+void Log::Close()
+{
+    Log * log = dynamic_cast<Log *>(std::clog.rdbuf());
+    if(log != NULL && !log->closed_)
+    {
+        // From here on lines go straight to syslog, the ones queued before are written out by Stop.
+        // Syslog stays open for the lines logged on the way out
+        log->closed_ = true;
+        __sync_synchronize();
+        log->sink_->Stop();
+    }
+}
+
 // Static init function with default facility
 void Log::Init(std::string ident)
 {
@@ -3,8 +3,11 @@
 
 
 #include <syslog.h>
+#include <pthread.h>
 #include <iostream>
 
+class LogSink;
+
 enum LogPriority {
     kLogEmerg    = LOG_EMERG,   // system is unusable
     kLogAlert    = LOG_ALERT,   // action must be taken immediately
@@ -25,16 +28,32 @@ public:
     explicit Log(std::string ident, int facility);
     static void Init(std::string ident, int facility);
     static void Init(std::string ident);
+    // Write out any queued log lines and stop the log writer. Lines logged after this, e.g. from
+    // destructors of static objects, are written to syslog directly
+    static void Close();
 protected:
     int sync();
     int overflow(int c);
+    std::streamsize xsputn(const char * s, std::streamsize n);
 
 private:
     friend std::ostream& operator<< (std::ostream& os, const LogPriority& log_priority);
-    std::string buffer_;
+
+    // Line under construction, kept separately for every thread that logs
+    struct LogLine
+    {
+        std::string buffer;
+        int priority;
+    };
+
+    LogLine * line();
+    static void freeLine(void * line);
+
+    pthread_key_t lineKey_;
     int facility_;
-    int priority_;
     char ident_[50];
+    LogSink * sink_;
+    volatile bool closed_;
 };
 
 std::string logPrintf(std::string &format,...);
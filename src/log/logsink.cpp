@@ -0,0 +1,157 @@
+#include "logsink.hpp"
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <time.h>
+
+LogSink::LogSink()
+{
+    uint32_t i;
+
+    // Each cell starts out with the sequence number of the position it will be written at first
+    for(i = 0; i < LOGSINK_QUEUE_LEN; i++)
+    {
+        this->queue[i].sequence = i;
+    }
+
+    this->enqueuePos = 0;
+    this->dequeuePos = 0;
+    this->dropped = 0;
+    this->droppedReported = 0;
+
+    sem_init(&this->pending, 0, 0);
+}
+
+LogSink::~LogSink()
+{
+    Stop();
+    sem_destroy(&this->pending);
+}
+
+void LogSink::Start()
+{
+    if(!ThreadRunning())
+    {
+        ThreadStart();
+    }
+}
+
+void LogSink::Stop()
+{
+    if(ThreadRunning())
+    {
+        ThreadStop();
+    }
+    // write out anything that was queued after the writer stopped
+    drain();
+}
+
+uint32_t LogSink::Dropped()
+{
+    return this->dropped;
+}
+
+// Multiple producers: reserve a cell by advancing enqueuePos with a CAS, fill it, then
+// publish it by bumping the cell sequence number. A cell whose sequence lags behind the
+// position is still owned by the reader, meaning the queue is full.
+bool LogSink::Push(int priority, const char * text, size_t len)
+{
+    Cell * cell;
+    uint32_t pos = this->enqueuePos;
+    int32_t dif;
+
+    while(true)
+    {
+        cell = &(this->queue[pos & (LOGSINK_QUEUE_LEN - 1)]);
+        dif = (int32_t)(cell->sequence - pos);
+        __sync_synchronize();
+
+        if(dif == 0)
+        {
+            if(__sync_bool_compare_and_swap(&this->enqueuePos, pos, pos + 1))
+                break;
+            pos = this->enqueuePos;
+        }
+        else if(dif < 0)
+        {
+            // Queue is full: drop the line rather than wait
+            __sync_fetch_and_add(&this->dropped, 1);
+            return false;
+        }
+        else
+        {
+            pos = this->enqueuePos;
+        }
+    }
+
+    if(len > LOGSINK_RECORD_LEN - 1)
+        len = LOGSINK_RECORD_LEN - 1;
+
+    cell->priority = priority;
+    memcpy(cell->text, text, len);
+    cell->text[len] = '\0';
+
+    __sync_synchronize();
+    cell->sequence = pos + 1;
+
+    sem_post(&this->pending);
+    return true;
+}
+
+// Single consumer: only the writer thread (or Stop, after the writer has ended) calls this
+bool LogSink::pop(int &priority, char * text)
+{
+    Cell * cell = &(this->queue[this->dequeuePos & (LOGSINK_QUEUE_LEN - 1)]);
+    int32_t dif = (int32_t)(cell->sequence - (this->dequeuePos + 1));
+    __sync_synchronize();
+
+    if(dif != 0)
+        return false; // nothing published at this position yet
+
+    priority = cell->priority;
+    memcpy(text, cell->text, LOGSINK_RECORD_LEN);
+
+    __sync_synchronize();
+    cell->sequence = this->dequeuePos + LOGSINK_QUEUE_LEN;
+    this->dequeuePos++;
+    return true;
+}
+
+void LogSink::drain()
+{
+    int priority;
+    char text[LOGSINK_RECORD_LEN];
+    uint32_t dropcount;
+
+    while(pop(priority, text))
+    {
+        syslog(priority, "%s", text);
+    }
+
+    // Report dropped lines once the queue has room again
+    dropcount = this->dropped;
+    if(dropcount != this->droppedReported)
+    {
+        syslog(LOG_WARNING, "Log queue overflow: %u log lines dropped (%u in total)", dropcount - this->droppedReported, dropcount);
+        this->droppedReported = dropcount;
+    }
+}
+
+void LogSink::ThreadFunc(void)
+{
+    MakeLowPriority();
+
+    while(ThreadRunning())
+    {
+        if(sem_wait(&this->pending) != 0 && errno != EINTR)
+            break;
+
+        drain();
+    }
+}
+
+void LogSink::ThreadWake(void)
+{
+    // The writer waits on the semaphore, not on the wakeup fd
+    sem_post(&this->pending);
+}
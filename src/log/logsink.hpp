@@ -0,0 +1,55 @@
+#ifndef __LOGSINK_HPP
+#define __LOGSINK_HPP
+
+#include "../thread/thread.hpp"
+#include <stdint.h>
+#include <semaphore.h>
+
+#define LOGSINK_QUEUE_LEN   512     // number of records in the queue (must be a power of two)
+#define LOGSINK_RECORD_LEN  256     // maximum length of a single log line, including terminating null
+
+// Asynchronous syslog writer
+// Log lines are copied into a bounded lock-free queue by the logging thread, and written to syslog
+// by a low priority writer thread. When the queue is full, the line is dropped and counted, so
+// a slow syslog socket never stalls the (realtime) threads doing the logging.
+class LogSink : protected Thread
+{
+    public:
+        LogSink();
+        ~LogSink();
+
+        //! Start the writer thread
+        void Start();
+        //! Stop the writer thread, after writing out everything still in the queue
+        void Stop();
+
+        //! Queue a line for writing to syslog. Never blocks, returns false if the line was dropped
+        bool Push(int priority, const char * text, size_t len);
+
+        //! Number of lines dropped since startup because the queue was full
+        uint32_t Dropped();
+
+    protected:
+        virtual void ThreadFunc(void);
+        virtual void ThreadWake(void);
+
+    private:
+        struct Cell
+        {
+            volatile uint32_t sequence;
+            int priority;
+            char text[LOGSINK_RECORD_LEN];
+        };
+
+        Cell queue[LOGSINK_QUEUE_LEN];
+        volatile uint32_t enqueuePos;
+        uint32_t dequeuePos;
+        volatile uint32_t dropped;
+        uint32_t droppedReported;
+        sem_t pending;
+
+        bool pop(int &priority, char * text);
+        void drain();
+};
+
+#endif
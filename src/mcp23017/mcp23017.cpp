@@ -263,6 +263,11 @@ Mcp23017::Mcp23017(    uint8_t adr,
         i2cClose(fp);
         throw x;
     }
+
+    Stats::Instance().Register("pwm.tick-lateness", &this->tickLateness);
+    char labels[64];
+    snprintf(labels, sizeof(labels), "driver=\"mcp23017\",address=\"0x%02x\"", adr);
+    Stats::Instance().Register("piio_pwm_active_channels", labels, &this->pwmChannels);
 }
 
 
@@ -270,6 +275,8 @@ Mcp23017::Mcp23017(    uint8_t adr,
 Mcp23017::~Mcp23017()
 {
     PwmStop();   // try to stop the PWM driver;
+    Stats::Instance().Unregister(&this->tickLateness);
+    Stats::Instance().Unregister(&this->pwmChannels);
     i2cClose(fp);
 }
 
@@ -562,6 +569,7 @@ void Mcp23017::setPwmState(uint8_t pin, bool state)
         this->pwm_mask |= (1 << pin);
     else
         this->pwm_mask &= ~(1 << pin);
+    this->pwmChannels.Set(__builtin_popcount(this->pwm_mask));
 }
 
 //! Set the PWM Configuration
@@ -594,31 +602,37 @@ PwmConfig Mcp23017::getPwmConfig()
 }
 
 //! Driver function for PWM thread
+uint16_t Mcp23017::getPwmFrame(uint8_t ctr)
+{
+    int i;
+    uint16_t pwm_out = this->pwm_mask; // start with pin high for all pins that have pwm_enabled
+
+    // Now check for each pin if it should be low in this step...
+    for(i=0;i<16;i++)
+    {
+        if(this->pwm_mask & (1 << i)) // Check if pwm_mask is enabled for this pin
+        {
+            if(ctr >= this->pwm_values[i] ) // check if the counter is greater than the pwm value for this pin. If so, turn it off.
+            {
+                pwm_out &= ~(1 << i); // mask this pin out to 0, for it should be stopped
+            }
+        }
+    }
+    return pwm_out;
+}
+
 void Mcp23017::ThreadFunc(void)
 {
     uint8_t ctr = 0; 
-    int i;
     uint16_t pwm_out = 0x00;
     // 
 
-    MakeRealtime();
+    ApplyProfile("pwm");
 
     while(ThreadRunning())
     {
 
-        pwm_out = this->pwm_mask; // start with pin high for all pins that have pwm_enabled
-
-        // Now check for each pin if it should be low in this step...
-        for(i=0;i<16;i++)
-        {
-            if(this->pwm_mask & (1 << i)) // Check if pwm_mask is enabled for this pin
-            {
-                if(ctr >= this->pwm_values[i] ) // check if the counter is greater than the pwm value for this pin. If so, turn it off.
-                {
-                    pwm_out &= ~(1 << i); // mask this pin out to 0, for it should be stopped
-                }
-            }
-        }
+        pwm_out = this->getPwmFrame(ctr);
         
         if(pwm_out != this->pwm_prev_val)
         {
@@ -633,7 +647,9 @@ void Mcp23017::ThreadFunc(void)
             ctr = 0;
         }
 
+        uint64_t sleepStart = Histogram::Now();
         usleep(this->pwm_tick_delay_us);
+        this->tickLateness.RecordLateness(sleepStart, this->pwm_tick_delay_us * 1000ULL);
     }
 
 }
@@ -3,6 +3,7 @@
 
 #include "../exception/baseexceptions.hpp"
 #include "../thread/thread.hpp"
+#include "../stats/stats.hpp"
 #include <stdint.h>
 
 /*! \file MCP23017 interface functions. Header file.
@@ -58,6 +59,8 @@ class Mcp23017 : public Thread
         uint32_t    pwm_tick_delay_us;  // Interval between PWM steps in us
         uint8_t     pwm_ticks;          // Number of PWM steps before coming full circle
         uint16_t    pwm_prev_val;       // Keeps state of pwm output;
+        Histogram   tickLateness;       // How much longer than pwm_tick_delay_us the ticks take
+        Gauge       pwmChannels;        // Number of pins in pwm_mask
 
         uint8_t     tryI2CRead8 (uint8_t reg);
         void        tryI2CWrite8(uint8_t reg, uint8_t value);
@@ -283,6 +286,13 @@ class Mcp23017 : public Thread
         */
         PwmConfig getPwmConfig();
 
+        //! Compute the output levels of the PWM pins for one step of the PWM cycle
+        /*! 
+            \param ctr The step in the PWM cycle
+            \return The levels of the PWM pins, only bits in the PWM mask are set
+        */
+        uint16_t getPwmFrame(uint8_t ctr);
+
 };
 
 
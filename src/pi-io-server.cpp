@@ -10,6 +10,9 @@
 #include "iogroup-pca9685.hpp"
 
 #include "gpio/c_gpio.h"
+#include "i2c/i2c.h"
+#include "trace/trace.h"
+#include "simulatorcontrol.hpp"
 
 
 #include <unistd.h>
@@ -18,12 +21,18 @@
 #include <stdio.h>
 #include <limits.h>
 #include <pthread.h>
+#include <sys/stat.h>
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string.hpp>
 #include <vector>
+#include <algorithm>
+#include <time.h>
+#include <sched.h>
 
 
 using namespace std;
@@ -34,14 +43,179 @@ static const std::string SERVER_DBUS_INTF = "nl.miqra.PiIo";
 static const std::string SERVER_DBUS_PATH = "/nl/miqra/PiIo";
 static const std::string IOGROUP_DBUS_PATH = "/nl/miqra/PiIo/IoGroups";
 static const std::string DEFAULT_CFGFILE_PATH = "/etc/piio.conf";
+static const std::string SERVER_SETTINGS = "server";
 
-// signal handler
+// signal handlers
 void niam(int sig);
+void reload(int sig);
+void dumpTrace(int sig);
+
+DBus::BusDispatcher dispatcher;
+// Written to from the SIGHUP handler, to reload the configuration in the dispatcher thread
+static DBus::Pipe * reloadPipe = NULL;
+// Written to from the SIGUSR2 handler, to dump the trace buffers in the dispatcher thread
+static DBus::Pipe * tracePipe = NULL;
+static std::string cfgFile = DEFAULT_CFGFILE_PATH;
+
+// Serialize a setting and everything below it, to find out which settings changed on a reload
+static std::string settingFingerprint(Setting &setting)
+{
+    std::ostringstream oss;
+    if(setting.getName() != NULL)
+        oss << setting.getName();
+    oss << ":" << (int)setting.getType() << "=";
+    
+    switch(setting.getType())
+    {
+        case Setting::TypeInt:
+        case Setting::TypeInt64:
+            oss << (long long)setting;
+            break;
+        case Setting::TypeFloat:
+            oss << std::setprecision(17) << (double)setting;
+            break;
+        case Setting::TypeString:
+        {
+            std::string value = (const char *)setting;
+            oss << value.size() << "'" << value;
+            break;
+        }
+        case Setting::TypeBoolean:
+            oss << (bool)setting;
+            break;
+        default:
+            // Groups, arrays and lists
+            oss << "{";
+            for(int i=0; i < setting.getLength(); ++i)
+            {
+                oss << settingFingerprint(setting[i]) << ";";
+            }
+            oss << "}";
+            break;
+    }
+    return oss.str();
+}
+
+// get current time in milliseconds
+static double now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+// Initialize a newly created group, deleting it (and so releasing its pins) if that fails
+static void initializeIoGroup(IoGroupBase * g, Setting &setting)
+{
+    try
+    {
+        g->Initialize(setting);
+    }
+    catch(...)
+    {
+        delete g;
+        throw;
+    }
+}
+
+// Fingerprint of a child setting, or an empty string if it does not exist
+static std::string settingFingerprint(Setting &parent, const std::string &name)
+{
+    if(!parent.exists(name.c_str()))
+        return "";
+    return settingFingerprint(parent[name.c_str()]);
+}
+
+// Apply the realtime settings: memory locking, and a scheduling profile per class of threads
+static void configureRealtime(Setting &rt)
+{
+    static const char * classes[] = { "pwm", "interrupt", "timer", "eventstream", "statestore", "metrics" };
+    bool lockmemory = false;
+    uint32_t prefault = 0;
+    
+    rt.lookupValue("lock-memory", lockmemory);
+    rt.lookupValue("prefault-stack-kb", prefault);
+    if(lockmemory && Thread::LockMemory(prefault))
+    {
+        clog << kLogInfo << "Memory locked, prefaulting " << prefault << " kB of stack per thread" << endl;
+    }
+    
+    for(size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+    {
+        if(!rt.exists(classes[i]))
+            continue;
+        
+        Setting &c = rt[classes[i]];
+        Thread::Profile profile;
+        string policy = "other";
+        
+        c.lookupValue("policy", policy);
+        if(boost::iequals(policy, "fifo"))
+            profile.policy = SCHED_FIFO;
+        else if(boost::iequals(policy, "rr"))
+            profile.policy = SCHED_RR;
+        else if(boost::iequals(policy, "batch"))
+            profile.policy = SCHED_BATCH;
+        else if(boost::iequals(policy, "idle"))
+            profile.policy = SCHED_IDLE;
+        else
+        {
+            if(!boost::iequals(policy, "other"))
+                clog << kLogWarning << "Unknown scheduling policy '" << policy << "' for " << classes[i] << " threads, using 'other'" << endl;
+            profile.policy = SCHED_OTHER;
+        }
+        
+        // Realtime priority for fifo and rr, nice value for the others
+        profile.priority = (profile.policy == SCHED_FIFO || profile.policy == SCHED_RR) ? sched_get_priority_max(profile.policy) : 0;
+        c.lookupValue("priority", profile.priority);
+        
+        if(c.exists("cpus"))
+        {
+            Setting &cpus = c["cpus"];
+            for(int j = 0; j < cpus.getLength(); j++)
+            {
+                profile.cpus.push_back((int)cpus[j]);
+            }
+        }
+        
+        clog << kLogInfo << "Thread profile for " << classes[i] << " threads: policy '" << policy << "', priority " << profile.priority << ", " << profile.cpus.size() << " cpu(s)" << endl;
+        Thread::SetProfile(classes[i], profile);
+    }
+}
 
 PiIoServer::PiIoServer(DBus::Connection &connection, Config &config)
   : DBus::ObjectAdaptor(connection, SERVER_DBUS_PATH)
 {
+    // Before the first thread of the server starts (the timer service), so every thread gets its profile
+    Setting &root = config.getRoot();
+    if(root.exists(SERVER_SETTINGS.c_str()) && root[SERVER_SETTINGS.c_str()].exists("realtime"))
+    {
+        configureRealtime(root[SERVER_SETTINGS.c_str()]["realtime"]);
+    }
+
     this->gpioRegistry = new GpioRegistry();
+    this->nameWatcher = NULL;
+    this->statePage = NULL;
+    this->retiredStatePage = NULL;
+    this->eventStream = NULL;
+    this->stateStore = NULL;
+    this->metricsFile = NULL;
+    this->propertiesPending = false;
+    Thread::InitMutex(&this->propertiesMutex);
+    this->propertiesPipe = dispatcher.add_pipe(&PiIoServer::propertiesPipeHandler, this);
+    TimerService::Instance().Dispatcher(&dispatcher);
+
+    // Subscribe and Unsubscribe are handled here directly instead of through the generated stubs, 
+    // since they need the sender of the call
+    this->nl::miqra::PiIo_adaptor::_methods["Subscribe"] = new ::DBus::Callback< PiIoServer, ::DBus::Message, const ::DBus::CallMessage & >(this, &PiIoServer::subscribeCall);
+    this->nl::miqra::PiIo_adaptor::_methods["Unsubscribe"] = new ::DBus::Callback< PiIoServer, ::DBus::Message, const ::DBus::CallMessage & >(this, &PiIoServer::unsubscribeCall);
+
+    this->callFilter = new DBus::Callback<PiIoServer, bool, const DBus::Message &>(this, &PiIoServer::countCall);
+    connection.add_filter(this->callFilter);
+    registerMetrics();
+
+    initServer(config);
 
     // Innitialize hardware
     try
@@ -59,12 +233,23 @@ PiIoServer::PiIoServer(DBus::Connection &connection, Config &config)
 
 PiIoServer::~PiIoServer()
 {
+    // First, so the metrics file is removed while everything is still there
+    if(this->metricsFile != NULL)
+    {
+        delete this->metricsFile;
+        this->metricsFile = NULL;
+    }
+
     std::set<IoGroupBase*>::iterator it;
     for (it = this->iogroups.begin(); it != this->iogroups.end(); ++it)
     {
         delete *it;
     }
 
+    TimerService::Instance().Dispatcher(NULL);
+    dispatcher.del_pipe(this->propertiesPipe);
+    pthread_mutex_destroy(&this->propertiesMutex);
+
     if(this->gpioRegistry != NULL)
     {
         delete this->gpioRegistry;
@@ -72,46 +257,380 @@ PiIoServer::~PiIoServer()
     
     }
 
+    if(this->nameWatcher != NULL)
+    {
+        delete this->nameWatcher;
+        this->nameWatcher = NULL;
+    }
+
+    if(this->statePage != NULL)
+    {
+        delete this->statePage;
+        this->statePage = NULL;
+    }
+
+    if(this->retiredStatePage != NULL)
+    {
+        delete this->retiredStatePage;
+        this->retiredStatePage = NULL;
+    }
+
+    if(this->eventStream != NULL)
+    {
+        delete this->eventStream;
+        this->eventStream = NULL;
+    }
+
+    // After the groups, so their last changes are saved
+    if(this->stateStore != NULL)
+    {
+        delete this->stateStore;
+        this->stateStore = NULL;
+    }
+
+    this->conn().remove_filter(this->callFilter);
+    unregisterMetrics();
+
     clog << kLogInfo << "Stopping normally" << endl;
 }
 
+void PiIoServer::initServer(Config &config)
+{
+    Setting& root = config.getRoot();
+    string delivery = "broadcast";
+    string statepage = PIIO_STATE_NAME;
+    string eventsocket = "";
+    string statefile = "";
+    int statesync = 1000;
+    string metricsfile = "";
+    int metricsinterval = 10000;
+    this->traceFile = "/run/piio/piio-trace.json";
+
+    this->serverFingerprint = settingFingerprint(root, SERVER_SETTINGS);
+    if(root.exists(SERVER_SETTINGS.c_str()))
+    {
+        root[SERVER_SETTINGS.c_str()].lookupValue("signal-delivery", delivery);
+        root[SERVER_SETTINGS.c_str()].lookupValue("state-page", statepage);
+        root[SERVER_SETTINGS.c_str()].lookupValue("event-socket", eventsocket);
+        root[SERVER_SETTINGS.c_str()].lookupValue("state-file", statefile);
+        root[SERVER_SETTINGS.c_str()].lookupValue("state-sync-ms", statesync);
+        root[SERVER_SETTINGS.c_str()].lookupValue("metrics-file", metricsfile);
+        root[SERVER_SETTINGS.c_str()].lookupValue("metrics-interval-ms", metricsinterval);
+        root[SERVER_SETTINGS.c_str()].lookupValue("trace-file", this->traceFile);
+    }
+
+    if(!statepage.empty())
+    {
+        this->statePage = new StatePage(statepage);
+    }
+
+    if(!eventsocket.empty())
+    {
+        this->eventStream = new EventStream(eventsocket);
+    }
+
+    if(!statefile.empty())
+    {
+        this->stateStore = new StateStore(statefile, statesync > 0 ? statesync : 0);
+        if(!this->stateStore->Open())
+        {
+            clog << kLogWarning << "Not saving output states" << endl;
+            delete this->stateStore;
+            this->stateStore = NULL;
+        }
+    }
+
+    if(!metricsfile.empty())
+    {
+        this->metricsFile = new MetricsFile(metricsfile, metricsinterval > 0 ? metricsinterval : 0);
+        this->metricsFile->Start();
+    }
+
+    if(boost::iequals(delivery,"subscribed"))
+    {
+        clog << kLogInfo << "Sending signals only to subscribed clients" << endl;
+        this->subscriptions.Subscribed(true);
+        this->nameWatcher = new BusNameWatcher(this->conn(), this->subscriptions);
+    }
+    else if(!boost::iequals(delivery,"broadcast"))
+    {
+        clog << kLogWarning << "Unknown signal-delivery '" << delivery << "', broadcasting signals" << endl;
+    }
+}
+
 void PiIoServer::initHardware(Config &config)
 {
     // Loop thhrough the config file looking for settings
     Setting& root = config.getRoot();
+    std::vector<IoGroupBase*> groups;
+    double start = now_ms(), initialized, started;
     
     clog << "Parsing config..." << endl;
 
+    // Reading the settings and taking the pin leases is done in config order, so conflicts are always resolved the same way
+    for(int i=0; i < root.getLength(); ++i)
+    {
+        Setting& setting = root[i];
+
+        // The server settings are not an IO group
+        if(SERVER_SETTINGS == setting.getName())
+            continue;
+        
+        IoGroupBase * g = this->addIoGroup(setting);
+        if(g != NULL)
+            groups.push_back(g);
+    }
+    initialized = now_ms();
+
+    // The slow part, bringing up the hardware, is done concurrently for each bus
+    this->startIoGroups(groups);
+    started = now_ms();
+
+    // Now that all IOs are known, the state page and event stream can be laid out
+    this->publishIoGroups(false);
+
+    clog << kLogInfo << "Startup took " << (now_ms() - start) << " ms: configuration " << (initialized - start) << " ms, hardware " 
+         << (started - initialized) << " ms, publishing " << (now_ms() - started) << " ms" << endl;
+}
+
+void PiIoServer::Reload(Config &config)
+{
+    Setting& root = config.getRoot();
+    std::set<std::string> names;
+    std::vector<IoGroupBase*> added;
+    int removed = 0;
+    double start = now_ms();
+
+    clog << kLogInfo << "Reloading configuration" << endl;
+
+    if(settingFingerprint(root, SERVER_SETTINGS) != this->serverFingerprint)
+    {
+        clog << kLogWarning << "Server settings changed, restart the server to apply them" << endl;
+    }
+
+    for(int i=0; i < root.getLength(); ++i)
+    {
+        if(SERVER_SETTINGS != root[i].getName())
+            names.insert(root[i].getName());
+    }
+
+    // Remove groups that are gone or changed first, so their pins are free for the new ones
+    std::set<IoGroupBase*> groups = this->iogroups;
+    for(std::set<IoGroupBase*>::iterator it = groups.begin(); it != groups.end(); ++it)
+    {
+        std::string name = (*it)->Name();
+        if(names.count(name) == 0 || settingFingerprint(root, name) != this->groupFingerprints[name])
+        {
+            clog << kLogInfo << "Removing IO Group '" << name << "'" << endl;
+            this->removeIoGroup(*it);
+            removed++;
+        }
+    }
+
+    // Create the new and changed groups, and retry those that failed before. The rest keeps running untouched
     for(int i=0; i < root.getLength(); ++i)
     {
         Setting& setting = root[i];
+        if(SERVER_SETTINGS == setting.getName() || this->findIoGroup(setting.getName()) != NULL)
+            continue;
+
+        IoGroupBase * g = this->addIoGroup(setting);
+        if(g != NULL)
+            added.push_back(g);
+    }
+    this->startIoGroups(added);
+
+    if(removed > 0 || !added.empty())
+    {
+        this->publishIoGroups(true);
+    }
+
+    clog << kLogInfo << "Configuration reloaded in " << (now_ms() - start) << " ms: " << removed << " groups removed, " 
+         << added.size() << " groups created" << endl;
+}
+
+IoGroupBase* PiIoServer::addIoGroup(Setting &setting)
+{
+    clog << "Creating IO Group" << endl;
+    try
+    {
+        IoGroupBase* g = this->createIoGroup(setting);
+        g->onCriticalError.connect(boost::bind(&PiIoServer::criticalError, this, _1, _2));
+        g->Subscriptions(&this->subscriptions);
+        g->onPropertiesDirty.connect(boost::bind(&PiIoServer::propertiesDirty, this, _1));
+        if(this->stateStore != NULL)
+        {
+            // Before the group is started, so restored values are the first ones written to the hardware
+            g->PersistState(this->stateStore);
+        }
         
-        clog << "Creating IO Group" << endl;
+        if(g->Interface() == "nl.miqra.PiIo.IoGroup.Digital")
+        {
+            IoGroupDigital* d = (IoGroupDigital*)g;
+            d->onButtonPress.connect(boost::bind(&PiIoServer::buttonPress, this, _1,_2));
+            d->onButtonHold.connect(boost::bind(&PiIoServer::buttonHold, this, _1,_2));
+            d->onButtonGesture.connect(boost::bind(&PiIoServer::buttonGesture, this, _1,_2,_3,_4));
+            d->onInputChanged.connect(boost::bind(&PiIoServer::inputChanged, this, _1,_2,_3));
+            d->onMbInputChanged.connect(boost::bind(&PiIoServer::mbInputChanged, this, _1,_2,_3));
+        }
+        
+        this->iogroups.insert(g);
+        this->groupFingerprints[g->Name()] = settingFingerprint(setting);
+        return g;
+    }
+    catch(InvalidArgumentException x)
+    {
+        // Ignore things, log has been made
+        clog << kLogWarning << "Error setting up iogroup: " << x.what() << endl;
+    }
+    catch(std::exception x)
+    {
+        clog << kLogError << "Error setting up iogroup: " << x.what() << endl;
+    }
+    return NULL;
+}
+
+struct StartWorker
+{
+    pthread_t thread;
+    std::string bus;
+    std::vector<IoGroupBase*> groups;
+    std::vector<IoGroupBase*> failed;
+    double time;
+};
+
+static void * startWorkerThread(void * obj)
+{
+    StartWorker * worker = (StartWorker *)obj;
+    double start = now_ms();
+    
+    for(std::vector<IoGroupBase*>::iterator it = worker->groups.begin(); it != worker->groups.end(); ++it)
+    {
+        double groupStart = now_ms();
         try
         {
-            
-            IoGroupBase* g = this->createIoGroup(setting);
-            g->onCriticalError.connect(boost::bind(&PiIoServer::criticalError, this, _1, _2));
-            
-            if(g->Interface() == "nl.miqra.PiIo.IoGroup.Digital")
-            {
-                IoGroupDigital* d = (IoGroupDigital*)g;
-                d->onButtonPress.connect(boost::bind(&PiIoServer::buttonPress, this, _1,_2));
-                d->onButtonHold.connect(boost::bind(&PiIoServer::buttonHold, this, _1,_2));
-                d->onInputChanged.connect(boost::bind(&PiIoServer::inputChanged, this, _1,_2,_3));
-                d->onMbInputChanged.connect(boost::bind(&PiIoServer::mbInputChanged, this, _1,_2,_3));
-            }
-            
-            this->iogroups.insert(g);
+            (*it)->Start();
+            clog << kLogInfo << "Started IO Group '" << (*it)->Name() << "' in " << (now_ms() - groupStart) << " ms" << endl;
         }
-        catch(InvalidArgumentException x)
+        catch(std::exception &x)
         {
-            // Ignore things, log has been made
-            clog << kLogWarning << "Error setting up iogroup: " << x.what() << endl;
+            clog << kLogError << "Error starting iogroup '" << (*it)->Name() << "': " << x.what() << endl;
+            worker->failed.push_back(*it);
         }
-        catch(std::exception x)
+    }
+    
+    worker->time = now_ms() - start;
+    return NULL;
+}
+
+void PiIoServer::startIoGroups(std::vector<IoGroupBase*> &groups)
+{
+    // One worker per bus, starting the groups on it in config order
+    std::map<std::string, StartWorker> workers;
+    for(std::vector<IoGroupBase*>::iterator it = groups.begin(); it != groups.end(); ++it)
+    {
+        StartWorker &w = workers[(*it)->Bus()];
+        w.bus = (*it)->Bus();
+        w.groups.push_back(*it);
+    }
+
+    for(std::map<std::string, StartWorker>::iterator it = workers.begin(); it != workers.end(); ++it)
+    {
+        if(pthread_create(&it->second.thread, NULL, startWorkerThread, &it->second) != 0)
+        {
+            // Start on this thread instead
+            startWorkerThread(&it->second);
+            it->second.thread = pthread_self();
+        }
+    }
+
+    for(std::map<std::string, StartWorker>::iterator it = workers.begin(); it != workers.end(); ++it)
+    {
+        if(!pthread_equal(it->second.thread, pthread_self()))
+            pthread_join(it->second.thread, NULL);
+        
+        clog << kLogInfo << "Started " << it->second.groups.size() - it->second.failed.size() << " of " << it->second.groups.size()
+             << " IO Groups on bus '" << (it->first.empty() ? "none" : it->first) << "' in " << it->second.time << " ms" << endl;
+
+        // Groups that failed are removed completely, releasing their pins
+        for(std::vector<IoGroupBase*>::iterator g = it->second.failed.begin(); g != it->second.failed.end(); ++g)
+        {
+            groups.erase(std::find(groups.begin(), groups.end(), *g));
+            this->removeIoGroup(*g);
+        }
+    }
+}
+
+void PiIoServer::removeIoGroup(IoGroupBase * g)
+{
+    g->onPropertiesDirty.disconnect_all_slots();
+    this->iogroups.erase(g);
+    this->groupFingerprints.erase(g->Name());
+    delete g;
+
+    // Make sure no property flush is pending for the group anymore. Only now that its threads are
+    // joined, since one of them may have been marking it dirty while the slots were disconnected.
+    // The flush runs on this (the dispatcher) thread, so it cannot be using the group meanwhile
+    pthread_mutex_lock(&this->propertiesMutex);
+    this->dirtyGroups.erase(g);
+    pthread_mutex_unlock(&this->propertiesMutex);
+}
+
+IoGroupBase* PiIoServer::findIoGroup(const std::string &name)
+{
+    for(std::set<IoGroupBase*>::iterator it = this->iogroups.begin(); it != this->iogroups.end(); ++it)
+    {
+        if((*it)->Name() == name)
+            return *it;
+    }
+    return NULL;
+}
+
+void PiIoServer::publishIoGroups(bool reload)
+{
+    if(this->statePage != NULL)
+    {
+        // Entries can only be registered before a page is opened, so a reload gets a new page. 
+        // The old one stays allocated until the next reload, since group threads may still be updating it.
+        StatePage * page = reload ? new StatePage(this->statePage->Name()) : this->statePage;
+        for(std::set<IoGroupBase*>::iterator it = this->iogroups.begin(); it != this->iogroups.end(); ++it)
+        {
+            (*it)->PublishState(page);
+        }
+        page->Open();
+        
+        if(reload)
+        {
+            // All groups were moved to a newer page since the page retired on the last reload
+            delete this->retiredStatePage;
+            this->statePage->Retire();
+            this->retiredStatePage = this->statePage;
+            this->statePage = page;
+        }
+    }
+
+    if(this->eventStream != NULL)
+    {
+        if(reload)
+            this->eventStream->Reset();
+        for(std::set<IoGroupBase*>::iterator it = this->iogroups.begin(); it != this->iogroups.end(); ++it)
+        {
+            (*it)->PublishEvents(this->eventStream);
+        }
+
+        if(reload)
+        {
+            this->eventStream->Reannounce();
+        }
+        else if(!this->eventStream->Start())
         {
-            clog << kLogError << "Error setting up iogroup: " << x.what() << endl;
+            // The groups hold on to the stream, detach them before it goes
+            for(std::set<IoGroupBase*>::iterator it = this->iogroups.begin(); it != this->iogroups.end(); ++it)
+            {
+                (*it)->PublishEvents(NULL);
+            }
+            delete this->eventStream;
+            this->eventStream = NULL;
         }
     }
 }
@@ -131,21 +650,21 @@ IoGroupBase* PiIoServer::createIoGroup(Setting &setting)
         {
         	clog << "Initializing GPIO IO Group" << endl;
             IoGroupGpio* g = new IoGroupGpio(this->conn(), buspath, *(this->gpioRegistry));
-            g->Initialize(setting);
+            initializeIoGroup(g, setting);
             return g;
         }
         else if(boost::iequals(type,"MCP23017"))
         {
         	clog << "Initializing MCP23017 IO Group" << endl;
             IoGroupMCP23017* g =  new IoGroupMCP23017(this->conn(), buspath, *(this->gpioRegistry));
-            g->Initialize(setting);
+            initializeIoGroup(g, setting);
             return g;
         }
         else if(boost::iequals(type,"PCA9685"))
         {
         	clog << "Initializing PCA9685 IO Group" << endl;
         	IoGroupPCA9685 * g =  new IoGroupPCA9685(this->conn(), buspath, *(this->gpioRegistry));
-            g->Initialize(setting);
+            initializeIoGroup(g, setting);
             return g;
         }
         else
@@ -174,6 +693,73 @@ std::vector< ::DBus::Path > PiIoServer::IoGroups()
     return groups;
 }
 
+std::vector< std::string > PiIoServer::Histograms()
+{
+    return Stats::Instance().Names();
+}
+
+void PiIoServer::GetHistogram(const std::string& name, uint64_t& count, uint64_t& sum_ns, uint64_t& max_ns, std::vector< uint64_t >& buckets)
+{
+    Stats::Summary summary;
+    if(!Stats::Instance().Get(name, summary))
+        throw ::DBus::ErrorInvalidArgs("No such histogram");
+    
+    count = summary.count;
+    sum_ns = summary.sum;
+    max_ns = summary.max;
+    buckets = summary.buckets;
+}
+
+void PiIoServer::Reset()
+{
+    Stats::Instance().Reset();
+}
+
+int32_t PiIoServer::DumpTrace()
+{
+    if(!Trace::Enabled())
+        throw ::DBus::ErrorNotSupported("Tracing is not compiled in, configure with --enable-trace");
+    
+    // The default directory is only writable by root, create it on first use
+    std::string file = this->traceFile;
+    size_t slash = file.rfind('/');
+    if(slash != std::string::npos && slash > 0)
+        mkdir(file.substr(0, slash).c_str(), 0755);
+    
+    int32_t events = Trace::Dump(file);
+    if(events < 0)
+    {
+        clog << kLogError << "Could not write trace to '" << file << "'" << endl;
+        throw ::DBus::ErrorFailed("Could not write trace file");
+    }
+    
+    clog << kLogInfo << "Wrote " << events << " trace events to '" << file << "'" << endl;
+    return events;
+}
+
+bool PiIoServer::countCall(const DBus::Message &msg)
+{
+    if(msg.type() == DBUS_MESSAGE_TYPE_METHOD_CALL)
+        this->methodCalls.Add();
+    return false;
+}
+
+void PiIoServer::registerMetrics()
+{
+    Stats::Instance().Register("piio_i2c_transfers_total", "", &i2cTransfers);
+    Stats::Instance().Register("piio_i2c_errors_total", "", &i2cErrors);
+    Stats::Instance().Register("piio_dbus_method_calls_total", "", &this->methodCalls);
+    Stats::Instance().Register("piio_dbus_signals_total", "", &SignalSubscriptions::SignalsSent);
+}
+
+void PiIoServer::unregisterMetrics()
+{
+    Stats::Instance().Unregister(&i2cTransfers);
+    Stats::Instance().Unregister(&i2cErrors);
+    Stats::Instance().Unregister(&this->methodCalls);
+    Stats::Instance().Unregister(&SignalSubscriptions::SignalsSent);
+}
+
 void PiIoServer::criticalError(IoGroupBase * sender, std::string message)
 {
     clog << kLogCritical << sender->Name() << ": Fatal error - " << message << endl;
@@ -181,42 +767,187 @@ void PiIoServer::criticalError(IoGroupBase * sender, std::string message)
     niam(1);
 }
 
+void PiIoServer::propertiesDirty(IoGroupBase * sender)
+{
+    bool wake;
+    
+    pthread_mutex_lock(&this->propertiesMutex);
+    this->dirtyGroups.insert(sender);
+    wake = !this->propertiesPending;
+    this->propertiesPending = true;
+    pthread_mutex_unlock(&this->propertiesMutex);
+    
+    // Wake the dispatcher once, all changes until it gets to them go out together
+    if(wake)
+    {
+        char c = 0;
+        this->propertiesPipe->write(&c, 1);
+    }
+}
+
+void PiIoServer::propertiesPipeHandler(const void *data, void *buffer, unsigned int nbyte)
+{
+    PiIoServer * server = (PiIoServer *)data;
+    std::set<IoGroupBase*> groups;
+    
+    pthread_mutex_lock(&server->propertiesMutex);
+    groups.swap(server->dirtyGroups);
+    server->propertiesPending = false;
+    pthread_mutex_unlock(&server->propertiesMutex);
+
+    for(std::set<IoGroupBase*>::iterator it = groups.begin(); it != groups.end(); ++it)
+    {
+        (*it)->FlushPropertyChanges();
+    }
+}
+
+void PiIoServer::Subscribe(const std::vector< std::string >& patterns)
+{
+    // Never called, Subscribe is dispatched to subscribeCall
+}
+
+void PiIoServer::Unsubscribe(const std::vector< std::string >& patterns)
+{
+    // Never called, Unsubscribe is dispatched to unsubscribeCall
+}
+
+DBus::Message PiIoServer::subscribeCall(const DBus::CallMessage &call)
+{
+    DBus::MessageIter ri = call.reader();
+    std::vector< std::string > patterns;
+    ri >> patterns;
+
+    this->subscriptions.Subscribe(call.sender(), patterns);
+    return DBus::ReturnMessage(call);
+}
+
+DBus::Message PiIoServer::unsubscribeCall(const DBus::CallMessage &call)
+{
+    DBus::MessageIter ri = call.reader();
+    std::vector< std::string > patterns;
+    ri >> patterns;
+
+    this->subscriptions.Unsubscribe(call.sender(), patterns);
+    return DBus::ReturnMessage(call);
+}
+
 void PiIoServer::buttonPress(IoGroupDigital* sender, std::string handle)
 {
-    string longname = sender->Name() + "." + handle;
-    this->OnButtonPress(longname);
+    std::vector<std::string> recipients;
+    if(this->subscriptions.Recipients(sender->Name(), handle, recipients))
+    {
+        string longname = sender->Name() + "." + handle;
+        SignalSubscriptions::Send(this->serverAdaptor(), "OnButtonPress", recipients, longname);
+    }
 }
 
 void PiIoServer::buttonHold(IoGroupDigital* sender, std::string handle)
 {
-    string longname = sender->Name() + "." + handle;
-    this->OnButtonHold(longname);
+    std::vector<std::string> recipients;
+    if(this->subscriptions.Recipients(sender->Name(), handle, recipients))
+    {
+        string longname = sender->Name() + "." + handle;
+        SignalSubscriptions::Send(this->serverAdaptor(), "OnButtonHold", recipients, longname);
+    }
+}
+
+void PiIoServer::buttonGesture(IoGroupDigital* sender, std::string handle, std::string gesture, uint32_t count)
+{
+    std::vector<std::string> recipients;
+    if(this->subscriptions.Recipients(sender->Name(), handle, recipients))
+    {
+        string longname = sender->Name() + "." + handle;
+        SignalSubscriptions::Send(this->serverAdaptor(), "OnButtonGesture", recipients, longname, gesture, count);
+    }
 }
     
 void PiIoServer::inputChanged(IoGroupDigital* sender, std::string handle, bool value)
 {
-    string longname = sender->Name() + "." + handle;
-    this->OnInputChanged(longname, value);
+    std::vector<std::string> recipients;
+    if(this->subscriptions.Recipients(sender->Name(), handle, recipients))
+    {
+        string longname = sender->Name() + "." + handle;
+        SignalSubscriptions::Send(this->serverAdaptor(), "OnInputChanged", recipients, longname, value);
+    }
 }
 
 void PiIoServer::mbInputChanged(IoGroupDigital* sender, std::string handle, uint32_t value)
 {
-    string longname = sender->Name() + "." + handle;
-    this->OnMbInputChanged(longname, value);
+    std::vector<std::string> recipients;
+    if(this->subscriptions.Recipients(sender->Name(), handle, recipients))
+    {
+        string longname = sender->Name() + "." + handle;
+        SignalSubscriptions::Send(this->serverAdaptor(), "OnMbInputChanged", recipients, longname, value);
+    }
 }
 
-
-DBus::BusDispatcher dispatcher;
-
 void niam(int sig)
 {
     dispatcher.leave();
 }
 
+void reload(int sig)
+{
+    if(reloadPipe != NULL)
+    {
+        char c = 0;
+        reloadPipe->write(&c, 1);
+    }
+}
+
+void dumpTrace(int sig)
+{
+    if(tracePipe != NULL)
+    {
+        char c = 0;
+        tracePipe->write(&c, 1);
+    }
+}
+
+static void tracePipeHandler(const void *data, void *buffer, unsigned int nbyte)
+{
+    PiIoServer * server = (PiIoServer *)data;
+    
+    try
+    {
+        server->DumpTrace();
+    }
+    catch(const DBus::Error &x)
+    {
+        // Already logged
+    }
+}
+
+static void reloadPipeHandler(const void *data, void *buffer, unsigned int nbyte)
+{
+    PiIoServer * server = (PiIoServer *)data;
+    Config config;
+    
+    try
+    {
+        config.readFile(cfgFile.c_str());
+    }
+    catch(const FileIOException& x)
+    {
+        clog << kLogError << "Cannot read file '" << cfgFile << "', configuration not reloaded" << endl;
+        return;
+    }
+    catch(const libconfig::ParseException& x)
+    {
+        clog << kLogError << "Error parsing config: " << x.getError() << " on line " << x.getLine() << " of '" << x.getFile() << "', configuration not reloaded" << endl;
+        return;
+    }
+    
+    server->Reload(config);
+}
+
 int main(int argc, char ** argv)
 {
     signal(SIGTERM, niam);
     signal(SIGINT, niam);
+    // Reloading is possible once the server is up
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGUSR2, SIG_IGN);
 
     Config config;
     
@@ -226,6 +957,8 @@ int main(int argc, char ** argv)
     desc.add_options()
         ("help", "Show this help message")
         ("config,c", po::value< vector<string> >(), "specify configuration file")
+        ("bus", po::value<string>(), "connect to the D-Bus bus at this address instead of the system bus")
+        ("simulate", "run on simulated hardware instead of the gpio and i2c devices")
     ;
      
     po::variables_map vm;
@@ -241,6 +974,7 @@ int main(int argc, char ** argv)
     if (vm.count("config"))
     {
         string cfgfile = vm["config"].as< vector<string> >()[0];
+        cfgFile = cfgfile;
         try
         {
             config.readFile(cfgfile.c_str());
@@ -281,21 +1015,65 @@ int main(int argc, char ** argv)
     // Initialize clog to be redirected to syslog key "mediacore.hid.server"
     Log::Init("piio");
 
-    DBus::Connection systemBus = DBus::Connection::SystemBus();
+    // Normally the system bus, or a private bus given on the command line, e.g. for benchmarks and tests
+    string busaddress = vm.count("bus") ? vm["bus"].as<string>() : "";
+    DBus::Connection systemBus = busaddress.empty() ? DBus::Connection::SystemBus() : DBus::Connection(busaddress.c_str());
+    if(!busaddress.empty())
+    {
+        clog << kLogInfo << "Connected to bus at '" << busaddress << "'" << endl;
+        systemBus.register_bus();
+    }
     systemBus.request_name(SERVER_DBUS_INTF.c_str());
 
-    int result = gpio_init(); // initialize the c_gpio subsystem;
+    int result;
+    bool simulate = (vm.count("simulate") > 0);
+    if(simulate)
+    {
+        // Device models for the configured io groups need to be in place before the groups start
+        result = Simulator::Instance().Enable() ? GPIO_SETUP_OK : GPIO_SETUP_MALLOC_FAIL;
+        if(result == GPIO_SETUP_OK)
+            Simulator::Instance().Configure(config);
+    }
+    else
+    {
+        result = gpio_init(); // initialize the c_gpio subsystem;
+    }
     
     if(result == GPIO_SETUP_OK)
     {
-        PiIoServer server(systemBus, config);
-        dispatcher.enter();
+        {
+            SimulatorControl * simulatorControl = simulate ? new SimulatorControl(systemBus) : NULL;
+            PiIoServer server(systemBus, config);
+            
+            reloadPipe = dispatcher.add_pipe(&reloadPipeHandler, &server);
+            signal(SIGHUP, reload);
+            if(Trace::Enabled())
+            {
+                tracePipe = dispatcher.add_pipe(&tracePipeHandler, &server);
+                signal(SIGUSR2, dumpTrace);
+            }
+            
+            dispatcher.enter();
+            
+            signal(SIGHUP, SIG_IGN);
+            signal(SIGUSR2, SIG_IGN);
+            dispatcher.del_pipe(reloadPipe);
+            reloadPipe = NULL;
+            if(tracePipe != NULL)
+            {
+                dispatcher.del_pipe(tracePipe);
+                tracePipe = NULL;
+            }
+            delete simulatorControl;
+        }
         gpio_cleanup();
+        Log::Close();
         return 0;
     }
     else
     {
         clog << "Could not open gpio memory map. This program must be run as root" << endl;
+        Log::Close();
         return 1;
     }
 }
@@ -8,6 +8,7 @@
 
 #include "pi-io-server-glue.hpp"
 #include "gpioregistry.hpp"
+#include "signalsubscriptions.hpp"
 #include "iogroup-base.hpp"
 #include "iogroup-digital.hpp"
 
@@ -15,9 +16,13 @@
 #include "mcp23017/mcp23017.hpp"
 #include "thread/thread.hpp"
 #include "buttontimer/buttontimer.hpp"
+#include "timerservice/timerservice.hpp"
+#include "stats/stats.hpp"
+#include "stats/metricsfile.hpp"
 
 class PiIoServer 
   : public nl::miqra::PiIo_adaptor, // << This will be generated by the makefile using dbusxx-xml2cpp on mc-hid-introspect.xml
+  public nl::miqra::PiIo::Stats_adaptor,
   public DBus::IntrospectableAdaptor,
   public DBus::ObjectAdaptor
 {
@@ -27,22 +32,80 @@ public:
     ~PiIoServer();
 
     virtual std::vector< ::DBus::Path > IoGroups();
+    virtual void Subscribe(const std::vector< std::string >& patterns);
+    virtual void Unsubscribe(const std::vector< std::string >& patterns);
+
+    // nl.miqra.PiIo.Stats: latency histograms of the realtime loops
+    virtual std::vector< std::string > Histograms();
+    virtual void GetHistogram(const std::string& name, uint64_t& count, uint64_t& sum_ns, uint64_t& max_ns, std::vector< uint64_t >& buckets);
+    virtual void Reset();
+    // Write the trace buffers as Chrome trace JSON to the configured trace file
+    virtual int32_t DumpTrace();
+
+    // Apply a changed configuration. Only groups whose settings changed are recreated, 
+    // the others keep running undisturbed. Call from the dispatcher thread
+    void Reload(libconfig::Config &config);
 
 private:
+    // The server interface, for emitting its signals
+    DBus::InterfaceAdaptor & serverAdaptor() { return *static_cast<nl::miqra::PiIo_adaptor*>(this); }
+
     GpioRegistry * gpioRegistry;
     std::set<IoGroupBase*> iogroups;
+    SignalSubscriptions subscriptions;
+    BusNameWatcher * nameWatcher;
+    StatePage * statePage;
+    StatePage * retiredStatePage;   // Page replaced on the last reload, freed on the next one
+    EventStream * eventStream;
+    StateStore * stateStore;
+    MetricsFile * metricsFile;
+    std::string traceFile;
+    Counter methodCalls;
+    DBus::MessageSlot callFilter;
+
+    // Groups with property changes, flushed once per dispatch cycle from the dispatcher thread
+    std::set<IoGroupBase*> dirtyGroups;
+    bool propertiesPending;
+    pthread_mutex_t propertiesMutex;
+    DBus::Pipe * propertiesPipe;
     
+    void initServer(libconfig::Config &config);
     void initHardware(libconfig::Config &config);
     IoGroupBase* createIoGroup(libconfig::Setting &setting);
+    // Create a group and initialize it from its settings, without starting its hardware
+    IoGroupBase* addIoGroup(libconfig::Setting &setting);
+    // Start the hardware of groups, concurrently for groups on different buses. Groups that fail are removed
+    void startIoGroups(std::vector<IoGroupBase*> &groups);
+    void removeIoGroup(IoGroupBase * g);
+    IoGroupBase* findIoGroup(const std::string &name);
+    // Register all IOs with the state page and event stream
+    void publishIoGroups(bool reload);
+
+    // Fingerprints of the settings the running groups and server were created with, by group name
+    std::map<std::string, std::string> groupFingerprints;
+    std::string serverFingerprint;
 
     void criticalError(IoGroupBase * sender, std::string message);
     void buttonPress(IoGroupDigital* sender, std::string handle);
 
     void buttonHold(IoGroupDigital* sender, std::string handle);
+    void buttonGesture(IoGroupDigital* sender, std::string handle, std::string gesture, uint32_t count);
     void inputChanged(IoGroupDigital* sender, std::string handle , bool value);
 
     void mbInputChanged(IoGroupDigital*, std::string, uint32_t value);
 
+    void propertiesDirty(IoGroupBase * sender);
+    static void propertiesPipeHandler(const void *data, void *buffer, unsigned int nbyte);
+
+    // Connection filter counting the method calls to the server and its groups. Never handles the message
+    bool countCall(const DBus::Message &msg);
+    void registerMetrics();
+    void unregisterMetrics();
+
+    // Method handlers for Subscribe and Unsubscribe, which need to know the calling client
+    DBus::Message subscribeCall(const DBus::CallMessage &call);
+    DBus::Message unsubscribeCall(const DBus::CallMessage &call);
+
 };
 
 #endif//__MC_HID_SERVER_HPP
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "signalsubscriptions.hpp"
+#include "log/log.hpp"
+#include "thread/thread.hpp"
+#include <fnmatch.h>
+
+using namespace std;
+
+Counter SignalSubscriptions::SignalsSent;
+
+SignalSubscriptions::SignalSubscriptions()
+{
+    this->subscribed = false;
+    this->patternCount = 0;
+    Thread::InitMutex(&this->mutex);
+}
+
+SignalSubscriptions::~SignalSubscriptions()
+{
+    pthread_mutex_destroy(&this->mutex);
+}
+
+void SignalSubscriptions::Subscribed(bool subscribed)
+{
+    this->subscribed = subscribed;
+}
+
+bool SignalSubscriptions::Subscribed()
+{
+    return this->subscribed;
+}
+
+void SignalSubscriptions::Subscribe(const std::string &client, const std::vector<std::string> &patterns)
+{
+    pthread_mutex_lock(&this->mutex);
+    std::set<std::string> &p = this->clients[client];
+    for(std::vector<std::string>::const_iterator it = patterns.begin(); it != patterns.end(); ++it)
+    {
+        if(p.insert(*it).second)
+        {
+            this->patternCount++;
+            clog << kLogDebug << "Client '" << client << "' subscribed to '" << *it << "'" << endl;
+        }
+    }
+    if(p.empty())
+    {
+        this->clients.erase(client);
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void SignalSubscriptions::Unsubscribe(const std::string &client, const std::vector<std::string> &patterns)
+{
+    pthread_mutex_lock(&this->mutex);
+    std::map<std::string, std::set<std::string> >::iterator c = this->clients.find(client);
+    if(c != this->clients.end())
+    {
+        for(std::vector<std::string>::const_iterator it = patterns.begin(); it != patterns.end(); ++it)
+        {
+            if(c->second.erase(*it) > 0)
+            {
+                this->patternCount--;
+                clog << kLogDebug << "Client '" << client << "' unsubscribed from '" << *it << "'" << endl;
+            }
+        }
+        if(c->second.empty())
+        {
+            this->clients.erase(c);
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void SignalSubscriptions::RemoveClient(const std::string &client)
+{
+    pthread_mutex_lock(&this->mutex);
+    std::map<std::string, std::set<std::string> >::iterator c = this->clients.find(client);
+    if(c != this->clients.end())
+    {
+        this->patternCount -= c->second.size();
+        this->clients.erase(c);
+        clog << kLogDebug << "Client '" << client << "' left the bus, removed its subscriptions" << endl;
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+bool SignalSubscriptions::Recipients(const std::string &group, const std::string &handle, std::vector<std::string> &recipients)
+{
+    if(!this->subscribed)
+        return true;    // broadcast
+
+    if(this->patternCount == 0)
+        return false;   // nobody is listening
+    
+    std::string longhandle = group + "." + handle;
+
+    pthread_mutex_lock(&this->mutex);
+    for(std::map<std::string, std::set<std::string> >::iterator c = this->clients.begin(); c != this->clients.end(); ++c)
+    {
+        for(std::set<std::string>::iterator p = c->second.begin(); p != c->second.end(); ++p)
+        {
+            if(fnmatch(p->c_str(), longhandle.c_str(), 0) == 0)
+            {
+                recipients.push_back(c->first);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    
+    return !recipients.empty();
+}
+
+BusNameWatcher::BusNameWatcher(DBus::Connection &connection, SignalSubscriptions &subscriptions)
+ : DBus::ObjectProxy(connection, "/org/freedesktop/DBus", "org.freedesktop.DBus"),
+   subscriptions(subscriptions)
+{
+
+}
+
+void BusNameWatcher::NameOwnerChanged(const std::string& name, const std::string& old_owner, const std::string& new_owner)
+{
+    // A unique name losing its owner means the client has disconnected
+    if(new_owner.empty() && name.size() > 0 && name[0] == ':')
+    {
+        this->subscriptions.RemoveClient(name);
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef __SIGNALSUBSCRIPTIONS_HPP
+#define __SIGNALSUBSCRIPTIONS_HPP
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <dbus-c++/dbus.h>
+#include "dbus-glue.hpp"
+#include "stats/stats.hpp"
+#include "trace/trace.h"
+
+// Keeps track of which bus clients want which signals
+// Clients subscribe with patterns (shell wildcards) on the long handle "group.handle".
+// In broadcast mode (the default), every signal is broadcast as usual. In subscription mode,
+// signals are only sent, as unicast, to clients with a matching subscription.
+class SignalSubscriptions 
+{
+public:
+
+    SignalSubscriptions();
+    ~SignalSubscriptions();
+
+    //! Switch between broadcast mode (false) and subscription mode (true)
+    void Subscribed(bool subscribed);
+    bool Subscribed();
+
+    void Subscribe(const std::string &client, const std::vector<std::string> &patterns);
+    void Unsubscribe(const std::string &client, const std::vector<std::string> &patterns);
+    //! Remove all subscriptions of a client
+    void RemoveClient(const std::string &client);
+
+    //! Find the clients a signal for group.handle should go to. Returns false if the signal should not be sent at all.
+    //! Returns true with an empty recipient list if the signal should be broadcast.
+    bool Recipients(const std::string &group, const std::string &handle, std::vector<std::string> &recipients);
+
+    //! Send a signal on an interface to the recipients, or broadcast it if the recipient list is empty.
+    //! The member name is used as the name of the trace span, so it must be a string literal
+    template<class T1> static void Send(DBus::InterfaceAdaptor &iface, const char *member, const std::vector<std::string> &recipients, const T1 &a1)
+    {
+        TRACE_SCOPE(member);
+        std::vector<std::string>::const_iterator it = recipients.begin();
+        do
+        {
+            DBus::SignalMessage sig(member);
+            DBus::MessageIter wi = sig.writer();
+            wi << a1;
+            if(it != recipients.end())
+                sig.destination((it++)->c_str());
+            iface.emit_signal(sig);
+            SignalsSent.Add();
+        }
+        while(it != recipients.end());
+    }
+
+    template<class T1, class T2> static void Send(DBus::InterfaceAdaptor &iface, const char *member, const std::vector<std::string> &recipients, const T1 &a1, const T2 &a2)
+    {
+        TRACE_SCOPE(member);
+        std::vector<std::string>::const_iterator it = recipients.begin();
+        do
+        {
+            DBus::SignalMessage sig(member);
+            DBus::MessageIter wi = sig.writer();
+            wi << a1;
+            wi << a2;
+            if(it != recipients.end())
+                sig.destination((it++)->c_str());
+            iface.emit_signal(sig);
+            SignalsSent.Add();
+        }
+        while(it != recipients.end());
+    }
+
+    template<class T1, class T2, class T3> static void Send(DBus::InterfaceAdaptor &iface, const char *member, const std::vector<std::string> &recipients, const T1 &a1, const T2 &a2, const T3 &a3)
+    {
+        TRACE_SCOPE(member);
+        std::vector<std::string>::const_iterator it = recipients.begin();
+        do
+        {
+            DBus::SignalMessage sig(member);
+            DBus::MessageIter wi = sig.writer();
+            wi << a1;
+            wi << a2;
+            wi << a3;
+            if(it != recipients.end())
+                sig.destination((it++)->c_str());
+            iface.emit_signal(sig);
+            SignalsSent.Add();
+        }
+        while(it != recipients.end());
+    }
+
+    //! Number of signal messages sent, counting each recipient of a unicast signal
+    static Counter SignalsSent;
+
+private:
+    bool subscribed;
+    volatile uint32_t patternCount;     // Total number of patterns, to skip matching when nobody is subscribed
+    std::map<std::string, std::set<std::string> > clients;
+    pthread_mutex_t mutex;
+};
+
+// Watches the bus for clients that disconnect, and drops their subscriptions
+class BusNameWatcher : public org::freedesktop::DBus_proxy, // << This will be generated by the makefile using dbusxx-xml2cpp on dbus-introspect.xml
+    public DBus::ObjectProxy
+{
+public:
+    BusNameWatcher(DBus::Connection &connection, SignalSubscriptions &subscriptions);
+
+    virtual void NameOwnerChanged(const std::string& name, const std::string& old_owner, const std::string& new_owner);
+
+private:
+    SignalSubscriptions &subscriptions;
+};
+
+#endif//__SIGNALSUBSCRIPTIONS_HPP
@@ -0,0 +1,241 @@
+#include "simdevices.hpp"
+#include <stdio.h>
+#include <string.h>
+
+// MCP23017 registers in BANK=0 mode, port A at the even and port B at the odd address
+#define MCP_IODIR       0x00
+#define MCP_IPOL        0x02
+#define MCP_GPINTEN     0x04
+#define MCP_DEFVAL      0x06
+#define MCP_INTCON      0x08
+#define MCP_IOCON       0x0A
+#define MCP_GPPU        0x0C
+#define MCP_INTF        0x0E
+#define MCP_INTCAP      0x10
+#define MCP_GPIO        0x12
+#define MCP_OLAT        0x14
+
+#define MCP_IOCON_INTPOL    0x02
+#define MCP_IOCON_SEQOP     0x20
+
+static std::string deviceName(const char *type, uint8_t address)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%s.0x%02x", type, address);
+    return name;
+}
+
+Mcp23017Model::Mcp23017Model(uint8_t address, int32_t intGpio)
+{
+    this->name = deviceName("mcp23017", address);
+    this->intGpio = intGpio;
+    // Power on reset values
+    this->iocon = 0;
+    this->iodir = 0xFFFF;
+    this->ipol = 0;
+    this->gpinten = 0;
+    this->defval = 0;
+    this->intcon = 0;
+    this->gppu = 0;
+    this->intf = 0;
+    this->intcap = 0;
+    this->olat = 0;
+    this->inputs = 0;
+    for(int i = 0; i < 16; i++)
+    {
+        this->inputSet[i] = false;
+    }
+    this->updateInterrupt();
+}
+
+uint8_t Mcp23017Model::Next(uint8_t reg)
+{
+    // With sequential operation disabled, the address pointer toggles between the A and B register
+    if(this->iocon & MCP_IOCON_SEQOP)
+        return reg ^ 0x01;
+    return (reg + 1) % 0x16;
+}
+
+uint16_t Mcp23017Model::pins()
+{
+    uint16_t driven = this->inputs;
+    for(int i = 0; i < 16; i++)
+    {
+        if(!this->inputSet[i] && (this->gppu & (1 << i)))
+            driven |= (1 << i);
+    }
+    return (this->iodir & driven) | (~this->iodir & this->olat);
+}
+
+uint16_t Mcp23017Model::port()
+{
+    return this->pins() ^ (this->ipol & this->iodir);
+}
+
+uint8_t Mcp23017Model::Read(uint8_t reg)
+{
+    bool high = (reg & 0x01);
+    uint8_t value = 0;
+    
+    switch(reg & 0xFE)
+    {
+        case MCP_IODIR:     value = getByte(this->iodir, high); break;
+        case MCP_IPOL:      value = getByte(this->ipol, high); break;
+        case MCP_GPINTEN:   value = getByte(this->gpinten, high); break;
+        case MCP_DEFVAL:    value = getByte(this->defval, high); break;
+        case MCP_INTCON:    value = getByte(this->intcon, high); break;
+        case MCP_IOCON:     value = this->iocon; break;
+        case MCP_GPPU:      value = getByte(this->gppu, high); break;
+        case MCP_INTF:      value = getByte(this->intf, high); break;
+        case MCP_OLAT:      value = getByte(this->olat, high); break;
+        case MCP_INTCAP:
+            value = getByte(this->intcap, high);
+            // Reading the captured value or the port clears the interrupt of the port
+            this->intf = setByte(this->intf, high, 0);
+            this->updateInterrupt();
+            break;
+        case MCP_GPIO:
+            value = getByte(this->port(), high);
+            this->intf = setByte(this->intf, high, 0);
+            this->updateInterrupt();
+            break;
+    }
+    return value;
+}
+
+void Mcp23017Model::Write(uint8_t reg, uint8_t value)
+{
+    bool high = (reg & 0x01);
+    uint16_t before = this->pins();
+    
+    switch(reg & 0xFE)
+    {
+        case MCP_IODIR:     this->iodir = setByte(this->iodir, high, value); break;
+        case MCP_IPOL:      this->ipol = setByte(this->ipol, high, value); break;
+        case MCP_GPINTEN:   this->gpinten = setByte(this->gpinten, high, value); break;
+        case MCP_DEFVAL:    this->defval = setByte(this->defval, high, value); break;
+        case MCP_INTCON:    this->intcon = setByte(this->intcon, high, value); break;
+        case MCP_IOCON:     this->iocon = value; this->updateInterrupt(); break;
+        case MCP_GPPU:      this->gppu = setByte(this->gppu, high, value); break;
+        case MCP_GPIO:      // Writing the port writes the output latch
+        case MCP_OLAT:      this->olat = setByte(this->olat, high, value); break;
+        default:            break;     // INTF and INTCAP are read only
+    }
+    
+    // Record the outputs that changed
+    uint16_t changed = (before ^ this->pins()) & ~this->iodir;
+    for(int i = 0; i < 16; i++)
+    {
+        if(changed & (1 << i))
+        {
+            char channel[48];
+            snprintf(channel, sizeof(channel), "%s.%d", this->name.c_str(), i);
+            Simulator::Instance().Record(channel, (this->pins() >> i) & 0x01);
+        }
+    }
+}
+
+void Mcp23017Model::SetInput(uint8_t pin, bool value)
+{
+    if(pin > 15)
+        return;
+    
+    uint16_t bit = (1 << pin);
+    uint16_t before = this->port();
+    
+    this->inputSet[pin] = true;
+    if(value)
+        this->inputs |= bit;
+    else
+        this->inputs &= ~bit;
+    
+    uint16_t after = this->port();
+    if(!(this->iodir & bit) || !(this->gpinten & bit))
+        return;
+    
+    // Interrupt on change from the previous value, or on a difference with DEFVAL
+    bool fire = (this->intcon & bit) ? ((after & bit) != (this->defval & bit)) : ((after & bit) != (before & bit));
+    if(fire)
+    {
+        // The port value is captured on the first interrupt, until it is cleared
+        if(this->intf == 0)
+            this->intcap = after;
+        this->intf |= bit;
+        this->updateInterrupt();
+    }
+}
+
+void Mcp23017Model::updateInterrupt()
+{
+    if(this->intGpio < 0)
+        return;
+    
+    bool active = (this->intf != 0);
+    bool activeHigh = (this->iocon & MCP_IOCON_INTPOL);
+    bool level = (active == activeHigh);
+    if(Simulator::Instance().GetGpio(this->intGpio) != level)
+        Simulator::Instance().SetGpio(this->intGpio, level);
+}
+
+Pca9685Model::Pca9685Model(uint8_t address)
+{
+    this->name = deviceName("pca9685", address);
+    memset(this->registers, 0, sizeof(this->registers));
+    // Power on reset values: sleeping, all outputs full off
+    this->registers[0x00] = 0x11;
+    this->registers[0x01] = 0x04;
+    this->registers[0xFE] = 0x1E;
+    for(int i = 0; i < 16; i++)
+    {
+        this->registers[0x06 + 4*i + 3] = 0x10;
+        this->duty[i] = 0;
+    }
+}
+
+uint8_t Pca9685Model::Read(uint8_t reg)
+{
+    return this->registers[reg];
+}
+
+void Pca9685Model::Write(uint8_t reg, uint8_t value)
+{
+    int first = 0, last = -1;
+    
+    this->registers[reg] = value;
+    if(reg >= 0x06 && reg < 0x46)
+    {
+        first = last = (reg - 0x06) / 4;
+    }
+    else if(reg >= 0xFA && reg <= 0xFD)
+    {
+        // ALL_LED registers write all channels
+        for(int i = 0; i < 16; i++)
+        {
+            this->registers[0x06 + 4*i + (reg - 0xFA)] = value;
+        }
+        first = 0;
+        last = 15;
+    }
+    
+    for(int i = first; i <= last; i++)
+    {
+        uint8_t * led = &(this->registers[0x06 + 4*i]);
+        uint32_t on = led[0] | ((led[1] & 0x0F) << 8);
+        uint32_t off = led[2] | ((led[3] & 0x0F) << 8);
+        uint32_t duty;
+        if(led[3] & 0x10)
+            duty = 0;           // Full off wins
+        else if(led[1] & 0x10)
+            duty = 4096;
+        else
+            duty = (off - on) & 0x0FFF;
+        
+        if(duty != this->duty[i])
+        {
+            this->duty[i] = duty;
+            char channel[48];
+            snprintf(channel, sizeof(channel), "%s.%d", this->name.c_str(), i);
+            Simulator::Instance().Record(channel, duty);
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef __SIMDEVICES_HPP
+#define __SIMDEVICES_HPP
+
+#include "simulator.hpp"
+#include <stdint.h>
+#include <string>
+
+// MCP23017 16 bit IO expander in BANK=0 mode, with interrupt on change. The INTA and INTB outputs are
+// modelled as one mirrored interrupt output, wired to a gpio pin of the simulator
+class Mcp23017Model : public SimDevice
+{
+public:
+    //! intGpio is the gpio pin the interrupt output drives, or -1 if it is not connected
+    Mcp23017Model(uint8_t address, int32_t intGpio);
+    
+    virtual uint8_t Read(uint8_t reg);
+    virtual void Write(uint8_t reg, uint8_t value);
+    virtual uint8_t Next(uint8_t reg);
+    
+    //! Drive an input pin from outside
+    void SetInput(uint8_t pin, bool value);
+    
+private:
+    std::string name;
+    int32_t intGpio;
+    uint8_t iocon;
+    uint16_t iodir, ipol, gpinten, defval, intcon, gppu, intf, intcap, olat;
+    uint16_t inputs;            // Levels driven on the pins from outside
+    bool inputSet[16];          // Unconnected inputs follow their pullup
+    
+    uint16_t pins();            // Current levels of all pins, inputs and outputs
+    uint16_t port();            // Value read from the GPIO register, with the input polarity applied
+    void updateInterrupt();
+    
+    static uint16_t setByte(uint16_t word, bool high, uint8_t value) { return high ? ((word & 0x00FF) | (value << 8)) : ((word & 0xFF00) | value); }
+    static uint8_t getByte(uint16_t word, bool high) { return high ? (word >> 8) : (word & 0xFF); }
+};
+
+// PCA9685 16 channel 12 bit PWM driver. Records the duty cycle of each channel, in counts of 4096
+class Pca9685Model : public SimDevice
+{
+public:
+    Pca9685Model(uint8_t address);
+    
+    virtual uint8_t Read(uint8_t reg);
+    virtual void Write(uint8_t reg, uint8_t value);
+    
+private:
+    std::string name;
+    uint8_t registers[256];
+    uint32_t duty[16];
+};
+
+#endif//__SIMDEVICES_HPP
@@ -0,0 +1,349 @@
+#include "simulator.hpp"
+#include "simdevices.hpp"
+#include "../gpio/c_gpio.h"
+#include "../i2c/i2c.h"
+#include "../thread/thread.hpp"
+#include "../log/log.hpp"
+#include <boost/algorithm/string.hpp>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#define SIM_FD_BASE     1000    // Device file descriptors are the i2c address plus this
+#define SIM_GPIO_PINS   64
+
+using namespace std;
+using namespace libconfig;
+
+volatile bool Simulator::enabled = false;
+
+Simulator & Simulator::Instance()
+{
+    static Simulator instance;
+    return instance;
+}
+
+bool Simulator::Enabled()
+{
+    return enabled;
+}
+
+Simulator::Simulator()
+{
+    Thread::InitMutex(&this->mutex, true);
+}
+
+uint64_t Simulator::now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+bool Simulator::Enable()
+{
+    static const struct i2c_sim_ops ops = { &Simulator::i2cOpen, &Simulator::i2cClose, &Simulator::i2cRead, &Simulator::i2cWrite };
+    
+    if(enabled)
+        return true;
+    
+    if(gpio_init_simulated() != GPIO_SETUP_OK)
+        return false;
+    gpio_set_output_hook(&Simulator::gpioOutput);
+    i2cSimulate(&ops);
+    
+    enabled = true;
+    clog << kLogNotice << "Running on simulated hardware" << endl;
+    return true;
+}
+
+void Simulator::Configure(Config &config)
+{
+    Setting& root = config.getRoot();
+    
+    for(int i=0; i < root.getLength(); ++i)
+    {
+        Setting& setting = root[i];
+        string type;
+        int32_t address;
+        
+        if(!setting.isGroup() || !setting.lookupValue("type", type) || !setting.lookupValue("address", address))
+            continue;
+        
+        if(boost::iequals(type, "MCP23017"))
+        {
+            int32_t intpin = -1;
+            setting.lookupValue("intpin", intpin);
+            this->AddDevice((uint8_t)address, new Mcp23017Model((uint8_t)address, intpin));
+        }
+        else if(boost::iequals(type, "PCA9685"))
+        {
+            this->AddDevice((uint8_t)address, new Pca9685Model((uint8_t)address));
+        }
+        else
+        {
+            continue;
+        }
+        clog << kLogInfo << "Simulating " << type << " on i2c address " << address << " for '" << setting.getName() << "'" << endl;
+    }
+}
+
+void Simulator::AddDevice(uint8_t address, SimDevice *device)
+{
+    pthread_mutex_lock(&this->mutex);
+    std::map<uint8_t, SimDevice*>::iterator it = this->devices.find(address);
+    if(it != this->devices.end())
+        delete it->second;
+    this->devices[address] = device;
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void Simulator::SetGpio(uint32_t pin, bool value)
+{
+    if(pin >= SIM_GPIO_PINS)
+        return;
+    
+    pthread_mutex_lock(&this->mutex);
+    bool before = (gpio_input(pin) != 0);
+    gpio_simulate_input(pin, value);
+    if(before != value)
+        this->edge(pin, value);
+    pthread_mutex_unlock(&this->mutex);
+}
+
+bool Simulator::GetGpio(uint32_t pin)
+{
+    if(pin >= SIM_GPIO_PINS)
+        return false;
+    return (gpio_input(pin) != 0);
+}
+
+int Simulator::Listen(uint32_t pin, uint32_t edges)
+{
+    Listener l;
+    l.pin = pin;
+    l.edges = edges;
+    l.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(l.fd < 0)
+        return -1;
+    memset(&l.stats, 0, sizeof(l.stats));
+    
+    pthread_mutex_lock(&this->mutex);
+    this->listeners.push_back(l);
+    pthread_mutex_unlock(&this->mutex);
+    return l.fd;
+}
+
+void Simulator::Unlisten(int fd)
+{
+    pthread_mutex_lock(&this->mutex);
+    for(std::vector<Listener>::iterator it = this->listeners.begin(); it != this->listeners.end(); ++it)
+    {
+        if(it->fd == fd)
+        {
+            this->listeners.erase(it);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    close(fd);
+}
+
+void Simulator::Acknowledge(int fd, uint64_t pending)
+{
+    pthread_mutex_lock(&this->mutex);
+    for(std::vector<Listener>::iterator it = this->listeners.begin(); it != this->listeners.end(); ++it)
+    {
+        if(it->fd == fd)
+        {
+            it->stats.wakeups++;
+            if(pending > it->stats.maxPending)
+                it->stats.maxPending = pending;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+Simulator::ListenerStats Simulator::GetListenerStats(uint32_t pin)
+{
+    ListenerStats total;
+    memset(&total, 0, sizeof(total));
+    
+    pthread_mutex_lock(&this->mutex);
+    for(std::vector<Listener>::iterator it = this->listeners.begin(); it != this->listeners.end(); ++it)
+    {
+        if(it->pin == pin)
+        {
+            total.edges += it->stats.edges;
+            total.wakeups += it->stats.wakeups;
+            total.maxPending = std::max(total.maxPending, it->stats.maxPending);
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    return total;
+}
+
+void Simulator::ResetListenerStats()
+{
+    pthread_mutex_lock(&this->mutex);
+    for(std::vector<Listener>::iterator it = this->listeners.begin(); it != this->listeners.end(); ++it)
+    {
+        memset(&it->stats, 0, sizeof(it->stats));
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+bool Simulator::SetExpanderInput(uint8_t address, uint8_t pin, bool value)
+{
+    bool found = false;
+    pthread_mutex_lock(&this->mutex);
+    std::map<uint8_t, SimDevice*>::iterator it = this->devices.find(address);
+    if(it != this->devices.end())
+    {
+        Mcp23017Model * mcp = dynamic_cast<Mcp23017Model*>(it->second);
+        if(mcp != NULL)
+        {
+            mcp->SetInput(pin, value);
+            found = true;
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    return found;
+}
+
+void Simulator::Record(const std::string &channel, uint32_t value)
+{
+    Transition t;
+    t.time = now_us();
+    t.value = value;
+    
+    pthread_mutex_lock(&this->mutex);
+    std::deque<Transition> &w = this->waveforms[channel];
+    w.push_back(t);
+    if(w.size() > SIMULATOR_WAVEFORM_LEN)
+        w.pop_front();
+    pthread_mutex_unlock(&this->mutex);
+}
+
+std::vector<std::string> Simulator::Channels()
+{
+    std::vector<std::string> channels;
+    pthread_mutex_lock(&this->mutex);
+    for(std::map<std::string, std::deque<Transition> >::iterator it = this->waveforms.begin(); it != this->waveforms.end(); ++it)
+    {
+        channels.push_back(it->first);
+    }
+    pthread_mutex_unlock(&this->mutex);
+    return channels;
+}
+
+std::vector<Simulator::Transition> Simulator::Waveform(const std::string &channel)
+{
+    std::vector<Transition> waveform;
+    pthread_mutex_lock(&this->mutex);
+    std::map<std::string, std::deque<Transition> >::iterator it = this->waveforms.find(channel);
+    if(it != this->waveforms.end())
+        waveform.assign(it->second.begin(), it->second.end());
+    pthread_mutex_unlock(&this->mutex);
+    return waveform;
+}
+
+void Simulator::ClearWaveforms()
+{
+    pthread_mutex_lock(&this->mutex);
+    this->waveforms.clear();
+    pthread_mutex_unlock(&this->mutex);
+}
+
+// Wake the listeners of a pin that changed level. Called with the mutex held
+void Simulator::edge(uint32_t pin, bool value)
+{
+    static const uint64_t one = 1;
+    uint32_t edge = value ? 1 : 2;     // kEdgeRising, kEdgeFalling
+    
+    char channel[16];
+    snprintf(channel, sizeof(channel), "gpio.%u", pin);
+    this->Record(channel, value);
+    
+    for(std::vector<Listener>::iterator it = this->listeners.begin(); it != this->listeners.end(); ++it)
+    {
+        if(it->pin == pin && (it->edges & edge))
+        {
+            it->stats.edges++;
+            if(write(it->fd, &one, sizeof(one)) != sizeof(one))
+                clog << kLogWarning << "Simulator: could not wake listener of gpio " << pin << endl;
+        }
+    }
+}
+
+void Simulator::gpioOutput(int bank, uint32_t changed, uint32_t levels)
+{
+    // Called from c_gpio after outputs were written, the level is already updated
+    for(int i = 0; i < 32; i++)
+    {
+        if(changed & (1 << i))
+        {
+            char channel[16];
+            snprintf(channel, sizeof(channel), "gpio.%d", bank*32 + i);
+            Instance().Record(channel, (levels >> i) & 0x01);
+        }
+    }
+}
+
+int Simulator::i2cOpen(unsigned char address)
+{
+    Simulator &sim = Instance();
+    int fd = -2;     // No device answers on this address
+    pthread_mutex_lock(&sim.mutex);
+    if(sim.devices.find(address) != sim.devices.end())
+        fd = address + SIM_FD_BASE;
+    pthread_mutex_unlock(&sim.mutex);
+    return fd;
+}
+
+void Simulator::i2cClose(int fd)
+{
+    // The device models live as long as the simulator
+}
+
+int Simulator::i2cRead(int fd, unsigned char reg, unsigned char *buf, int len)
+{
+    Simulator &sim = Instance();
+    int result = -1;
+    pthread_mutex_lock(&sim.mutex);
+    std::map<uint8_t, SimDevice*>::iterator it = sim.devices.find(fd - SIM_FD_BASE);
+    if(it != sim.devices.end())
+    {
+        for(int i = 0; i < len; i++)
+        {
+            buf[i] = it->second->Read(reg);
+            reg = it->second->Next(reg);
+        }
+        result = 0;
+    }
+    pthread_mutex_unlock(&sim.mutex);
+    return result;
+}
+
+int Simulator::i2cWrite(int fd, unsigned char reg, const unsigned char *buf, int len)
+{
+    Simulator &sim = Instance();
+    int result = -1;
+    pthread_mutex_lock(&sim.mutex);
+    std::map<uint8_t, SimDevice*>::iterator it = sim.devices.find(fd - SIM_FD_BASE);
+    if(it != sim.devices.end())
+    {
+        for(int i = 0; i < len; i++)
+        {
+            it->second->Write(reg, buf[i]);
+            reg = it->second->Next(reg);
+        }
+        result = 0;
+    }
+    pthread_mutex_unlock(&sim.mutex);
+    return result;
+}
@@ -0,0 +1,108 @@
+#ifndef __SIMULATOR_HPP
+#define __SIMULATOR_HPP
+
+#include <stdint.h>
+#include <pthread.h>
+#include <libconfig.h++>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+#define SIMULATOR_WAVEFORM_LEN  65536   // Transitions kept per channel
+
+// Model of an i2c device, addressed by register
+class SimDevice
+{
+public:
+    virtual ~SimDevice() {}
+    virtual uint8_t Read(uint8_t reg) = 0;
+    virtual void Write(uint8_t reg, uint8_t value) = 0;
+    //! Register the address pointer moves to after an access to reg
+    virtual uint8_t Next(uint8_t reg) { return reg + 1; }
+};
+
+// Simulated hardware, so the server runs on any Linux box. Replaces the mapped gpio registers by a block of
+// memory, the sysfs interrupt files by events from the simulator, and the i2c bus by device models.
+// Inputs are driven with SetGpio and SetExpanderInput. All level changes of pins and of the outputs of 
+// the device models are recorded with a timestamp, and can be read back per channel as a waveform.
+class Simulator
+{
+public:
+    struct Transition
+    {
+        uint64_t time;          // us, CLOCK_MONOTONIC
+        uint32_t value;
+    };
+    
+    // How the edges of a pin queued up at its listeners
+    struct ListenerStats
+    {
+        uint64_t edges;         // Edges signalled to the listeners
+        uint64_t wakeups;       // Times a listener took its pending edges
+        uint64_t maxPending;    // Most edges a listener took at once
+    };
+    
+    static Simulator & Instance();
+    //! True once Enable was called
+    static bool Enabled();
+    
+    //! Switch the gpio and i2c layers to the simulation. Returns false if that failed
+    bool Enable();
+    //! Create device models for the io groups in a configuration, and wire their interrupt outputs to the
+    //! gpio pins the groups listen on
+    void Configure(libconfig::Config &config);
+    //! Add a device model on an i2c address. The simulator owns it from then on
+    void AddDevice(uint8_t address, SimDevice *device);
+    
+    //! Drive a gpio pin from outside, waking the listeners if it changed
+    void SetGpio(uint32_t pin, bool value);
+    bool GetGpio(uint32_t pin);
+    //! Get an eventfd that is signalled on the given edges (GpioEdge) of a pin
+    int Listen(uint32_t pin, uint32_t edges);
+    void Unlisten(int fd);
+    //! Report that a listener took the given number of pending edges from its eventfd
+    void Acknowledge(int fd, uint64_t pending);
+    //! Queueing of the edges of a pin since the last ResetListenerStats, over all its current listeners
+    ListenerStats GetListenerStats(uint32_t pin);
+    void ResetListenerStats();
+    
+    //! Drive an input pin of a simulated MCP23017. Returns false if there is no such expander
+    bool SetExpanderInput(uint8_t address, uint8_t pin, bool value);
+    
+    //! Record a new value of an output channel, e.g. "gpio.17"
+    void Record(const std::string &channel, uint32_t value);
+    std::vector<std::string> Channels();
+    std::vector<Transition> Waveform(const std::string &channel);
+    void ClearWaveforms();
+    
+    static uint64_t now_us();
+    
+private:
+    struct Listener
+    {
+        uint32_t pin;
+        uint32_t edges;
+        int fd;
+        ListenerStats stats;
+    };
+    
+    Simulator();
+    
+    static volatile bool enabled;
+    pthread_mutex_t mutex;      // Recursive, device models drive pins while being accessed
+    std::map<uint8_t, SimDevice*> devices;
+    std::vector<Listener> listeners;
+    std::map<std::string, std::deque<Transition> > waveforms;
+    
+    // i2c layer hooks. The file descriptor of a device is its address plus SIM_FD_BASE
+    static int i2cOpen(unsigned char address);
+    static void i2cClose(int fd);
+    static int i2cRead(int fd, unsigned char reg, unsigned char *buf, int len);
+    static int i2cWrite(int fd, unsigned char reg, const unsigned char *buf, int len);
+    static void gpioOutput(int bank, uint32_t changed, uint32_t levels);
+    
+    void edge(uint32_t pin, bool value);
+};
+
+#endif//__SIMULATOR_HPP
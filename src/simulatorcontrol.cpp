@@ -0,0 +1,53 @@
+#include "simulatorcontrol.hpp"
+
+static const std::string SIMULATOR_DBUS_PATH = "/nl/miqra/PiIo/Simulator";
+
+SimulatorControl::SimulatorControl(DBus::Connection &connection)
+  : DBus::ObjectAdaptor(connection, SIMULATOR_DBUS_PATH)
+{
+}
+
+void SimulatorControl::SetGpio(const uint32_t& pin, const bool& value)
+{
+    if(pin >= 64)
+        throw DBus::ErrorInvalidArgs("No such gpio pin");
+    Simulator::Instance().SetGpio(pin, value);
+}
+
+bool SimulatorControl::GetGpio(const uint32_t& pin)
+{
+    if(pin >= 64)
+        throw DBus::ErrorInvalidArgs("No such gpio pin");
+    return Simulator::Instance().GetGpio(pin);
+}
+
+void SimulatorControl::SetExpanderInput(const uint8_t& address, const uint8_t& pin, const bool& value)
+{
+    if(pin > 15)
+        throw DBus::ErrorInvalidArgs("Pin must be 0...15");
+    if(!Simulator::Instance().SetExpanderInput(address, pin, value))
+        throw DBus::ErrorInvalidArgs("No simulated MCP23017 on this address");
+}
+
+std::vector< std::string > SimulatorControl::Channels()
+{
+    return Simulator::Instance().Channels();
+}
+
+std::vector< ::DBus::Struct< uint64_t, uint32_t > > SimulatorControl::Waveform(const std::string& channel)
+{
+    std::vector<Simulator::Transition> waveform = Simulator::Instance().Waveform(channel);
+    std::vector< ::DBus::Struct< uint64_t, uint32_t > > result(waveform.size());
+    
+    for(size_t i = 0; i < waveform.size(); i++)
+    {
+        result[i]._1 = waveform[i].time;
+        result[i]._2 = waveform[i].value;
+    }
+    return result;
+}
+
+void SimulatorControl::ClearWaveforms()
+{
+    Simulator::Instance().ClearWaveforms();
+}
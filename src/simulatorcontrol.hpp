@@ -0,0 +1,27 @@
+#ifndef __SIMULATORCONTROL_HPP
+#define __SIMULATORCONTROL_HPP
+
+#include <stdint.h>
+#include <dbus-c++/dbus.h>
+#include "pi-io-server-glue.hpp"
+#include "simulator/simulator.hpp"
+
+// D-Bus control of the simulated hardware, to drive inputs and read back the output waveforms
+class SimulatorControl
+  : public nl::miqra::PiIo::Simulator_adaptor,
+  public DBus::IntrospectableAdaptor,
+  public DBus::ObjectAdaptor
+{
+public:
+    SimulatorControl(DBus::Connection &connection);
+    
+    virtual void SetGpio(const uint32_t& pin, const bool& value);
+    virtual bool GetGpio(const uint32_t& pin);
+    virtual void SetExpanderInput(const uint8_t& address, const uint8_t& pin, const bool& value);
+    virtual std::vector< std::string > Channels();
+    // Transitions of a channel as (time in us on CLOCK_MONOTONIC, value)
+    virtual std::vector< ::DBus::Struct< uint64_t, uint32_t > > Waveform(const std::string& channel);
+    virtual void ClearWaveforms();
+};
+
+#endif//__SIMULATORCONTROL_HPP
@@ -0,0 +1,194 @@
+/*
+ * Layout of the PiIo shared memory state page, and a header-only reader for it.
+ *
+ * The server publishes the current value of every IO in every group into a shared memory
+ * segment (by default /dev/shm/piio-state). The segment starts with a header, followed by a
+ * table of fixed size entries at PIIO_STATE_TABLE_OFFSET. Entries keep their index for the
+ * lifetime of the page, so a reader can look up an IO once and read it by index from then on.
+ * When the server reloads its configuration, it publishes a new page under the same name and
+ * marks the old one invalid. Readers should check piio_state_valid now and then, and reopen
+ * the page when it returns 0.
+ *
+ * Writers update the page under a seqlock: the sequence number is odd while an update is in
+ * progress. The generation counter is incremented on every change, and each entry records
+ * the generation in which it last changed, so readers can cheaply check for changes.
+ *
+ * Usage:
+ *      piio_state state;
+ *      if(piio_state_open(&state, PIIO_STATE_NAME) == 0)
+ *      {
+ *          int idx = piio_state_find(&state, "GPIO.btn");
+ *          double value;
+ *          piio_state_read(&state, idx, &value);
+ *          piio_state_close(&state);
+ *      }
+ *
+ * Only piio_state_open and piio_state_close make system calls.
+ */
+#ifndef __PIIO_STATE_H
+#define __PIIO_STATE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PIIO_STATE_NAME         "/piio-state"
+#define PIIO_STATE_MAGIC        0x4F495050      /* "PPIO" */
+#define PIIO_STATE_VERSION      1
+#define PIIO_STATE_NAME_LEN     48              /* maximum length of "group.handle", including terminating null */
+#define PIIO_STATE_TABLE_OFFSET 64              /* offset of the entry table from the start of the page */
+
+/* IO types of an entry */
+#define PIIO_STATE_BUTTON       1
+#define PIIO_STATE_INPUT        2
+#define PIIO_STATE_OUTPUT       3
+#define PIIO_STATE_MBINPUT      4
+#define PIIO_STATE_MBOUTPUT     5
+#define PIIO_STATE_PWM          6   /* pwm on a digital group, value 0-255 */
+#define PIIO_STATE_PWMVALUE     7   /* value of a pwm group */
+
+struct piio_state_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_size;            /* sizeof(struct piio_state_entry) */
+    uint32_t entry_count;
+    volatile uint32_t sequence;     /* seqlock, odd while the page is being updated */
+    uint32_t reserved;
+    volatile uint64_t generation;   /* incremented on every change */
+};
+
+struct piio_state_entry
+{
+    char name[PIIO_STATE_NAME_LEN]; /* "group.handle" */
+    uint32_t type;                  /* PIIO_STATE_* */
+    uint32_t reserved;
+    double value;                   /* current value, booleans are 0 or 1 */
+    uint64_t generation;            /* generation in which the value last changed */
+};
+
+typedef struct
+{
+    void * base;
+    size_t size;
+    const struct piio_state_header * header;
+    const struct piio_state_entry * entries;
+} piio_state;
+
+/* Open and map the state page. Returns 0 on success, -1 on failure */
+static inline int piio_state_open(piio_state * state, const char * name)
+{
+    struct stat st;
+    const struct piio_state_header * header;
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    if(fd < 0)
+        return -1;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < PIIO_STATE_TABLE_OFFSET)
+    {
+        close(fd);
+        return -1;
+    }
+
+    state->size = st.st_size;
+    state->base = mmap(NULL, state->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(state->base == MAP_FAILED)
+        return -1;
+
+    header = (const struct piio_state_header *)state->base;
+    if(header->magic != PIIO_STATE_MAGIC || header->version != PIIO_STATE_VERSION ||
+       header->entry_size != sizeof(struct piio_state_entry) ||
+       PIIO_STATE_TABLE_OFFSET + (size_t)header->entry_count * sizeof(struct piio_state_entry) > state->size)
+    {
+        munmap(state->base, state->size);
+        return -1;
+    }
+
+    state->header = header;
+    state->entries = (const struct piio_state_entry *)((const char *)state->base + PIIO_STATE_TABLE_OFFSET);
+    return 0;
+}
+
+static inline void piio_state_close(piio_state * state)
+{
+    munmap(state->base, state->size);
+    state->base = NULL;
+    state->header = NULL;
+    state->entries = NULL;
+}
+
+/* Current generation of the page. If it has not changed since the last read, nothing has changed */
+static inline uint64_t piio_state_generation(const piio_state * state)
+{
+    uint32_t seq;
+    uint64_t generation;
+    do
+    {
+        seq = state->header->sequence;
+        __sync_synchronize();
+        generation = state->header->generation;
+        __sync_synchronize();
+    }
+    while((seq & 1) || seq != state->header->sequence);
+    return generation;
+}
+
+/* Returns 0 if the page has been replaced by a new one, and should be reopened */
+static inline int piio_state_valid(const piio_state * state)
+{
+    return state->header->magic == PIIO_STATE_MAGIC;
+}
+
+/* Find the index of an IO by "group.handle". Returns -1 if not found */
+static inline int piio_state_find(const piio_state * state, const char * name)
+{
+    uint32_t i;
+    for(i = 0; i < state->header->entry_count; i++)
+    {
+        if(strncmp(state->entries[i].name, name, PIIO_STATE_NAME_LEN) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+/* Read the value of one entry consistently. Returns the generation in which it last changed */
+static inline uint64_t piio_state_read(const piio_state * state, int index, double * value)
+{
+    uint32_t seq;
+    uint64_t generation;
+    do
+    {
+        seq = state->header->sequence;
+        __sync_synchronize();
+        *value = state->entries[index].value;
+        generation = state->entries[index].generation;
+        __sync_synchronize();
+    }
+    while((seq & 1) || seq != state->header->sequence);
+    return generation;
+}
+
+/* Copy a consistent snapshot of up to count entries. Returns the generation of the snapshot */
+static inline uint64_t piio_state_snapshot(const piio_state * state, struct piio_state_entry * entries, uint32_t count)
+{
+    uint32_t seq;
+    uint64_t generation;
+    if(count > state->header->entry_count)
+        count = state->header->entry_count;
+    do
+    {
+        seq = state->header->sequence;
+        __sync_synchronize();
+        memcpy(entries, (const void *)state->entries, count * sizeof(struct piio_state_entry));
+        generation = state->header->generation;
+        __sync_synchronize();
+    }
+    while((seq & 1) || seq != state->header->sequence);
+    return generation;
+}
+
+#endif/*__PIIO_STATE_H*/
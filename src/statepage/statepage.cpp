@@ -0,0 +1,163 @@
+#include "statepage.hpp"
+#include "../log/log.hpp"
+#include "../thread/thread.hpp"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+StatePage::StatePage(const std::string &name)
+{
+    this->name = name;
+    this->header = NULL;
+    this->entries = NULL;
+    this->size = 0;
+    Thread::InitMutex(&this->mutex);
+}
+
+StatePage::~StatePage()
+{
+    if(this->header != NULL)
+    {
+        munmap(this->header, this->size);
+        shm_unlink(this->name.c_str());
+        this->header = NULL;
+        this->entries = NULL;
+    }
+    pthread_mutex_destroy(&this->mutex);
+}
+
+int32_t StatePage::Register(const std::string &longhandle, uint32_t type)
+{
+    struct piio_state_entry entry;
+    
+    if(this->header != NULL)
+    {
+        clog << kLogWarning << "State page: cannot register '" << longhandle << "' after the page was opened" << endl;
+        return -1;
+    }
+    if(longhandle.size() >= PIIO_STATE_NAME_LEN)
+    {
+        clog << kLogWarning << "State page: name '" << longhandle << "' is too long, not publishing it" << endl;
+        return -1;
+    }
+    
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.name, longhandle.c_str(), PIIO_STATE_NAME_LEN - 1);
+    entry.type = type;
+    
+    pthread_mutex_lock(&this->mutex);
+    this->pending.push_back(entry);
+    int32_t index = (int32_t)this->pending.size() - 1;
+    pthread_mutex_unlock(&this->mutex);
+    
+    return index;
+}
+
+bool StatePage::Open()
+{
+    int fd;
+    void * base;
+    size_t size = PIIO_STATE_TABLE_OFFSET + this->pending.size() * sizeof(struct piio_state_entry);
+    
+    // Remove any stale page from a previous run, so readers never map a page with a different layout
+    shm_unlink(this->name.c_str());
+    fd = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0)
+    {
+        clog << kLogError << "State page: could not create '" << this->name << "': " << strerror(errno) << endl;
+        return false;
+    }
+    
+    if(ftruncate(fd, size) != 0)
+    {
+        clog << kLogError << "State page: could not size '" << this->name << "': " << strerror(errno) << endl;
+        close(fd);
+        shm_unlink(this->name.c_str());
+        return false;
+    }
+    
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+    {
+        clog << kLogError << "State page: could not map '" << this->name << "': " << strerror(errno) << endl;
+        shm_unlink(this->name.c_str());
+        return false;
+    }
+    
+    pthread_mutex_lock(&this->mutex);
+    
+    this->size = size;
+    this->entries = (struct piio_state_entry *)((char *)base + PIIO_STATE_TABLE_OFFSET);
+    if(this->pending.size() > 0)
+    {
+        memcpy(this->entries, &(this->pending[0]), this->pending.size() * sizeof(struct piio_state_entry));
+    }
+    
+    struct piio_state_header * header = (struct piio_state_header *)base;
+    header->entry_size = sizeof(struct piio_state_entry);
+    header->entry_count = this->pending.size();
+    header->sequence = 0;
+    header->generation = 0;
+    header->version = PIIO_STATE_VERSION;
+    __sync_synchronize();
+    // Magic last, a reader that sees it sees a complete header
+    header->magic = PIIO_STATE_MAGIC;
+    this->header = header;
+    
+    pthread_mutex_unlock(&this->mutex);
+    
+    clog << kLogInfo << "State page: publishing " << this->pending.size() << " IOs in '" << this->name << "'" << endl;
+    return true;
+}
+
+void StatePage::Retire()
+{
+    pthread_mutex_lock(&this->mutex);
+    
+    if(this->header != NULL)
+    {
+        this->header->magic = 0;
+        __sync_synchronize();
+        munmap(this->header, this->size);
+        this->header = NULL;
+        this->entries = NULL;
+    }
+    // Without a header, the destructor leaves the name (which now belongs to the new page) alone
+    this->pending.clear();
+    
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void StatePage::Update(int32_t index, double value)
+{
+    if(index < 0)
+        return;
+    
+    pthread_mutex_lock(&this->mutex);
+    
+    if(this->header == NULL)
+    {
+        // Not opened yet, keep the value for when it is
+        if((uint32_t)index < this->pending.size())
+            this->pending[index].value = value;
+    }
+    else if((uint32_t)index < this->header->entry_count && this->entries[index].value != value)
+    {
+        this->header->sequence++;
+        __sync_synchronize();
+        
+        this->header->generation++;
+        this->entries[index].value = value;
+        this->entries[index].generation = this->header->generation;
+        
+        __sync_synchronize();
+        this->header->sequence++;
+    }
+    
+    pthread_mutex_unlock(&this->mutex);
+}
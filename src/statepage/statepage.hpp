@@ -0,0 +1,40 @@
+#ifndef __STATEPAGE_HPP
+#define __STATEPAGE_HPP
+
+#include "piio-state.h"
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// Writer side of the shared memory state page (see piio-state.h for the layout)
+// IOs are registered first, then the page is opened with room for exactly the registered IOs.
+// Updates before Open are kept, and written to the page when it is opened.
+class StatePage
+{
+public:
+    StatePage(const std::string &name);
+    ~StatePage();
+
+    //! Register an IO, returns the index to use for updates
+    int32_t Register(const std::string &longhandle, uint32_t type);
+    //! Create and map the shared memory segment. Returns false on failure
+    bool Open();
+    //! Name of the shared memory segment
+    std::string Name() { return this->name; }
+    //! Update the value of an IO
+    void Update(int32_t index, double value);
+    //! Mark the page invalid for readers and unmap it, when a new page with the same name replaces it.
+    //! Updates are ignored from then on, so groups still holding the page can safely use it.
+    void Retire();
+
+private:
+    std::string name;
+    std::vector<struct piio_state_entry> pending;   // Entries registered before Open
+    struct piio_state_header * header;
+    struct piio_state_entry * entries;
+    size_t size;
+    pthread_mutex_t mutex;
+};
+
+#endif//__STATEPAGE_HPP
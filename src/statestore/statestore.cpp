@@ -0,0 +1,241 @@
+#include "statestore.hpp"
+#include "../log/log.hpp"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+StateStore::StateStore(const std::string &path, uint32_t syncInterval_ms)
+{
+    this->path = path;
+    this->syncInterval = (syncInterval_ms > 0) ? syncInterval_ms : 1;    // 0 would keep the sync thread spinning
+    this->fd = -1;
+    this->base = NULL;
+    this->size = 0;
+    this->capacity = 0;
+    this->dirty = false;
+    this->syncing = false;
+    Thread::InitMutex(&this->mutex);
+    pthread_cond_init(&this->syncDone, NULL);
+}
+
+StateStore::~StateStore()
+{
+    if(ThreadRunning())
+    {
+        ThreadStop();
+    }
+
+    if(this->base != NULL)
+    {
+        sync();
+        munmap(this->base, this->size);
+        this->base = NULL;
+    }
+    if(this->fd >= 0)
+    {
+        close(this->fd);
+        this->fd = -1;
+    }
+    pthread_cond_destroy(&this->syncDone);
+    pthread_mutex_destroy(&this->mutex);
+}
+
+bool StateStore::Open()
+{
+    struct stat st;
+    
+    this->fd = open(this->path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(this->fd < 0 || fstat(this->fd, &st) != 0)
+    {
+        clog << kLogError << "State store: could not open '" << this->path << "': " << strerror(errno) << endl;
+        return false;
+    }
+    
+    // Check what is in the file, and start over if it is not a store we can read
+    uint32_t count = 0;
+    if(st.st_size >= (off_t)sizeof(Header))
+    {
+        Header h;
+        if(pread(this->fd, &h, sizeof(h), 0) == sizeof(h) && h.magic == STATESTORE_MAGIC && h.version == STATESTORE_VERSION 
+           && h.record_size == sizeof(Record) && st.st_size >= (off_t)(sizeof(Header) + h.count * sizeof(Record)))
+        {
+            count = h.count;
+        }
+        else
+        {
+            clog << kLogWarning << "State store: '" << this->path << "' is not a valid state file, starting with an empty one" << endl;
+        }
+    }
+    
+    pthread_mutex_lock(&this->mutex);
+    bool ok = mapFile(count > 32 ? count * 2 : 64);
+    if(ok)
+    {
+        Header * h = header();
+        h->magic = STATESTORE_MAGIC;
+        h->version = STATESTORE_VERSION;
+        h->record_size = sizeof(Record);
+        h->count = count;
+        
+        for(uint32_t i = 0; i < count; i++)
+        {
+            Record * r = &(records()[i]);
+            r->name[STATESTORE_NAME_LEN - 1] = 0;
+            this->slots[r->name] = i;
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    
+    if(!ok)
+        return false;
+    
+    clog << kLogInfo << "State store: " << count << " saved values in '" << this->path << "'" << endl;
+    ThreadStart();
+    return true;
+}
+
+int32_t StateStore::Register(const std::string &longhandle, uint32_t type, double &value, bool &restored)
+{
+    int32_t slot = -1;
+    restored = false;
+    
+    if(longhandle.size() >= STATESTORE_NAME_LEN)
+    {
+        clog << kLogWarning << "State store: name '" << longhandle << "' is too long, not saving it" << endl;
+        return -1;
+    }
+    
+    pthread_mutex_lock(&this->mutex);
+    if(this->base != NULL)
+    {
+        std::map<std::string, int32_t>::iterator it = this->slots.find(longhandle);
+        if(it != this->slots.end())
+        {
+            slot = it->second;
+            Record * r = &(records()[slot]);
+            if(r->type == type)
+            {
+                value = r->value;
+                restored = true;
+            }
+            else
+            {
+                // The IO changed type, the saved value means nothing anymore
+                r->type = type;
+                r->value = value;
+                this->dirty = true;
+            }
+        }
+        else if(header()->count < this->capacity || mapFile(this->capacity * 2))
+        {
+            slot = header()->count;
+            Record * r = &(records()[slot]);
+            memset(r, 0, sizeof(Record));
+            strncpy(r->name, longhandle.c_str(), STATESTORE_NAME_LEN - 1);
+            r->type = type;
+            r->value = value;
+            __sync_synchronize();
+            header()->count++;
+            this->slots[longhandle] = slot;
+            this->dirty = true;
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    
+    return slot;
+}
+
+void StateStore::Update(int32_t slot, double value)
+{
+    if(slot < 0)
+        return;
+    
+    pthread_mutex_lock(&this->mutex);
+    if(this->base != NULL && (uint32_t)slot < header()->count && records()[slot].value != value)
+    {
+        records()[slot].value = value;
+        this->dirty = true;
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void StateStore::ThreadFunc(void)
+{
+    ApplyProfile("statestore");
+    Thread::ThreadFunc();
+}
+
+void StateStore::ThreadLoop(void)
+{
+    // The final sync on a stop is done by the destructor
+    if(ThreadSleep(this->syncInterval * 1000))
+    {
+        sync();
+    }
+}
+
+// Flush the mapping to disk if anything changed since the last time
+void StateStore::sync()
+{
+    pthread_mutex_lock(&this->mutex);
+    if(!this->dirty || this->base == NULL)
+    {
+        pthread_mutex_unlock(&this->mutex);
+        return;
+    }
+    this->dirty = false;
+    this->syncing = true;
+    void * base = this->base;
+    size_t size = this->size;
+    pthread_mutex_unlock(&this->mutex);
+    
+    // Without the mutex, so updates don't have to wait for the disk
+    if(msync(base, size, MS_SYNC) != 0)
+    {
+        clog << kLogWarning << "State store: could not sync '" << this->path << "': " << strerror(errno) << endl;
+    }
+    
+    pthread_mutex_lock(&this->mutex);
+    this->syncing = false;
+    pthread_cond_broadcast(&this->syncDone);
+    pthread_mutex_unlock(&this->mutex);
+}
+
+bool StateStore::mapFile(uint32_t capacity)
+{
+    size_t size = sizeof(Header) + capacity * sizeof(Record);
+    
+    // The mapping may move, wait for a sync using the old one to finish
+    while(this->syncing)
+    {
+        pthread_cond_wait(&this->syncDone, &this->mutex);
+    }
+    
+    if(ftruncate(this->fd, size) != 0)
+    {
+        clog << kLogError << "State store: could not size '" << this->path << "': " << strerror(errno) << endl;
+        return false;
+    }
+    
+    void * base;
+    if(this->base == NULL)
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+    else
+        base = mremap(this->base, this->size, size, MREMAP_MAYMOVE);
+    
+    if(base == MAP_FAILED)
+    {
+        clog << kLogError << "State store: could not map '" << this->path << "': " << strerror(errno) << endl;
+        return false;
+    }
+    
+    this->base = base;
+    this->size = size;
+    this->capacity = capacity;
+    return true;
+}
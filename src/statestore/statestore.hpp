@@ -0,0 +1,73 @@
+#ifndef __STATESTORE_HPP
+#define __STATESTORE_HPP
+
+#include "../thread/thread.hpp"
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <map>
+
+#define STATESTORE_MAGIC        0x54534950      // "PIST"
+#define STATESTORE_VERSION      1
+#define STATESTORE_NAME_LEN     48
+
+// Keeps the values of outputs in a small memory mapped file, so they can be restored after a restart.
+// Values are written to the mapping on every change, and flushed to disk by a background thread
+// at most once per sync interval, so a burst of changes costs a single msync.
+class StateStore : protected Thread
+{
+public:
+    StateStore(const std::string &path, uint32_t syncInterval_ms);
+    ~StateStore();
+
+    //! Map the file and read the saved values. Returns false if the store can't be used
+    bool Open();
+
+    //! Get a slot to save the value of an IO in. If a value of the same type was saved for it,
+    //! sets value to it and restored to true. Returns -1 on failure
+    int32_t Register(const std::string &longhandle, uint32_t type, double &value, bool &restored);
+    //! Save a new value
+    void Update(int32_t slot, double value);
+
+protected:
+    virtual void ThreadFunc(void);
+    virtual void ThreadLoop(void);
+
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t record_size;
+        uint32_t count;
+    };
+
+    struct Record
+    {
+        char name[STATESTORE_NAME_LEN];
+        uint32_t type;
+        uint32_t reserved;
+        double value;
+    };
+
+    std::string path;
+    uint32_t syncInterval;
+    int fd;
+    void * base;
+    size_t size;
+    uint32_t capacity;
+    std::map<std::string, int32_t> slots;
+
+    bool dirty;
+    bool syncing;
+    pthread_mutex_t mutex;
+    pthread_cond_t syncDone;
+
+    Header * header() { return (Header *)this->base; }
+    Record * records() { return (Record *)((char *)this->base + sizeof(Header)); }
+    // (Re)map the file with room for capacity records. Call with the mutex held
+    bool mapFile(uint32_t capacity);
+    void sync();
+};
+
+#endif//__STATESTORE_HPP
@@ -0,0 +1,71 @@
+#include "metricsfile.hpp"
+#include "stats.hpp"
+#include "../log/log.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fstream>
+
+using namespace std;
+
+MetricsFile::MetricsFile(const std::string &path, uint32_t interval_ms)
+{
+    this->path = path;
+    this->interval = (interval_ms > 0) ? interval_ms : 1;
+}
+
+MetricsFile::~MetricsFile()
+{
+    if(ThreadRunning())
+    {
+        ThreadStop();
+    }
+    // Stale metrics would look like a server that is still running
+    unlink(this->path.c_str());
+}
+
+void MetricsFile::Start()
+{
+    clog << kLogInfo << "Writing metrics to '" << this->path << "' every " << this->interval << " ms" << endl;
+    ThreadStart();
+}
+
+void MetricsFile::ThreadFunc(void)
+{
+    ApplyProfile("metrics");
+    write();
+    Thread::ThreadFunc();
+}
+
+void MetricsFile::ThreadLoop(void)
+{
+    if(ThreadSleep(this->interval * 1000))
+    {
+        write();
+    }
+}
+
+void MetricsFile::write()
+{
+    std::string tmp = this->path + ".tmp";
+    std::string text = Stats::Instance().Prometheus();
+    
+    {
+        std::ofstream out(tmp.c_str(), std::ios::out | std::ios::trunc);
+        out << text;
+        out.close();
+        if(out.fail())
+        {
+            clog << kLogWarning << "Metrics: could not write '" << tmp << "'" << endl;
+            return;
+        }
+    }
+    
+    if(rename(tmp.c_str(), this->path.c_str()) != 0)
+    {
+        clog << kLogWarning << "Metrics: could not replace '" << this->path << "': " << strerror(errno) << endl;
+        unlink(tmp.c_str());
+    }
+}
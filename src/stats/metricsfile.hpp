@@ -0,0 +1,30 @@
+#ifndef __METRICSFILE_HPP
+#define __METRICSFILE_HPP
+
+#include "../thread/thread.hpp"
+#include <stdint.h>
+#include <string>
+
+// Periodically writes all metrics in the Prometheus text format to a file, e.g. in /run, for the 
+// textfile collector of a local node exporter. The file is replaced atomically, so a scrape never 
+// sees a partial file, and removed when the server stops.
+class MetricsFile : protected Thread
+{
+public:
+    MetricsFile(const std::string &path, uint32_t interval_ms);
+    ~MetricsFile();
+    
+    void Start();
+    
+protected:
+    virtual void ThreadFunc(void);
+    virtual void ThreadLoop(void);
+    
+private:
+    std::string path;
+    uint32_t interval;
+    
+    void write();
+};
+
+#endif//__METRICSFILE_HPP
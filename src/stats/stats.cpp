@@ -0,0 +1,220 @@
+#include "stats.hpp"
+#include "../thread/thread.hpp"
+#include <set>
+#include <sstream>
+
+Histogram::Histogram()
+{
+    for(uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        this->buckets[i] = 0;
+        this->baseBuckets[i] = 0;
+    }
+    this->count = 0;
+    this->sum = 0;
+    this->max = 0;
+    this->baseCount = 0;
+    this->baseSum = 0;
+}
+
+Stats & Stats::Instance()
+{
+    static Stats instance;
+    return instance;
+}
+
+Stats::Stats()
+{
+    Thread::InitMutex(&this->mutex);
+}
+
+void Stats::Register(const std::string &name, Histogram *histogram)
+{
+    pthread_mutex_lock(&this->mutex);
+    this->histograms.insert(std::make_pair(name, histogram));
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void Stats::Unregister(Histogram *histogram)
+{
+    pthread_mutex_lock(&this->mutex);
+    for(std::multimap<std::string, Histogram*>::iterator it = this->histograms.begin(); it != this->histograms.end(); ++it)
+    {
+        if(it->second == histogram)
+        {
+            this->histograms.erase(it);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+std::vector<std::string> Stats::Names()
+{
+    std::set<std::string> names;
+    pthread_mutex_lock(&this->mutex);
+    for(std::multimap<std::string, Histogram*>::iterator it = this->histograms.begin(); it != this->histograms.end(); ++it)
+    {
+        names.insert(it->first);
+    }
+    pthread_mutex_unlock(&this->mutex);
+    return std::vector<std::string>(names.begin(), names.end());
+}
+
+bool Stats::Get(const std::string &name, Summary &summary)
+{
+    bool found = false;
+    
+    summary.count = 0;
+    summary.sum = 0;
+    summary.max = 0;
+    summary.buckets.assign(HISTOGRAM_BUCKETS, 0);
+    
+    pthread_mutex_lock(&this->mutex);
+    std::pair<std::multimap<std::string, Histogram*>::iterator, std::multimap<std::string, Histogram*>::iterator> range = this->histograms.equal_range(name);
+    for(std::multimap<std::string, Histogram*>::iterator it = range.first; it != range.second; ++it)
+    {
+        Histogram * h = it->second;
+        found = true;
+        summary.count += h->count - h->baseCount;
+        summary.sum += h->sum - h->baseSum;
+        if(h->max > summary.max)
+            summary.max = h->max;
+        for(uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            summary.buckets[i] += h->buckets[i] - h->baseBuckets[i];
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    
+    return found;
+}
+
+void Stats::Reset()
+{
+    pthread_mutex_lock(&this->mutex);
+    for(std::multimap<std::string, Histogram*>::iterator it = this->histograms.begin(); it != this->histograms.end(); ++it)
+    {
+        Histogram * h = it->second;
+        h->baseCount = h->count;
+        h->baseSum = h->sum;
+        // The maximum can't be kept relative, a sample racing with this only loses its maximum
+        h->max = 0;
+        for(uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            h->baseBuckets[i] = h->buckets[i];
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void Stats::Register(const std::string &name, const std::string &labels, Counter *counter)
+{
+    this->registerMetric(name, labels, false, &counter->value);
+}
+
+void Stats::Register(const std::string &name, const std::string &labels, Gauge *gauge)
+{
+    this->registerMetric(name, labels, true, &gauge->value);
+}
+
+void Stats::Register(const std::string &name, const std::string &labels, volatile uint64_t *counter)
+{
+    this->registerMetric(name, labels, false, counter);
+}
+
+void Stats::registerMetric(const std::string &name, const std::string &labels, bool gauge, volatile uint64_t *value)
+{
+    Metric m;
+    m.labels = labels;
+    m.gauge = gauge;
+    m.value = value;
+    
+    pthread_mutex_lock(&this->mutex);
+    this->metrics.insert(std::make_pair(name, m));
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void Stats::Unregister(volatile uint64_t *value)
+{
+    pthread_mutex_lock(&this->mutex);
+    for(std::multimap<std::string, Metric>::iterator it = this->metrics.begin(); it != this->metrics.end(); ++it)
+    {
+        if(it->second.value == value)
+        {
+            this->metrics.erase(it);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+std::string Stats::Prometheus()
+{
+    std::ostringstream out;
+    out.precision(12);
+    
+    pthread_mutex_lock(&this->mutex);
+    
+    std::multimap<std::string, Metric>::iterator it = this->metrics.begin();
+    while(it != this->metrics.end())
+    {
+        // Add up all metrics with the same name and labels
+        std::string name = it->first;
+        bool gauge = it->second.gauge;
+        std::map<std::string, uint64_t> series;
+        for(; it != this->metrics.end() && it->first == name; ++it)
+        {
+            series[it->second.labels] += __sync_fetch_and_add(it->second.value, 0);
+        }
+        
+        out << "# TYPE " << name << (gauge ? " gauge" : " counter") << "\n";
+        for(std::map<std::string, uint64_t>::iterator s = series.begin(); s != series.end(); ++s)
+        {
+            out << name;
+            if(!s->first.empty())
+                out << "{" << s->first << "}";
+            out << " " << s->second << "\n";
+        }
+    }
+    
+    // Histograms, in seconds as Prometheus prefers. Bucket boundaries are the powers of two in ns
+    std::multimap<std::string, Histogram*>::iterator h = this->histograms.begin();
+    while(h != this->histograms.end())
+    {
+        std::string name = h->first;
+        uint64_t buckets[HISTOGRAM_BUCKETS] = {0};
+        uint64_t count = 0, sum = 0;
+        for(; h != this->histograms.end() && h->first == name; ++h)
+        {
+            count += h->second->count - h->second->baseCount;
+            sum += h->second->sum - h->second->baseSum;
+            for(uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+            {
+                buckets[i] += h->second->buckets[i] - h->second->baseBuckets[i];
+            }
+        }
+        
+        std::string metric = "piio_" + name + "_seconds";
+        for(std::string::iterator c = metric.begin(); c != metric.end(); ++c)
+        {
+            if(*c == '.' || *c == '-')
+                *c = '_';
+        }
+        
+        out << "# TYPE " << metric << " histogram\n";
+        uint64_t cumulative = 0;
+        for(uint32_t i = 0; i < HISTOGRAM_BUCKETS - 1; i++)
+        {
+            cumulative += buckets[i];
+            out << metric << "_bucket{le=\"" << ((double)(1ULL << i) / 1e9) << "\"} " << cumulative << "\n";
+        }
+        out << metric << "_bucket{le=\"+Inf\"} " << count << "\n";
+        out << metric << "_sum " << ((double)sum / 1e9) << "\n";
+        out << metric << "_count " << count << "\n";
+    }
+    
+    pthread_mutex_unlock(&this->mutex);
+    
+    return out.str();
+}
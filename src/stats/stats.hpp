@@ -0,0 +1,149 @@
+#ifndef __STATS_HPP
+#define __STATS_HPP
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#define HISTOGRAM_BUCKETS   32      // Bucket n counts values from 2^(n-1) up to 2^n ns, the last one everything above
+
+// Histogram of durations in nanoseconds, in power of two buckets. Recording is a handful of plain
+// increments without locks, so it can stay enabled in realtime loops. Each histogram must only be 
+// recorded into by one thread. Reading it from another thread may be off by the sample being recorded.
+class Histogram
+{
+public:
+    Histogram();
+    
+    inline void Record(uint64_t ns)
+    {
+        uint32_t bucket = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+        if(bucket >= HISTOGRAM_BUCKETS)
+            bucket = HISTOGRAM_BUCKETS - 1;
+        this->buckets[bucket]++;
+        this->count++;
+        this->sum += ns;
+        if(ns > this->max)
+            this->max = (ns > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)ns;
+    }
+    
+    // Record the time since a timestamp taken with Now()
+    inline void RecordSince(uint64_t start)
+    {
+        uint64_t now = Now();
+        this->Record((now > start) ? now - start : 0);
+    }
+    
+    // Record how much later than expected_ns after a timestamp taken with Now() it is
+    inline void RecordLateness(uint64_t start, uint64_t expected_ns)
+    {
+        uint64_t now = Now();
+        this->Record((now > start + expected_ns) ? now - start - expected_ns : 0);
+    }
+    
+    // Monotonic time in nanoseconds
+    static inline uint64_t Now()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return ((uint64_t)now.tv_sec) * 1000000000ULL + now.tv_nsec;
+    }
+    
+private:
+    friend class Stats;
+    volatile uint32_t buckets[HISTOGRAM_BUCKETS];
+    volatile uint32_t count;
+    volatile uint64_t sum;
+    volatile uint32_t max;
+    
+    // Values at the last reset, subtracted when reading, so a reset never has to write to the counters
+    uint32_t baseBuckets[HISTOGRAM_BUCKETS];
+    uint32_t baseCount;
+    uint64_t baseSum;
+};
+
+// Monotonic count of events. Adding is a single atomic increment, without locks, so any thread can count
+class Counter
+{
+public:
+    Counter() : value(0) {}
+    
+    inline void Add(uint64_t n = 1) { __sync_fetch_and_add(&this->value, n); }
+    uint64_t Value() { return __sync_fetch_and_add(&this->value, 0); }
+    
+private:
+    friend class Stats;
+    volatile uint64_t value;
+};
+
+// Value that can go up and down, like a number of clients
+class Gauge
+{
+public:
+    Gauge() : value(0) {}
+    
+    inline void Set(uint64_t v) { __sync_lock_test_and_set(&this->value, v); }
+    uint64_t Value() { return __sync_fetch_and_add(&this->value, 0); }
+    
+private:
+    friend class Stats;
+    volatile uint64_t value;
+};
+
+// Process wide registry of histograms. Histograms registered under the same name, e.g. one per thread, 
+// are reported together
+class Stats
+{
+public:
+    struct Summary
+    {
+        uint64_t count;
+        uint64_t sum;           // ns
+        uint64_t max;           // ns, since the last reset
+        std::vector<uint64_t> buckets;
+    };
+    
+    static Stats & Instance();
+    
+    void Register(const std::string &name, Histogram *histogram);
+    void Unregister(Histogram *histogram);
+    
+    //! Register a counter or gauge as a metric. Labels are in Prometheus syntax without the braces, 
+    //! e.g. group="GPIO", or empty. Metrics with the same name and labels are added up
+    void Register(const std::string &name, const std::string &labels, Counter *counter);
+    void Register(const std::string &name, const std::string &labels, Gauge *gauge);
+    //! Register a counter kept outside of a Counter, like the ones of the i2c layer
+    void Register(const std::string &name, const std::string &labels, volatile uint64_t *counter);
+    void Unregister(volatile uint64_t *value);
+    void Unregister(Counter *counter) { this->Unregister(&counter->value); }
+    void Unregister(Gauge *gauge) { this->Unregister(&gauge->value); }
+    
+    std::vector<std::string> Names();
+    //! Combine all histograms with a name. Returns false if there are none
+    bool Get(const std::string &name, Summary &summary);
+    //! Start counting from zero for all histograms
+    void Reset();
+    
+    //! All metrics and histograms in the Prometheus text exposition format
+    std::string Prometheus();
+    
+private:
+    struct Metric
+    {
+        std::string labels;
+        bool gauge;
+        volatile uint64_t *value;
+    };
+    
+    Stats();
+    std::multimap<std::string, Histogram*> histograms;
+    std::multimap<std::string, Metric> metrics;
+    
+    void registerMetric(const std::string &name, const std::string &labels, bool gauge, volatile uint64_t *value);
+    pthread_mutex_t mutex;
+};
+
+#endif//__STATS_HPP
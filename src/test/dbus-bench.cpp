@@ -0,0 +1,573 @@
+/*
+ * D-Bus latency and throughput benchmark for piio-server.
+ *
+ * Starts a private dbus-daemon and a piio-server connected to it, then
+ *  - calls SetOutput, GetInput and SetValue from a number of concurrent clients, measuring the
+ *    round trip time of every call
+ *  - toggles outputs as fast as possible for a while, counting the signals that arrive
+ *  - with --simulate, injects input edges through the simulator for a while, counting the input signals
+ *    that arrive for them
+ * Results are printed as one JSON object per benchmark on stdout, progress goes to stderr.
+ *
+ * With --simulate the server runs on simulated hardware, so no root or real IO is needed. Without a
+ * --config, a GPIO group with output 'led' and input 'in' and an MCP23017 group with input 'in' are used.
+ *
+ * Example:
+ *   dbus-bench --server ./piio-server --config test.cfg --group GPIO --output led1 --input buttons -j 4
+ *   dbus-bench --server ./piio-server --simulate
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <dbus-c++/dbus.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <boost/program_options.hpp>
+
+#include "privatebus.hpp"
+
+// For getting current time
+#include <time.h>
+
+using namespace std;
+namespace po = boost::program_options;
+
+static const char *SERVER_DBUS_INTF = "nl.miqra.PiIo";
+static const std::string IOGROUP_DBUS_PATH = "/nl/miqra/PiIo/IoGroups";
+static const char *DIGITAL_INTF = "nl.miqra.PiIo.IoGroup.Digital";
+static const char *PWM_INTF = "nl.miqra.PiIo.IoGroup.Pwm";
+static const char *SIMULATOR_DBUS_PATH = "/nl/miqra/PiIo/Simulator";
+static const char *SIMULATOR_INTF = "nl.miqra.PiIo.Simulator";
+static const int CALL_TIMEOUT_MS = 5000;
+
+enum BenchOp
+{
+    kOpSetOutput,
+    kOpGetInput,
+    kOpSetValue,
+    kOpInjectGpio,
+    kOpInjectExpander
+};
+
+// Simulated hardware used when no config is given with --simulate
+static const unsigned int SIM_GPIO_OUTPUT = 18;
+static const unsigned int SIM_GPIO_INPUT = 17;
+static const unsigned int SIM_MCP_ADR = 0x20;
+static const unsigned int SIM_MCP_INTPIN = 22;
+static const unsigned int SIM_MCP_INPUT = 0;
+
+struct BenchWorker
+{
+    pthread_t thread;
+    std::string address;
+    BenchOp op;
+    std::string path;
+    std::string handle;
+    unsigned int expander;          // Expander address for kOpInjectExpander
+    unsigned int pin;               // Pin to inject edges on
+    unsigned int count;             // Number of calls to make, or 0 to run until the deadline
+    double deadline;
+    unsigned int errors;
+    std::vector<double> latencies;  // us
+};
+
+DBus::BusDispatcher dispatcher;
+static volatile unsigned int signalCount = 0;
+static volatile unsigned int inputSignalCount = 0;
+
+static double now_s(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// User + system cpu time of a process in seconds, from /proc
+static double processCpu(pid_t pid)
+{
+    std::ostringstream fn;
+    fn << "/proc/" << pid << "/stat";
+    std::ifstream f(fn.str().c_str());
+    std::string stat((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+    // Fields after the command name (which may contain spaces), utime and stime are field 14 and 15
+    size_t pos = stat.rfind(')');
+    if(pos == std::string::npos)
+        return 0;
+    std::istringstream fields(stat.substr(pos + 2));
+    std::string skip;
+    unsigned long utime = 0, stime = 0;
+    for(int i = 3; i < 14; i++)
+        fields >> skip;
+    fields >> utime >> stime;
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static double selfCpu(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+// Wait until the server has claimed its name on the bus
+static bool waitForServer(DBus::Connection &conn, pid_t pid, double timeout)
+{
+    double deadline = now_s() + timeout;
+    while(now_s() < deadline)
+    {
+        if(waitpid(pid, NULL, WNOHANG) == pid)
+            return false;
+
+        DBus::CallMessage call("org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameHasOwner");
+        DBus::MessageIter wi = call.writer();
+        wi << std::string(SERVER_DBUS_INTF);
+        DBus::Message reply = conn.send_blocking(call, CALL_TIMEOUT_MS);
+        DBus::MessageIter ri = reply.reader();
+        bool owned = false;
+        ri >> owned;
+        if(owned)
+            return true;
+        usleep(50000);
+    }
+    return false;
+}
+
+// Counts all signals from the server, runs in the dispatcher thread
+class SignalCounter
+{
+public:
+    bool filter(const DBus::Message &msg)
+    {
+        if(msg.is_signal(DIGITAL_INTF, "InputChanged") || msg.is_signal(DIGITAL_INTF, "InputsChanged"))
+        {
+            __sync_fetch_and_add(&signalCount, 1);
+            __sync_fetch_and_add(&inputSignalCount, 1);
+        }
+        else if(msg.is_signal(DIGITAL_INTF, "OutputChanged") || msg.is_signal(DIGITAL_INTF, "OutputsChanged")
+                || msg.is_signal(PWM_INTF, "PwmValueChanged"))
+        {
+            __sync_fetch_and_add(&signalCount, 1);
+        }
+        return false;
+    }
+};
+
+static void * dispatcherThread(void *)
+{
+    dispatcher.enter();
+    return NULL;
+}
+
+static void * workerThread(void * obj)
+{
+    BenchWorker * w = (BenchWorker *)obj;
+    DBus::Connection conn(w->address.c_str());
+    conn.register_bus();
+
+    bool value = false;
+    for(unsigned int i = 0; w->count == 0 || i < w->count; i++)
+    {
+        if(w->count == 0 && now_s() >= w->deadline)
+            break;
+
+        DBus::CallMessage call;
+        if(w->op == kOpInjectGpio || w->op == kOpInjectExpander)
+        {
+            // Edges are injected through the simulator, which needs no handle
+            value = !value;
+            call = DBus::CallMessage(SERVER_DBUS_INTF, SIMULATOR_DBUS_PATH, SIMULATOR_INTF,
+                                     (w->op == kOpInjectGpio) ? "SetGpio" : "SetExpanderInput");
+            DBus::MessageIter wi = call.writer();
+            if(w->op == kOpInjectGpio)
+                wi << (uint32_t)w->pin << value;
+            else
+                wi << (uint8_t)w->expander << (uint8_t)w->pin << value;
+        }
+        else
+        {
+            const char * iface = (w->op == kOpSetValue) ? PWM_INTF : DIGITAL_INTF;
+            const char * method = (w->op == kOpSetOutput) ? "SetOutput" : (w->op == kOpGetInput) ? "GetInput" : "SetValue";
+            call = DBus::CallMessage(SERVER_DBUS_INTF, w->path.c_str(), iface, method);
+            DBus::MessageIter wi = call.writer();
+            wi << w->handle;
+            if(w->op == kOpSetOutput)
+            {
+                value = !value;
+                wi << value;
+            }
+            else if(w->op == kOpSetValue)
+            {
+                wi << (double)(i % 100) / 100.0;
+            }
+        }
+
+        double start = now_s();
+        try
+        {
+            conn.send_blocking(call, CALL_TIMEOUT_MS);
+            w->latencies.push_back((now_s() - start) * 1e6);
+        }
+        catch(DBus::Error &e)
+        {
+            w->errors++;
+        }
+    }
+    return NULL;
+}
+
+static double percentile(std::vector<double> &sorted, double p)
+{
+    if(sorted.empty())
+        return 0;
+    size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+struct CpuSample
+{
+    double server;
+    double bus;
+    double client;
+};
+
+static CpuSample sampleCpu(pid_t server, pid_t bus)
+{
+    CpuSample s;
+    s.server = processCpu(server);
+    s.bus = processCpu(bus);
+    s.client = selfCpu();
+    return s;
+}
+
+static void printCpu(const char *name, const CpuSample &before, const CpuSample &after, unsigned int ops)
+{
+    double n = ops > 0 ? ops : 1;
+    cout << ",\"" << name << "\":{\"server\":" << (after.server - before.server) * 1e6 / n
+         << ",\"bus\":" << (after.bus - before.bus) * 1e6 / n
+         << ",\"client\":" << (after.client - before.client) * 1e6 / n << "}";
+}
+
+// Run one benchmark with concurrent workers. With count 0, runs for duration seconds.
+static void runWorkers(std::vector<BenchWorker> &workers, const std::string &address, BenchOp op, const std::string &path,
+                       const std::string &handle, unsigned int count, double duration)
+{
+    double deadline = now_s() + duration;
+    for(std::vector<BenchWorker>::iterator it = workers.begin(); it != workers.end(); ++it)
+    {
+        it->address = address;
+        it->op = op;
+        it->path = path;
+        it->handle = handle;
+        it->count = count;
+        it->deadline = deadline;
+        it->errors = 0;
+        it->latencies.clear();
+        it->latencies.reserve(count);
+        pthread_create(&it->thread, NULL, workerThread, &(*it));
+    }
+    for(std::vector<BenchWorker>::iterator it = workers.begin(); it != workers.end(); ++it)
+    {
+        pthread_join(it->thread, NULL);
+    }
+}
+
+static void benchCalls(const char *name, BenchOp op, const std::string &address, const std::string &path, const std::string &handle,
+                       unsigned int concurrency, unsigned int count, pid_t server, pid_t bus)
+{
+    std::vector<BenchWorker> workers(concurrency);
+
+    cerr << "Running " << name << " on " << path << " '" << handle << "'..." << endl;
+    CpuSample cpuBefore = sampleCpu(server, bus);
+    double start = now_s();
+    runWorkers(workers, address, op, path, handle, count, 0);
+    double elapsed = now_s() - start;
+    CpuSample cpuAfter = sampleCpu(server, bus);
+
+    std::vector<double> latencies;
+    unsigned int errors = 0;
+    for(std::vector<BenchWorker>::iterator it = workers.begin(); it != workers.end(); ++it)
+    {
+        latencies.insert(latencies.end(), it->latencies.begin(), it->latencies.end());
+        errors += it->errors;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    cout << "{\"benchmark\":\"" << name << "\",\"concurrency\":" << concurrency << ",\"calls\":" << latencies.size()
+         << ",\"errors\":" << errors << ",\"seconds\":" << elapsed << ",\"calls_per_s\":" << latencies.size() / elapsed
+         << ",\"latency_us\":{\"min\":" << percentile(latencies, 0) << ",\"p50\":" << percentile(latencies, 0.5)
+         << ",\"p90\":" << percentile(latencies, 0.9) << ",\"p99\":" << percentile(latencies, 0.99)
+         << ",\"p999\":" << percentile(latencies, 0.999) << ",\"max\":" << percentile(latencies, 1) << "}";
+    printCpu("cpu_us_per_call", cpuBefore, cpuAfter, latencies.size());
+    cout << "}" << endl;
+}
+
+// Toggle an output from all workers for a while, and measure how many signals get delivered
+static void benchStorm(const std::string &address, const std::string &path, const std::string &handle,
+                       unsigned int concurrency, double duration, pid_t server, pid_t bus)
+{
+    std::vector<BenchWorker> workers(concurrency);
+
+    cerr << "Running signal storm on " << path << " '" << handle << "' for " << duration << " s..." << endl;
+    CpuSample cpuBefore = sampleCpu(server, bus);
+    unsigned int signalsBefore = signalCount;
+    double start = now_s();
+    runWorkers(workers, address, kOpSetOutput, path, handle, 0, duration);
+    // Give the last signals some time to arrive
+    usleep(200000);
+    double elapsed = now_s() - start;
+    unsigned int signals = signalCount - signalsBefore;
+    CpuSample cpuAfter = sampleCpu(server, bus);
+
+    unsigned int calls = 0;
+    for(std::vector<BenchWorker>::iterator it = workers.begin(); it != workers.end(); ++it)
+    {
+        calls += it->latencies.size();
+    }
+
+    cout << "{\"benchmark\":\"signal-storm\",\"concurrency\":" << concurrency << ",\"seconds\":" << elapsed
+         << ",\"calls\":" << calls << ",\"signals\":" << signals << ",\"signals_per_s\":" << signals / elapsed;
+    printCpu("cpu_us_per_signal", cpuBefore, cpuAfter, signals);
+    cout << "}" << endl;
+}
+
+// Toggle a simulated input from a single client for a while, and measure how many of the injected edges come
+// back as input signals. A single client is used, so that every injection call is an edge on the input.
+static void benchInputStorm(const char *name, const std::string &address, BenchOp op, unsigned int expander, unsigned int pin,
+                            double duration, pid_t server, pid_t bus)
+{
+    BenchWorker w;
+    w.address = address;
+    w.op = op;
+    w.expander = expander;
+    w.pin = pin;
+    w.count = 0;
+    w.errors = 0;
+
+    cerr << "Running " << name << " on pin " << pin << " for " << duration << " s..." << endl;
+    CpuSample cpuBefore = sampleCpu(server, bus);
+    unsigned int signalsBefore = inputSignalCount;
+    double start = now_s();
+    w.deadline = start + duration;
+    pthread_create(&w.thread, NULL, workerThread, &w);
+    pthread_join(w.thread, NULL);
+    // Give the last signals some time to arrive
+    usleep(200000);
+    double elapsed = now_s() - start;
+    unsigned int signals = inputSignalCount - signalsBefore;
+    CpuSample cpuAfter = sampleCpu(server, bus);
+
+    unsigned int edges = w.latencies.size();
+    std::sort(w.latencies.begin(), w.latencies.end());
+    cout << "{\"benchmark\":\"" << name << "\",\"seconds\":" << elapsed << ",\"edges\":" << edges
+         << ",\"errors\":" << w.errors << ",\"edges_per_s\":" << edges / elapsed
+         << ",\"signals\":" << signals << ",\"signals_per_s\":" << signals / elapsed
+         << ",\"delivered\":" << (edges > 0 ? (double)signals / edges : 0)
+         << ",\"inject_latency_us\":{\"p50\":" << percentile(w.latencies, 0.5) << ",\"p99\":" << percentile(w.latencies, 0.99)
+         << ",\"max\":" << percentile(w.latencies, 1) << "}";
+    printCpu("cpu_us_per_signal", cpuBefore, cpuAfter, signals);
+    cout << "}" << endl;
+}
+
+// Configuration for the simulated hardware, when no config is given with --simulate
+static std::string simulatedConfig(void)
+{
+    std::ostringstream cfg;
+    cfg << "GPIO: { type = \"GPIO\"; io: {"
+        << " led: { type = \"OUTPUTPIN\"; pin = " << SIM_GPIO_OUTPUT << "; };"
+        << " in: { type = \"INPUTPIN\"; pin = " << SIM_GPIO_INPUT << "; }; }; };" << endl;
+    cfg << "MCP: { type = \"MCP23017\"; address = " << SIM_MCP_ADR << "; intpin = " << SIM_MCP_INTPIN << "; io: {"
+        << " in: { type = \"INPUTPIN\"; pin = " << SIM_MCP_INPUT << "; }; }; };" << endl;
+    return cfg.str();
+}
+
+int main(int argc, char ** argv)
+{
+    // first parse options
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "Show this help message")
+        ("server", po::value<string>()->default_value("./piio-server"), "piio-server binary to benchmark")
+        ("config,c", po::value<string>(), "configuration file for the server")
+        ("dbus-daemon", po::value<string>()->default_value("dbus-daemon"), "dbus-daemon binary to use for the private bus")
+        ("group", po::value<string>()->default_value("GPIO"), "digital IO group to use")
+        ("output", po::value<string>(), "output handle for SetOutput and the signal storm")
+        ("input", po::value<string>(), "input handle for GetInput")
+        ("pwm-group", po::value<string>(), "pwm IO group to use for SetValue")
+        ("pwm", po::value<string>(), "pwm handle for SetValue")
+        ("concurrency,j", po::value<unsigned int>()->default_value(1), "number of concurrent clients")
+        ("count,n", po::value<unsigned int>()->default_value(1000), "number of calls per client")
+        ("storm-time", po::value<double>()->default_value(5), "duration of the signal storm in seconds, 0 to skip")
+        ("simulate", "run the server on simulated hardware, the config is optional then")
+        ("inject-gpio", po::value<unsigned int>(), "gpio input pin to inject an edge storm on with --simulate")
+        ("inject-expander", po::value<string>(), "MCP23017 input to inject an edge storm on with --simulate, as <address>:<pin>")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc,argv,desc),vm);
+    po::notify(vm);
+
+    bool simulate = (vm.count("simulate") > 0);
+    if (vm.count("help") || (!vm.count("config") && !simulate))
+    {
+        cout << desc << endl;
+        return 1;
+    }
+
+    std::string configfile;
+    std::string output = vm.count("output") ? vm["output"].as<string>() : "";
+    std::string input = vm.count("input") ? vm["input"].as<string>() : "";
+    bool injectGpio = vm.count("inject-gpio") > 0;
+    unsigned int injectGpioPin = injectGpio ? vm["inject-gpio"].as<unsigned int>() : 0;
+    bool injectExpander = false;
+    unsigned int injectExpanderAdr = 0, injectExpanderPin = 0;
+    if(vm.count("inject-expander"))
+    {
+        int adr = 0;
+        if(sscanf(vm["inject-expander"].as<string>().c_str(), "%i:%u", &adr, &injectExpanderPin) != 2)
+        {
+            cerr << "Expected <address>:<pin> for --inject-expander" << endl;
+            return 1;
+        }
+        injectExpanderAdr = adr;
+        injectExpander = true;
+    }
+
+    if(vm.count("config"))
+    {
+        configfile = vm["config"].as<string>();
+    }
+    else
+    {
+        // Write the config for the simulated hardware, and benchmark everything on it unless told otherwise
+        char tmpl[] = "/tmp/dbus-bench-XXXXXX";
+        int fd = mkstemp(tmpl);
+        std::string cfg = simulatedConfig();
+        if(fd < 0 || write(fd, cfg.data(), cfg.size()) != (ssize_t)cfg.size())
+        {
+            cerr << "Could not write a config for the simulated hardware: " << strerror(errno) << endl;
+            return 1;
+        }
+        close(fd);
+        configfile = tmpl;
+
+        if(!vm.count("output") && !vm.count("input") && !injectGpio && !injectExpander)
+        {
+            output = "led";
+            input = "in";
+            injectGpio = true;
+            injectGpioPin = SIM_GPIO_INPUT;
+            injectExpander = true;
+            injectExpanderAdr = SIM_MCP_ADR;
+            injectExpanderPin = SIM_MCP_INPUT;
+        }
+    }
+
+    unsigned int concurrency = vm["concurrency"].as<unsigned int>();
+    unsigned int count = vm["count"].as<unsigned int>();
+    std::string grouppath = IOGROUP_DBUS_PATH + "/" + vm["group"].as<string>();
+
+    signal(SIGPIPE, SIG_IGN);
+
+    std::string address;
+    pid_t bus = startBus(vm["dbus-daemon"].as<string>(), address);
+    if(bus < 0)
+    {
+        cerr << "Could not start a private dbus-daemon" << endl;
+        return 1;
+    }
+    cerr << "Private bus at " << address << endl;
+
+    std::vector<std::string> args;
+    args.push_back(vm["server"].as<string>());
+    args.push_back("--config");
+    args.push_back(configfile);
+    args.push_back("--bus");
+    args.push_back(address);
+    if(simulate)
+        args.push_back("--simulate");
+    pid_t server = spawn(args);
+
+    DBus::_init_threading();
+    DBus::default_dispatcher = &dispatcher;
+
+    int result = 0;
+    {
+        DBus::Connection conn(address.c_str());
+        conn.register_bus();
+
+        if(!waitForServer(conn, server, 10))
+        {
+            cerr << "Server did not come up on the private bus" << endl;
+            terminate(server);
+            terminate(bus);
+            if(!vm.count("config"))
+                unlink(configfile.c_str());
+            return 1;
+        }
+
+        SignalCounter counter;
+        DBus::MessageSlot filter;
+        filter = new DBus::Callback<SignalCounter, bool, const DBus::Message &>(&counter, &SignalCounter::filter);
+        conn.add_filter(filter);
+        conn.add_match((std::string("type='signal',sender='") + SERVER_DBUS_INTF + "'").c_str());
+
+        pthread_t dispatcherTid;
+        pthread_create(&dispatcherTid, NULL, dispatcherThread, NULL);
+
+        if(!output.empty())
+        {
+            benchCalls("SetOutput", kOpSetOutput, address, grouppath, output, concurrency, count, server, bus);
+        }
+        if(!input.empty())
+        {
+            benchCalls("GetInput", kOpGetInput, address, grouppath, input, concurrency, count, server, bus);
+        }
+        if(vm.count("pwm-group") && vm.count("pwm"))
+        {
+            benchCalls("SetValue", kOpSetValue, address, IOGROUP_DBUS_PATH + "/" + vm["pwm-group"].as<string>(), vm["pwm"].as<string>(),
+                       concurrency, count, server, bus);
+        }
+        if(!output.empty() && vm["storm-time"].as<double>() > 0)
+        {
+            benchStorm(address, grouppath, output, concurrency, vm["storm-time"].as<double>(), server, bus);
+        }
+        // Edge injection needs the simulator control interface, which only exists on simulated hardware
+        if(simulate && injectGpio && vm["storm-time"].as<double>() > 0)
+        {
+            benchInputStorm("gpio-input-storm", address, kOpInjectGpio, 0, injectGpioPin, vm["storm-time"].as<double>(), server, bus);
+        }
+        if(simulate && injectExpander && vm["storm-time"].as<double>() > 0)
+        {
+            benchInputStorm("mcp23017-input-storm", address, kOpInjectExpander, injectExpanderAdr, injectExpanderPin,
+                            vm["storm-time"].as<double>(), server, bus);
+        }
+
+        if(waitpid(server, NULL, WNOHANG) == server)
+        {
+            cerr << "Server exited during the benchmark" << endl;
+            result = 1;
+        }
+
+        dispatcher.leave();
+        pthread_join(dispatcherTid, NULL);
+        conn.remove_filter(filter);
+    }
+
+    terminate(server);
+    terminate(bus);
+    if(!vm.count("config"))
+        unlink(configfile.c_str());
+    return result;
+}
@@ -0,0 +1,426 @@
+/*
+ * Microbenchmarks of the hot paths in piio-server.
+ *
+ * Runs in-process against io groups with in-memory pins and a simulated MCP23017, so it needs no hardware.
+ * The groups are D-Bus objects, so a private dbus-daemon is started for them, but no signals are sent:
+ * the groups are in subscription mode without subscribers.
+ *
+ * Every benchmark is run with an iteration count that takes at least --min-time seconds, a number of
+ * times. Results are printed as one JSON object per benchmark on stdout, with the ns per operation.
+ *
+ * Example:
+ *   micro-bench --filter digital -r 10
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <dbus-c++/dbus.h>
+#include <libconfig.h++>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <boost/program_options.hpp>
+
+#include "../iogroup-digital.hpp"
+#include "../iogroup-hwpwm.hpp"
+#include "../buttontimer/buttontimer.hpp"
+#include "../mcp23017/mcp23017.hpp"
+#include "../simulator/simulator.hpp"
+#include "../simulator/simdevices.hpp"
+#include "../log/log.hpp"
+#include "privatebus.hpp"
+
+// For getting current time
+#include <time.h>
+
+using namespace std;
+using namespace libconfig;
+namespace po = boost::program_options;
+
+#define BENCH_PINS      16      // Inputs and outputs in the digital group
+#define BENCH_MCP_ADR   0x20
+
+DBus::BusDispatcher dispatcher;
+static volatile uint64_t sink = 0;     // Results go here, so the compiler cannot drop the work
+
+static double now_s(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/****************************
+*                           *
+*     FIXTURES              *
+*                           *
+*****************************/
+
+// Digital group on in-memory pins: pin n is bit n of a word
+class BenchDigital : public IoGroupDigital
+{
+public:
+    BenchDigital(DBus::Connection &connection, std::string &dbuspath, GpioRegistry &registry)
+      : IoGroupDigital(connection, dbuspath, registry), pins(0) {}
+
+    // Change an input pin, as an interrupt would
+    void Change(uint16_t id, bool value)
+    {
+        if(value)   this->pins |= (1ULL << id);
+        else        this->pins &= ~(1ULL << id);
+        this->inputChanged(id, value);
+    }
+
+protected:
+    uint64_t pins;
+    uint8_t pwms[64];
+
+    virtual bool getInputPin(uint16_t id) { return (this->pins >> id) & 0x01; }
+    virtual bool setOutputPin(uint16_t id, bool value) { this->pins = value ? (this->pins | (1ULL << id)) : (this->pins & ~(1ULL << id)); return true; }
+    virtual bool setPwm(uint16_t id, uint8_t value) { this->pwms[id] = value; return true; }
+    virtual uint16_t getPinId(int32_t i) { return (uint16_t)i; }
+    virtual uint16_t getPinId(std::string s) { return (uint16_t)atoi(s.c_str()); }
+    virtual void prepareInputPin(uint16_t pinid, bool invert, bool pullup, bool pulldown, bool inten) {}
+    virtual void prepareOutputPin(uint16_t pinid) {}
+    virtual void preparePwmPin(uint16_t pinid) {}
+};
+
+// Pwm group that computes the filtered value on every change, like the PCA9685 group does
+class BenchPwm : public IoGroupHwPwm
+{
+public:
+    BenchPwm(DBus::Connection &connection, std::string &dbuspath, GpioRegistry &registry)
+      : IoGroupHwPwm(connection, dbuspath, registry) {}
+
+    // Filtered value of a pin, by index in config order
+    double Filtered(size_t index) { return this->pins[index]->GetFilteredValue(); }
+    void SetFiltered(size_t index, double value) { this->pins[index]->SetFromFilteredValue(value, 0); }
+
+protected:
+    std::vector<PwmPin*> pins;
+
+    virtual void setPwmPin(PwmPin *pin) { sink += (uint64_t)(pin->GetFilteredValue() * 4096); }
+    virtual void getPwmPin(PwmPin *pin) {}
+    virtual void preparePwmPin(PwmPin *pin) { this->pins.push_back(pin); }
+    virtual uint16_t getPinId(const int32_t &i) { return (uint16_t)i; }
+};
+
+static BenchDigital *digital = NULL;
+static BenchPwm *pwm = NULL;
+static Mcp23017 *mcp = NULL;
+static std::vector<std::string> inputHandles;
+static std::vector<std::string> outputHandles;
+
+static void countSlot(IoGroupDigital *, std::string, bool value)
+{
+    sink += value;
+}
+
+/****************************
+*                           *
+*     BENCHMARKS            *
+*                           *
+*****************************/
+
+static void benchLookup(uint64_t n)
+{
+    for(uint64_t i = 0; i < n; i++)
+        sink += digital->GetOutput(outputHandles[i % BENCH_PINS]);
+}
+
+static void benchSetOutput(uint64_t n)
+{
+    for(uint64_t i = 0; i < n; i++)
+        digital->SetOutput(outputHandles[i % BENCH_PINS], (i / BENCH_PINS) & 0x01);
+}
+
+static void benchSetOutputUnchanged(uint64_t n)
+{
+    bool value = digital->GetOutput(outputHandles[0]);
+    for(uint64_t i = 0; i < n; i++)
+        digital->SetOutput(outputHandles[0], value);
+}
+
+static void benchGetInput(uint64_t n)
+{
+    for(uint64_t i = 0; i < n; i++)
+        sink += digital->GetInput(inputHandles[i % BENCH_PINS]);
+}
+
+static void benchSetLedPwm(uint64_t n)
+{
+    for(uint64_t i = 0; i < n; i++)
+        digital->SetLedPwm("pwm0", (uint8_t)i);
+}
+
+static void inputChanged(uint64_t n, int slots)
+{
+    std::vector<boost::signals2::connection> connections;
+    for(int s = 0; s < slots; s++)
+        connections.push_back(digital->onInputChanged.connect(&countSlot));
+
+    for(uint64_t i = 0; i < n; i++)
+        digital->Change(i % BENCH_PINS, (i / BENCH_PINS) & 0x01);
+
+    for(size_t s = 0; s < connections.size(); s++)
+        connections[s].disconnect();
+}
+
+static void benchInputChanged0(uint64_t n) { inputChanged(n, 0); }
+static void benchInputChanged1(uint64_t n) { inputChanged(n, 1); }
+static void benchInputChanged4(uint64_t n) { inputChanged(n, 4); }
+
+static void benchButton(uint64_t n)
+{
+    // A press and release, which is too short to report, so the cost is only the bookkeeping
+    for(uint64_t i = 0; i < n; i++)
+    {
+        digital->Change(BENCH_PINS * 2, true);
+        digital->Change(BENCH_PINS * 2, false);
+    }
+}
+
+static void benchButtonTimer(uint64_t n)
+{
+    static ButtonTimer timer(25, 6000);
+    for(uint64_t i = 0; i < n; i++)
+    {
+        timer.RegisterPress(i & 0x0F);
+        timer.RegisterRelease(i & 0x0F);
+    }
+}
+
+static void filtered(uint64_t n, size_t index)
+{
+    double sum = 0;
+    for(uint64_t i = 0; i < n; i++)
+        sum += pwm->Filtered(index);
+    sink += (uint64_t)sum;
+}
+
+static void benchFilteredNone(uint64_t n) { filtered(n, 0); }
+static void benchFilteredLed(uint64_t n) { filtered(n, 1); }
+static void benchFilteredServo(uint64_t n) { filtered(n, 2); }
+
+static void benchSetFilteredLed(uint64_t n)
+{
+    for(uint64_t i = 0; i < n; i++)
+        pwm->SetFiltered(1, (i & 0xFF) / 255.0);
+}
+
+static void benchPwmSetValueLed(uint64_t n)
+{
+    for(uint64_t i = 0; i < n; i++)
+        pwm->SetValue("led", (i & 0xFF) / 255.0);
+}
+
+static void benchMcpPwmFrame(uint64_t n)
+{
+    for(uint64_t i = 0; i < n; i++)
+        sink += mcp->getPwmFrame(i & 0x0F);
+}
+
+static void benchMcpPwmLedValue(uint64_t n)
+{
+    for(uint64_t i = 0; i < n; i++)
+        mcp->setPwmLedValue(i & 0x0F, (uint8_t)i);
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*func)(uint64_t n);
+};
+
+static const Benchmark benchmarks[] =
+{
+    { "digital.lookup",                 benchLookup },
+    { "digital.set-output",             benchSetOutput },
+    { "digital.set-output-unchanged",   benchSetOutputUnchanged },
+    { "digital.get-input",              benchGetInput },
+    { "digital.set-led-pwm",            benchSetLedPwm },
+    { "digital.input-changed-0-slots",  benchInputChanged0 },
+    { "digital.input-changed-1-slot",   benchInputChanged1 },
+    { "digital.input-changed-4-slots",  benchInputChanged4 },
+    { "digital.button-press-release",   benchButton },
+    { "buttontimer.press-release",      benchButtonTimer },
+    { "pwmpin.filtered-none",           benchFilteredNone },
+    { "pwmpin.filtered-led",            benchFilteredLed },
+    { "pwmpin.filtered-servo",          benchFilteredServo },
+    { "pwmpin.set-filtered-led",        benchSetFilteredLed },
+    { "hwpwm.set-value-led",            benchPwmSetValueLed },
+    { "mcp23017.pwm-frame",             benchMcpPwmFrame },
+    { "mcp23017.pwm-led-value",         benchMcpPwmLedValue },
+};
+
+// Run a benchmark repetitions times, with an iteration count that takes at least minTime seconds
+static void run(const Benchmark &b, double minTime, unsigned int repetitions)
+{
+    uint64_t n = 1;
+    for(;;)
+    {
+        double start = now_s();
+        b.func(n);
+        double elapsed = now_s() - start;
+        if(elapsed >= minTime)
+            break;
+        // Grow quickly while the runs are too short to time, then aim just past minTime
+        n = (elapsed < minTime / 100) ? n * 100 : (uint64_t)(n * 1.2 * minTime / elapsed) + 1;
+    }
+
+    std::vector<double> samples;
+    for(unsigned int r = 0; r < repetitions; r++)
+    {
+        double start = now_s();
+        b.func(n);
+        samples.push_back((now_s() - start) * 1e9 / n);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    cout << "{\"benchmark\":\"" << b.name << "\",\"iterations\":" << n << ",\"repetitions\":" << repetitions
+         << ",\"ns_per_op\":" << samples[samples.size() / 2] << ",\"ns_per_op_min\":" << samples.front()
+         << ",\"ns_per_op_max\":" << samples.back() << "}" << endl;
+}
+
+static std::string digitalConfig()
+{
+    std::ostringstream cfg;
+    cfg << "digital: { type = \"BENCH\"; io: {";
+    for(int i = 0; i < BENCH_PINS; i++)
+    {
+        cfg << " in" << i << ": { type = \"INPUTPIN\"; pin = " << i << "; };";
+        cfg << " out" << i << ": { type = \"OUTPUTPIN\"; pin = " << BENCH_PINS + i << "; };";
+    }
+    cfg << " btn: { type = \"BUTTON\"; pin = " << BENCH_PINS * 2 << "; };";
+    cfg << " pwm0: { type = \"PWMPIN\"; pin = " << BENCH_PINS * 2 + 1 << "; };";
+    cfg << " }; };";
+    cfg << "pwm: { type = \"BENCH\"; io: {";
+    cfg << " none: { pin = 0; };";
+    cfg << " led: { pin = 1; filter = \"led\"; gamma = 2.8; default = 0.5; };";
+    cfg << " servo: { pin = 2; filter = \"servo\"; min = -90.0; max = 90.0; default = 10.0; };";
+    cfg << " }; };";
+    return cfg.str();
+}
+
+int main(int argc, char ** argv)
+{
+    // first parse options
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "Show this help message")
+        ("dbus-daemon", po::value<string>()->default_value("dbus-daemon"), "dbus-daemon binary to use for the private bus")
+        ("filter,f", po::value<string>()->default_value(""), "only run benchmarks whose name contains this text")
+        ("min-time", po::value<double>()->default_value(0.2), "minimum duration of one repetition in seconds")
+        ("repetitions,r", po::value<unsigned int>()->default_value(5), "number of repetitions, the median is reported")
+        ("list", "list the benchmarks")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc,argv,desc),vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        cout << desc << endl;
+        return 1;
+    }
+    if (vm.count("list"))
+    {
+        for(size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+            cout << benchmarks[i].name << endl;
+        return 0;
+    }
+
+    std::string filter = vm["filter"].as<string>();
+    double minTime = vm["min-time"].as<double>();
+    unsigned int repetitions = std::max(1u, vm["repetitions"].as<unsigned int>());
+
+    signal(SIGPIPE, SIG_IGN);
+    Log::Init("micro-bench");
+
+    std::string address;
+    pid_t bus = startBus(vm["dbus-daemon"].as<string>(), address);
+    if(bus < 0)
+    {
+        cerr << "Could not start a private dbus-daemon" << endl;
+        Log::Close();
+        return 1;
+    }
+
+    DBus::_init_threading();
+    DBus::default_dispatcher = &dispatcher;
+
+    // The MCP23017 runs against a device model
+    Simulator::Instance().Enable();
+    Simulator::Instance().AddDevice(BENCH_MCP_ADR, new Mcp23017Model(BENCH_MCP_ADR, -1));
+
+    int result = 0;
+    try
+    {
+        DBus::Connection conn(address.c_str());
+        conn.register_bus();
+
+        Config config;
+        config.readString(digitalConfig());
+
+        GpioRegistry registry;
+        SignalSubscriptions subscriptions;
+        subscriptions.Subscribed(true);
+
+        std::string digitalPath = "/bench/digital";
+        std::string pwmPath = "/bench/pwm";
+        digital = new BenchDigital(conn, digitalPath, registry);
+        digital->Initialize(config.lookup("digital"));
+        digital->Subscriptions(&subscriptions);
+        digital->Start();
+        pwm = new BenchPwm(conn, pwmPath, registry);
+        pwm->Initialize(config.lookup("pwm"));
+        pwm->Subscriptions(&subscriptions);
+        pwm->Start();
+
+        HWConfig hwcfg;
+        mcp = new Mcp23017(BENCH_MCP_ADR, 0x0000, 0x0000, 0x0000, hwcfg, false);
+        for(uint8_t pin = 0; pin < 16; pin++)
+        {
+            mcp->setPwmState(pin, true);
+            mcp->setPwmValue(pin, pin * 16);
+        }
+
+        for(int i = 0; i < BENCH_PINS; i++)
+        {
+            std::ostringstream in, out;
+            in << "in" << i;
+            out << "out" << i;
+            inputHandles.push_back(in.str());
+            outputHandles.push_back(out.str());
+        }
+
+        for(size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+        {
+            if(strstr(benchmarks[i].name, filter.c_str()) != NULL)
+                run(benchmarks[i], minTime, repetitions);
+        }
+
+        delete mcp;
+        delete pwm;
+        delete digital;
+    }
+    catch(const libconfig::ParseException &x)
+    {
+        cerr << "Error parsing the benchmark config: " << x.getError() << " on line " << x.getLine() << endl;
+        result = 1;
+    }
+    catch(const DBus::Error &x)
+    {
+        cerr << "D-Bus error: " << x.message() << endl;
+        result = 1;
+    }
+
+    terminate(bus);
+    Log::Close();
+    return result;
+}
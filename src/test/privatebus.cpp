@@ -0,0 +1,76 @@
+#include "privatebus.hpp"
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+// Start a process with the given arguments, returns its pid
+pid_t spawn(std::vector<std::string> &args)
+{
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        std::vector<char *> argv;
+        for(std::vector<std::string>::iterator it = args.begin(); it != args.end(); ++it)
+            argv.push_back(const_cast<char *>(it->c_str()));
+        argv.push_back(NULL);
+        execvp(argv[0], &argv[0]);
+        cerr << "Could not start '" << args[0] << "': " << strerror(errno) << endl;
+        _exit(127);
+    }
+    return pid;
+}
+
+void terminate(pid_t pid)
+{
+    if(pid > 0)
+    {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+}
+
+// Start a private dbus-daemon, returns its pid and sets its address
+pid_t startBus(const std::string &daemon, std::string &address)
+{
+    int fds[2];
+    if(pipe(fds) != 0)
+        return -1;
+
+    std::ostringstream printaddress;
+    printaddress << "--print-address=" << fds[1];
+    std::vector<std::string> args;
+    args.push_back(daemon);
+    args.push_back("--session");
+    args.push_back("--nofork");
+    args.push_back("--nopidfile");
+    args.push_back(printaddress.str());
+    pid_t pid = spawn(args);
+    close(fds[1]);
+
+    char buffer[512];
+    size_t n = 0;
+    ssize_t r;
+    while(n < sizeof(buffer) - 1 && (r = read(fds[0], buffer + n, sizeof(buffer) - 1 - n)) > 0)
+    {
+        n += r;
+        if(memchr(buffer, '\n', n) != NULL)
+            break;
+    }
+    close(fds[0]);
+    buffer[n] = 0;
+
+    address = buffer;
+    address.erase(address.find_last_not_of("\r\n") + 1);
+    if(address.empty())
+    {
+        terminate(pid);
+        return -1;
+    }
+    return pid;
+}
@@ -0,0 +1,19 @@
+#ifndef __PRIVATEBUS_HPP
+#define __PRIVATEBUS_HPP
+
+// Helpers for the benchmarks, which run against a private dbus-daemon instead of the system bus
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+// Start a process with the given arguments, returns its pid
+pid_t spawn(std::vector<std::string> &args);
+
+// Stop a process started with spawn and wait for it
+void terminate(pid_t pid);
+
+// Start a private dbus-daemon, returns its pid and sets its address
+pid_t startBus(const std::string &daemon, std::string &address);
+
+#endif//__PRIVATEBUS_HPP
@@ -0,0 +1,334 @@
+/*
+ * PWM waveform accuracy and CPU cost benchmark.
+ *
+ * Runs the software PWM of a GPIO group and the PWM of an MCP23017 group on simulated hardware, where
+ * every output transition is timestamped. For every combination of tick delay, tick count and number
+ * of active pins, the PWM runs for a while and the recorded waveforms are analyzed per channel:
+ *  - the achieved frequency, against the nominal 1 / (tick delay * ticks)
+ *  - the duty cycle, against the requested value / 255
+ *  - the jitter, as the standard deviation and the largest deviation of the periods
+ *  - the cpu time of the process, as a percentage of one cpu, and the mean lateness of the ticks
+ * Results are printed as CSV on stdout, one line per channel, progress goes to stderr.
+ *
+ * The cpu time includes recording the transitions in the simulator, so it is an upper bound for the
+ * cost on real hardware. The timing is that of the machine the benchmark runs on.
+ *
+ * Example:
+ *   pwm-bench --driver gpio --tickdelay 100,400,800 --ticks 16,32 --pins 1,8 > pwm.csv
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <math.h>
+#include <sys/resource.h>
+
+#include <dbus-c++/dbus.h>
+#include <libconfig.h++>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include "../iogroup-gpio.hpp"
+#include "../iogroup-mcp23017.hpp"
+#include "../simulator/simulator.hpp"
+#include "../simulator/simdevices.hpp"
+#include "../stats/stats.hpp"
+#include "../log/log.hpp"
+#include "privatebus.hpp"
+
+// For getting current time
+#include <time.h>
+
+using namespace std;
+using namespace libconfig;
+namespace po = boost::program_options;
+
+#define BENCH_GPIO_FIRST    4       // First gpio pin used for software pwm
+#define BENCH_MCP_ADR       0x20
+#define SETTLE_S            0.1     // Time for the pwm thread to get going before recording
+
+DBus::BusDispatcher dispatcher;
+
+struct ChannelResult
+{
+    unsigned int periods;
+    double frequency;       // Hz
+    double duty;            // 0...1
+    double jitter;          // Standard deviation of the period, us
+    double maxDeviation;    // Largest deviation of a period from the mean, us
+};
+
+static double now_s(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double selfCpu(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static std::vector<unsigned int> parseList(const std::string &s)
+{
+    std::vector<std::string> parts;
+    std::vector<unsigned int> values;
+    boost::split(parts, s, boost::is_any_of(","));
+    for(std::vector<std::string>::iterator it = parts.begin(); it != parts.end(); ++it)
+    {
+        if(!it->empty())
+            values.push_back(strtoul(it->c_str(), NULL, 0));
+    }
+    return values;
+}
+
+// Measure a waveform over the whole periods in it, from the first to the last rising edge.
+// Returns false if there are less than two rising edges
+static bool analyze(const std::vector<Simulator::Transition> &w, ChannelResult &r)
+{
+    std::vector<uint64_t> rises;
+    for(size_t i = 1; i < w.size(); i++)
+    {
+        if(w[i].value && !w[i-1].value)
+            rises.push_back(w[i].time);
+    }
+    if(rises.size() < 2)
+        return false;
+
+    uint64_t first = rises.front(), last = rises.back();
+    uint64_t high = 0;
+    for(size_t i = 0; i + 1 < w.size(); i++)
+    {
+        if(!w[i].value || w[i].time >= last || w[i+1].time <= first)
+            continue;
+        high += std::min(w[i+1].time, last) - std::max(w[i].time, first);
+    }
+
+    double span = last - first;
+    double mean = span / (rises.size() - 1);
+    double variance = 0, maxDeviation = 0;
+    for(size_t i = 1; i < rises.size(); i++)
+    {
+        double deviation = (rises[i] - rises[i-1]) - mean;
+        variance += deviation * deviation;
+        maxDeviation = std::max(maxDeviation, fabs(deviation));
+    }
+
+    r.periods = rises.size() - 1;
+    r.frequency = 1e6 / mean;
+    r.duty = high / span;
+    r.jitter = sqrt(variance / r.periods);
+    r.maxDeviation = maxDeviation;
+    return true;
+}
+
+static std::string groupConfig(const std::string &driver, unsigned int tickdelay, unsigned int ticks, unsigned int pins)
+{
+    std::ostringstream cfg;
+    cfg << "bench: { ";
+    if(driver == "gpio")
+        cfg << "type = \"GPIO\"; ";
+    else
+        cfg << "type = \"MCP23017\"; address = " << BENCH_MCP_ADR << "; ";
+    cfg << "pwm-tickdelay-us = " << tickdelay << "; pwm-ticks = " << ticks << "; io: {";
+    for(unsigned int i = 0; i < pins; i++)
+    {
+        cfg << " pwm" << i << ": { type = \"PWMPIN\"; pin = " << ((driver == "gpio") ? BENCH_GPIO_FIRST + i : i) << "; };";
+    }
+    cfg << " }; };";
+    return cfg.str();
+}
+
+static std::string channelName(const std::string &driver, unsigned int pin)
+{
+    std::ostringstream channel;
+    if(driver == "gpio")
+        channel << "gpio." << BENCH_GPIO_FIRST + pin;
+    else
+        channel << "mcp23017.0x" << hex << BENCH_MCP_ADR << dec << "." << pin;
+    return channel.str();
+}
+
+// Run one combination of settings, and print a line per channel
+static void run(DBus::Connection &conn, GpioRegistry &registry, SignalSubscriptions &subscriptions, const std::string &driver,
+                unsigned int tickdelay, unsigned int ticks, unsigned int pins, const std::vector<unsigned int> &values, double duration)
+{
+    cerr << driver << ": " << tickdelay << " us x " << ticks << " ticks, " << pins << " pins" << endl;
+
+    Config config;
+    config.readString(groupConfig(driver, tickdelay, ticks, pins));
+    std::string path = "/bench/" + driver;
+    IoGroupDigital * group;
+    if(driver == "gpio")
+        group = new IoGroupGpio(conn, path, registry);
+    else
+        group = new IoGroupMCP23017(conn, path, registry);
+
+    group->Initialize(config.lookup("bench"));
+    group->Subscriptions(&subscriptions);
+    group->Start();
+
+    for(unsigned int i = 0; i < pins; i++)
+    {
+        std::ostringstream handle;
+        handle << "pwm" << i;
+        group->SetPwm(handle.str(), (uint8_t)values[i % values.size()]);
+    }
+
+    usleep(SETTLE_S * 1e6);
+    Simulator::Instance().ClearWaveforms();
+    Stats::Instance().Reset();
+    double cpuStart = selfCpu(), start = now_s();
+    usleep(duration * 1e6);
+    double cpu = (selfCpu() - cpuStart) / (now_s() - start) * 100;
+
+    Stats::Summary lateness;
+    double meanLateness = 0;
+    if(Stats::Instance().Get("pwm.tick-lateness", lateness) && lateness.count > 0)
+        meanLateness = lateness.sum / 1e3 / lateness.count;
+
+    // Collect the waveforms before the group stops its pwm and sets the outputs low
+    std::vector< std::vector<Simulator::Transition> > waveforms;
+    for(unsigned int i = 0; i < pins; i++)
+        waveforms.push_back(Simulator::Instance().Waveform(channelName(driver, i)));
+    delete group;
+
+    double nominal = 1e6 / ((double)tickdelay * ticks);
+    for(unsigned int i = 0; i < pins; i++)
+    {
+        unsigned int value = values[i % values.size()];
+        double expected = value / 255.0;
+        ChannelResult r;
+
+        cout << driver << "," << tickdelay << "," << ticks << "," << pins << "," << channelName(driver, i) << "," << value
+             << "," << nominal << "," << expected << ",";
+        if(analyze(waveforms[i], r))
+        {
+            cout << r.periods << "," << r.frequency << "," << (r.frequency - nominal) / nominal << "," << r.duty << "," << r.duty - expected
+                 << "," << r.jitter << "," << r.maxDeviation;
+        }
+        else
+        {
+            cout << "0,,,,,,";
+        }
+        cout << "," << cpu << "," << meanLateness << endl;
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    // first parse options
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "Show this help message")
+        ("dbus-daemon", po::value<string>()->default_value("dbus-daemon"), "dbus-daemon binary to use for the private bus")
+        ("driver", po::value<string>()->default_value("gpio,mcp23017"), "pwm drivers to measure: gpio (software pwm), mcp23017")
+        ("tickdelay", po::value<string>()->default_value("100,200,400,800,1600"), "pwm-tickdelay-us settings to measure")
+        ("ticks", po::value<string>()->default_value("8,16,32"), "pwm-ticks settings to measure")
+        ("pins", po::value<string>()->default_value("1,4,8,16"), "numbers of active pwm pins to measure")
+        ("values", po::value<string>()->default_value("64,128,192"), "pwm values (0-255) given to the pins in turn")
+        ("duration", po::value<double>()->default_value(2), "measuring time per combination in seconds")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc,argv,desc),vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        cout << desc << endl;
+        return 1;
+    }
+
+    std::vector<std::string> drivers;
+    boost::split(drivers, vm["driver"].as<string>(), boost::is_any_of(","));
+    std::vector<unsigned int> tickdelays = parseList(vm["tickdelay"].as<string>());
+    std::vector<unsigned int> tickcounts = parseList(vm["ticks"].as<string>());
+    std::vector<unsigned int> pincounts = parseList(vm["pins"].as<string>());
+    std::vector<unsigned int> values = parseList(vm["values"].as<string>());
+    double duration = vm["duration"].as<double>();
+
+    bool valid = !values.empty();
+    for(size_t i = 0; i < values.size(); i++)
+        valid = valid && values[i] > 0 && values[i] < 255;
+    if(!valid)
+    {
+        cerr << "Values must be between 1 and 254, 0 and 255 switch the pwm off" << endl;
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    Log::Init("pwm-bench");
+
+    std::string address;
+    pid_t bus = startBus(vm["dbus-daemon"].as<string>(), address);
+    if(bus < 0)
+    {
+        cerr << "Could not start a private dbus-daemon" << endl;
+        Log::Close();
+        return 1;
+    }
+
+    DBus::_init_threading();
+    DBus::default_dispatcher = &dispatcher;
+
+    Simulator::Instance().Enable();
+    Simulator::Instance().AddDevice(BENCH_MCP_ADR, new Mcp23017Model(BENCH_MCP_ADR, -1));
+
+    int result = 0;
+    try
+    {
+        DBus::Connection conn(address.c_str());
+        conn.register_bus();
+
+        GpioRegistry registry;
+        SignalSubscriptions subscriptions;
+        subscriptions.Subscribed(true);
+
+        cout << "driver,tickdelay_us,ticks,pins,channel,value,nominal_hz,expected_duty,periods,frequency_hz,frequency_error,"
+             << "duty,duty_error,jitter_us,max_period_deviation_us,cpu_percent,tick_lateness_us" << endl;
+
+        for(std::vector<std::string>::iterator d = drivers.begin(); d != drivers.end(); ++d)
+        {
+            if(*d != "gpio" && *d != "mcp23017")
+            {
+                cerr << "Unknown driver '" << *d << "'" << endl;
+                result = 1;
+                continue;
+            }
+            for(size_t t = 0; t < tickdelays.size(); t++)
+            {
+                for(size_t n = 0; n < tickcounts.size(); n++)
+                {
+                    for(size_t p = 0; p < pincounts.size(); p++)
+                    {
+                        if(pincounts[p] < 1 || pincounts[p] > 16 || tickcounts[n] < 2 || tickcounts[n] > 255)
+                            continue;
+                        run(conn, registry, subscriptions, *d, tickdelays[t], tickcounts[n], pincounts[p], values, duration);
+                    }
+                }
+            }
+        }
+    }
+    catch(const libconfig::ParseException &x)
+    {
+        cerr << "Error parsing the benchmark config: " << x.getError() << " on line " << x.getLine() << endl;
+        result = 1;
+    }
+    catch(const DBus::Error &x)
+    {
+        cerr << "D-Bus error: " << x.message() << endl;
+        result = 1;
+    }
+
+    terminate(bus);
+    Log::Close();
+    return result;
+}
@@ -0,0 +1,538 @@
+/*
+ * Interrupt storm stress test.
+ *
+ * Injects bursts of edges into the interrupt sources of a GPIO group and an MCP23017 group on simulated
+ * hardware, and follows every edge to the InputChanged the group reports for it. Per source and pattern:
+ *  - the edges injected and the changes delivered. Both drivers fold edges that come in while an interrupt
+ *    is being handled, so fewer deliveries than edges is expected, none at all is not
+ *  - the queue depth, as the most edges the interrupt listener found pending on one wakeup
+ *  - the dispatch lag, from the oldest undelivered edge of a pin to the next change reported for it
+ *  - the cpu time of the process, as a percentage of one cpu
+ * After the storm, the inputs are left alone for a while and every pin is toggled once more, which must
+ * be delivered within the lag limit. A GPIO input reports the level it reads, so it must also have settled
+ * on the level last injected. An MCP23017 reports the port value captured on the first of the edges it
+ * folds, so there a stale value is reported but is not a failure.
+ *
+ * Prints a line per source and pattern, and exits with 0 if all runs stayed within the limits, 1 if not,
+ * and 77 (skipped) if no private dbus-daemon could be started, so it can run from make check.
+ *
+ * Patterns:
+ *  square  edges at a constant rate, round robin over the pins
+ *  burst   --burst-len edges at the rate, then a pause of --burst-gap-ms
+ *  random  edges at random times (poisson) on random pins, at the rate on average
+ *
+ * Example:
+ *   storm-test --source gpio --pattern burst --rate 50000 --burst-len 256 --duration 5
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include <dbus-c++/dbus.h>
+#include <libconfig.h++>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include "../iogroup-gpio.hpp"
+#include "../iogroup-mcp23017.hpp"
+#include "../simulator/simulator.hpp"
+#include "../simulator/simdevices.hpp"
+#include "../stats/stats.hpp"
+#include "../log/log.hpp"
+#include "privatebus.hpp"
+
+// For getting current time
+#include <time.h>
+
+using namespace std;
+using namespace libconfig;
+namespace po = boost::program_options;
+
+#define STORM_MCP_ADR       0x20
+#define STORM_MCP_INTPIN    22
+#define EXIT_SKIP           77      // Exit code automake uses for a skipped test
+
+// Gpio pins that are valid on all board revisions, for the inputs of the GPIO group
+static const uint32_t stormGpioPins[] = { 4, 17, 18, 23, 24, 25 };
+#define STORM_GPIO_PIN_COUNT (sizeof(stormGpioPins) / sizeof(stormGpioPins[0]))
+
+DBus::BusDispatcher dispatcher;
+
+struct StormSettings
+{
+    double rate;            // Edges per second
+    double duration;        // s
+    unsigned int pins;
+    unsigned int burstLen;
+    double burstGap;        // s
+    double maxLag;          // s
+    double minDelivery;     // Deliveries per injected edge
+    double maxCpu;          // Percent of one cpu, 0 for no limit
+    unsigned int noiseMargin;
+};
+
+struct StormResult
+{
+    uint64_t injected;
+    uint64_t delivered;
+    uint64_t duplicates;    // Deliveries without an edge pending
+    unsigned int stale;     // Pins not on their injected level after the storm
+    unsigned int lost;      // Probe toggles not delivered in time
+    double achievedRate;
+    double meanLag;         // s
+    double maxLag;          // s
+    double maxProbeLag;     // s
+    Simulator::ListenerStats queue;
+    uint64_t maxInterruptLatency;   // ns
+    uint64_t maxHandlerTime;        // ns
+    double cpu;
+};
+
+static double now_s(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void sleepUntil(double t)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)t;
+    ts.tv_nsec = (long)((t - ts.tv_sec) * 1e9);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static double selfCpu(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+// Keeps track of the edges injected into the inputs of a group, and of the changes it delivers for them
+class StormTracker
+{
+public:
+    StormTracker(unsigned int pins)
+    {
+        Thread::InitMutex(&this->mutex);
+        this->pins.resize(pins);
+        for(unsigned int i = 0; i < pins; i++)
+        {
+            this->pins[i].level = false;
+            this->pins[i].value = false;
+            this->pins[i].pendingSince = 0;
+        }
+        this->injected = 0;
+        this->delivered = 0;
+        this->duplicates = 0;
+        this->lagSum = 0;
+        this->lagMax = 0;
+    }
+
+    ~StormTracker()
+    {
+        pthread_mutex_destroy(&this->mutex);
+    }
+
+    // Register an edge on an input and return the new level. Call before driving the pin,
+    // so the delivery cannot come in before the edge is known
+    bool Inject(unsigned int pin)
+    {
+        pthread_mutex_lock(&this->mutex);
+        PinState &p = this->pins[pin];
+        p.level = !p.level;
+        if(p.pendingSince == 0)
+            p.pendingSince = Simulator::now_us();
+        this->injected++;
+        bool level = p.level;
+        pthread_mutex_unlock(&this->mutex);
+        return level;
+    }
+
+    // Connected to onInputChanged of the group. The inputs are named in0, in1, ...
+    void Delivered(IoGroupDigital * sender, std::string handle, bool value)
+    {
+        unsigned int pin = strtoul(handle.c_str() + 2, NULL, 10);
+        uint64_t now = Simulator::now_us();
+
+        pthread_mutex_lock(&this->mutex);
+        if(pin < this->pins.size())
+        {
+            PinState &p = this->pins[pin];
+            if(p.pendingSince != 0)
+            {
+                uint64_t lag = now - p.pendingSince;
+                this->lagSum += lag;
+                this->lagMax = std::max(this->lagMax, lag);
+                this->delivered++;
+                p.pendingSince = 0;
+            }
+            else
+            {
+                this->duplicates++;
+            }
+            p.value = value;
+        }
+        pthread_mutex_unlock(&this->mutex);
+    }
+
+    // Start measuring the lag from here, e.g. after the storm
+    void ResetLag()
+    {
+        pthread_mutex_lock(&this->mutex);
+        this->lagMax = 0;
+        pthread_mutex_unlock(&this->mutex);
+    }
+
+    // Wait until a toggled pin was delivered with its new level. Returns false on a timeout
+    bool WaitDelivered(unsigned int pin, double timeout)
+    {
+        double end = now_s() + timeout;
+        while(now_s() < end)
+        {
+            pthread_mutex_lock(&this->mutex);
+            bool done = (this->pins[pin].pendingSince == 0 && this->pins[pin].value == this->pins[pin].level);
+            pthread_mutex_unlock(&this->mutex);
+            if(done)
+                return true;
+            usleep(500);
+        }
+        return false;
+    }
+
+    void Results(StormResult &r)
+    {
+        pthread_mutex_lock(&this->mutex);
+        r.injected = this->injected;
+        r.delivered = this->delivered;
+        r.duplicates = this->duplicates;
+        r.meanLag = (this->delivered > 0) ? this->lagSum / 1e6 / this->delivered : 0;
+        r.maxLag = this->lagMax / 1e6;
+        r.stale = 0;
+        for(size_t i = 0; i < this->pins.size(); i++)
+        {
+            if(this->pins[i].value != this->pins[i].level)
+                r.stale++;
+        }
+        pthread_mutex_unlock(&this->mutex);
+    }
+
+    double MaxLag()
+    {
+        pthread_mutex_lock(&this->mutex);
+        double lag = this->lagMax / 1e6;
+        pthread_mutex_unlock(&this->mutex);
+        return lag;
+    }
+
+private:
+    struct PinState
+    {
+        bool level;             // Last level injected
+        bool value;             // Last value delivered
+        uint64_t pendingSince;  // Time of the oldest undelivered edge, 0 if there is none
+    };
+
+    pthread_mutex_t mutex;
+    std::vector<PinState> pins;
+    uint64_t injected;
+    uint64_t delivered;
+    uint64_t duplicates;
+    uint64_t lagSum;            // us
+    uint64_t lagMax;            // us
+};
+
+static std::string groupConfig(const std::string &source, const StormSettings &s)
+{
+    std::ostringstream cfg;
+    cfg << "storm: { ";
+    if(source == "gpio")
+        cfg << "type = \"GPIO\"; ";
+    else
+        cfg << "type = \"MCP23017\"; address = " << STORM_MCP_ADR << "; intpin = " << STORM_MCP_INTPIN << "; noisemargin = " << s.noiseMargin << "; ";
+    cfg << "io: {";
+    for(unsigned int i = 0; i < s.pins; i++)
+    {
+        cfg << " in" << i << ": { type = \"INPUTPIN\"; pin = " << ((source == "gpio") ? stormGpioPins[i] : i) << "; };";
+    }
+    cfg << " }; };";
+    return cfg.str();
+}
+
+static void drive(const std::string &source, unsigned int pin, bool level)
+{
+    if(source == "gpio")
+        Simulator::Instance().SetGpio(stormGpioPins[pin], level);
+    else
+        Simulator::Instance().SetExpanderInput(STORM_MCP_ADR, pin, level);
+}
+
+// Queue statistics of the interrupt listeners of a source
+static Simulator::ListenerStats queueStats(const std::string &source, unsigned int pins)
+{
+    if(source != "gpio")
+        return Simulator::Instance().GetListenerStats(STORM_MCP_INTPIN);
+
+    Simulator::ListenerStats total;
+    memset(&total, 0, sizeof(total));
+    for(unsigned int i = 0; i < pins; i++)
+    {
+        Simulator::ListenerStats pin = Simulator::Instance().GetListenerStats(stormGpioPins[i]);
+        total.edges += pin.edges;
+        total.wakeups += pin.wakeups;
+        total.maxPending = std::max(total.maxPending, pin.maxPending);
+    }
+    return total;
+}
+
+// Inject edges following a pattern for the duration of the storm. Returns the number of edges injected
+static uint64_t inject(StormTracker &tracker, const std::string &source, const std::string &pattern, const StormSettings &s)
+{
+    double start = now_s();
+    double end = start + s.duration;
+    double next = start;
+    uint64_t n = 0;
+
+    while(next < end)
+    {
+        // Edges that are late are injected right away, so a slow injector shows up as a lower rate
+        sleepUntil(next);
+
+        unsigned int pin;
+        if(pattern == "random")
+            pin = rand() % s.pins;
+        else
+            pin = n % s.pins;
+        drive(source, pin, tracker.Inject(pin));
+        n++;
+
+        if(pattern == "random")
+            next += -log(1.0 - rand() / (RAND_MAX + 1.0)) / s.rate;
+        else if(pattern == "burst" && (n % s.burstLen) == 0)
+            next += s.burstGap;
+        else
+            next += 1.0 / s.rate;
+    }
+    return n;
+}
+
+// Run a storm on one source, returns true if it stayed within the limits
+static bool run(DBus::Connection &conn, GpioRegistry &registry, SignalSubscriptions &subscriptions,
+                const std::string &source, const std::string &pattern, const StormSettings &s)
+{
+    // Start from a fresh chip with all inputs low, and the gpio inputs low
+    Simulator::Instance().AddDevice(STORM_MCP_ADR, new Mcp23017Model(STORM_MCP_ADR, STORM_MCP_INTPIN));
+    for(unsigned int i = 0; i < s.pins; i++)
+    {
+        drive(source, i, false);
+    }
+
+    Config config;
+    config.readString(groupConfig(source, s));
+    std::string path = "/storm/" + source;
+    IoGroupDigital * group;
+    if(source == "gpio")
+        group = new IoGroupGpio(conn, path, registry);
+    else
+        group = new IoGroupMCP23017(conn, path, registry);
+
+    StormTracker tracker(s.pins);
+    group->Initialize(config.lookup("storm"));
+    group->Subscriptions(&subscriptions);
+    group->onInputChanged.connect(boost::bind(&StormTracker::Delivered, &tracker, _1, _2, _3));
+    group->Start();
+    usleep(100000);     // Let the interrupt listener get going
+
+    Simulator::Instance().ResetListenerStats();
+    Stats::Instance().Reset();
+
+    // The storm
+    StormResult r;
+    double cpuStart = selfCpu(), start = now_s();
+    inject(tracker, source, pattern, s);
+    double stormTime = now_s() - start;
+    usleep(s.maxLag * 1e6);
+    r.cpu = (selfCpu() - cpuStart) / (now_s() - start) * 100;
+    tracker.Results(r);
+    r.achievedRate = r.injected / stormTime;
+    r.queue = queueStats(source, s.pins);
+
+    Stats::Summary summary;
+    r.maxInterruptLatency = Stats::Instance().Get("interrupt.latency", summary) ? summary.max : 0;
+    r.maxHandlerTime = Stats::Instance().Get("interrupt.handler", summary) ? summary.max : 0;
+
+    // The probe: every pin toggled once more, one at a time, must come through
+    tracker.ResetLag();
+    r.lost = 0;
+    for(unsigned int i = 0; i < s.pins; i++)
+    {
+        drive(source, i, tracker.Inject(i));
+        if(!tracker.WaitDelivered(i, s.maxLag))
+            r.lost++;
+    }
+    r.maxProbeLag = tracker.MaxLag();
+
+    delete group;
+
+    double ratio = (r.injected > 0) ? (double)r.delivered / r.injected : 0;
+    std::vector<std::string> failures;
+    if(r.maxLag > s.maxLag)
+        failures.push_back("lag");
+    if(ratio < s.minDelivery)
+        failures.push_back("delivery");
+    if(r.lost > 0)
+        failures.push_back("probe");
+    if(source == "gpio" && r.stale > 0)
+        failures.push_back("stale");
+    if(s.maxCpu > 0 && r.cpu > s.maxCpu)
+        failures.push_back("cpu");
+
+    cout << fixed << setprecision(2);
+    cout << source << "/" << pattern << ": injected " << r.injected << " (" << (uint64_t)r.achievedRate << "/s)"
+         << ", delivered " << r.delivered << " (" << ratio * 100 << "%)"
+         << ", duplicates " << r.duplicates
+         << ", stale " << r.stale
+         << ", wakeups " << r.queue.wakeups << ", max pending " << r.queue.maxPending
+         << ", lag mean " << r.meanLag * 1e3 << " ms max " << r.maxLag * 1e3 << " ms"
+         << ", probe lag max " << r.maxProbeLag * 1e3 << " ms"
+         << ", interrupt latency max " << r.maxInterruptLatency / 1e3 << " us"
+         << ", handler max " << r.maxHandlerTime / 1e3 << " us"
+         << ", cpu " << r.cpu << "%";
+    if(failures.empty())
+        cout << ": PASS" << endl;
+    else
+        cout << ": FAIL (" << boost::join(failures, ",") << ")" << endl;
+
+    return failures.empty();
+}
+
+int main(int argc, char ** argv)
+{
+    // first parse options
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "Show this help message")
+        ("dbus-daemon", po::value<string>()->default_value("dbus-daemon"), "dbus-daemon binary to use for the private bus")
+        ("source", po::value<string>()->default_value("gpio,mcp23017"), "interrupt sources to storm: gpio, mcp23017")
+        ("pattern", po::value<string>()->default_value("square,burst,random"), "edge patterns to inject: square, burst, random")
+        ("rate", po::value<double>()->default_value(5000), "edges per second")
+        ("duration", po::value<double>()->default_value(1), "length of a storm in seconds")
+        ("pins", po::value<unsigned int>()->default_value(4), "number of input pins the edges are spread over (1-6)")
+        ("burst-len", po::value<unsigned int>()->default_value(64), "edges per burst")
+        ("burst-gap-ms", po::value<double>()->default_value(50), "pause between bursts")
+        ("noisemargin", po::value<unsigned int>()->default_value(0), "noisemargin of the MCP23017 group, 0 to deliver all changes")
+        ("max-lag-ms", po::value<double>()->default_value(250), "fail if a change takes longer to be delivered")
+        ("min-delivery", po::value<double>()->default_value(0.1), "fail if less changes per injected edge are delivered")
+        ("max-cpu", po::value<double>()->default_value(0), "fail if the cpu use is higher, in percent of one cpu. 0 for no limit")
+        ("seed", po::value<unsigned int>()->default_value(1), "seed for the random pattern")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc,argv,desc),vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        cout << desc << endl;
+        return 1;
+    }
+
+    StormSettings settings;
+    settings.rate = vm["rate"].as<double>();
+    settings.duration = vm["duration"].as<double>();
+    settings.pins = vm["pins"].as<unsigned int>();
+    settings.burstLen = vm["burst-len"].as<unsigned int>();
+    settings.burstGap = vm["burst-gap-ms"].as<double>() / 1e3;
+    settings.maxLag = vm["max-lag-ms"].as<double>() / 1e3;
+    settings.minDelivery = vm["min-delivery"].as<double>();
+    settings.maxCpu = vm["max-cpu"].as<double>();
+    settings.noiseMargin = vm["noisemargin"].as<unsigned int>();
+
+    if(settings.pins < 1 || settings.pins > STORM_GPIO_PIN_COUNT || settings.rate <= 0 || settings.burstLen < 1)
+    {
+        cerr << "Pins must be between 1 and " << STORM_GPIO_PIN_COUNT << ", rate and burst-len must be positive" << endl;
+        return 1;
+    }
+
+    std::vector<std::string> sources, patterns;
+    boost::split(sources, vm["source"].as<string>(), boost::is_any_of(","));
+    boost::split(patterns, vm["pattern"].as<string>(), boost::is_any_of(","));
+    srand(vm["seed"].as<unsigned int>());
+
+    signal(SIGPIPE, SIG_IGN);
+    Log::Init("storm-test");
+
+    std::string address;
+    pid_t bus = startBus(vm["dbus-daemon"].as<string>(), address);
+    if(bus < 0)
+    {
+        cerr << "Could not start a private dbus-daemon, skipping" << endl;
+        Log::Close();
+        return EXIT_SKIP;
+    }
+
+    DBus::_init_threading();
+    DBus::default_dispatcher = &dispatcher;
+
+    Simulator::Instance().Enable();
+
+    int result = 0;
+    try
+    {
+        DBus::Connection conn(address.c_str());
+        conn.register_bus();
+
+        GpioRegistry registry;
+        SignalSubscriptions subscriptions;
+        subscriptions.Subscribed(true);
+
+        for(std::vector<std::string>::iterator src = sources.begin(); src != sources.end(); ++src)
+        {
+            if(*src != "gpio" && *src != "mcp23017")
+            {
+                cerr << "Unknown source '" << *src << "'" << endl;
+                result = 1;
+                continue;
+            }
+            for(std::vector<std::string>::iterator p = patterns.begin(); p != patterns.end(); ++p)
+            {
+                if(*p != "square" && *p != "burst" && *p != "random")
+                {
+                    cerr << "Unknown pattern '" << *p << "'" << endl;
+                    result = 1;
+                    continue;
+                }
+                if(!run(conn, registry, subscriptions, *src, *p, settings))
+                    result = 1;
+            }
+        }
+    }
+    catch(const libconfig::ParseException &x)
+    {
+        cerr << "Error parsing the test config: " << x.getError() << " on line " << x.getLine() << endl;
+        result = 1;
+    }
+    catch(const DBus::Error &x)
+    {
+        cerr << "D-Bus error: " << x.message() << endl;
+        result = 1;
+    }
+
+    terminate(bus);
+    Log::Close();
+    return result;
+}
@@ -3,6 +3,14 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <alloca.h>
+#include <map>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include <iostream>
 
@@ -10,16 +18,17 @@
 
 using namespace std;
 
+#define PREFAULT_MARGIN_KB  64      // Stack left untouched by the prefault, for what is in use and the guard
+
 void * thread_threadStarter(void *);
 
 Thread::Thread()
 {
-    running = false;
+    running = 0;
+    // Without an eventfd, loops fall back to their poll timeouts
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 
-    pthread_mutexattr_init(&mutexAttr);
-    pthread_mutexattr_settype(&mutexAttr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&mutex, &mutexAttr);    
-    
+    InitMutex(&mutex, true);
 }
 
 Thread::~Thread()
@@ -28,27 +37,57 @@ Thread::~Thread()
     pthread_mutex_destroy(&mutex);
 
     // Stop the thread if needed
-    if(running)
+    if(ThreadRunning())
         ThreadStop(); 
+
+    if(wakeFd >= 0)
+        close(wakeFd);
 }
 
 bool Thread::ThreadRunning()
 {
-    return running;
+    return __sync_fetch_and_add(&running, 0) != 0;
+}
+
+int Thread::ThreadWakeFd()
+{
+    return wakeFd;
+}
+
+void Thread::ThreadWake()
+{
+    uint64_t one = 1;
+    if(wakeFd >= 0 && write(wakeFd, &one, sizeof(one)) < 0) { /* counter full means it is signalled anyway */ }
+}
+
+bool Thread::ThreadSleep(uint32_t us)
+{
+    struct pollfd pfd;
+    struct timespec timeout;
+    
+    pfd.fd = wakeFd;    // Ignored by ppoll when negative
+    pfd.events = POLLIN;
+    timeout.tv_sec = us / 1000000;
+    timeout.tv_nsec = (us % 1000000) * 1000L;
+    
+    while(ppoll(&pfd, 1, &timeout, NULL) < 0 && errno == EINTR);
+    return ThreadRunning();
 }
 
 
 void Thread::ThreadStart()
 {
     int32_t result;
-    if(!running)
+    if(__sync_bool_compare_and_swap(&running, 0, 1))
     {
-        running = true;
+        // Clear a wakeup left from a previous stop
+        uint64_t count;
+        if(wakeFd >= 0 && read(wakeFd, &count, sizeof(count)) < 0) { /* not signalled */ }
 
         result = pthread_create(&wthread, NULL, thread_threadStarter, this);
         if(result != 0) // success
         {
-            running = false;
+            __sync_lock_release(&running);
             if(result == EAGAIN)
                 throw ThreadException("Cannot create thread: Error EAGAIN - The system lacked the neccesary resources to create another thread, or PTHREAD_THREADS_MAX is exceeded");
             else if(result == EINVAL)
@@ -62,9 +101,9 @@ void Thread::ThreadStart()
 void Thread::ThreadStop()
 {
     int32_t result;
-    if(running)
+    if(__sync_bool_compare_and_swap(&running, 1, 0))  // stops the thread loop
     {
-        running = false;    // stops the thread loop
+        ThreadWake();       // interrupts it if it is waiting
         result = pthread_join(wthread, NULL); // wait for completion
         if(result != 0)
         {
@@ -83,11 +122,11 @@ void Thread::ThreadStarter()
    try
    {
         ThreadFunc();
-        running = false;
+        __sync_lock_release(&running);
    }
    catch(std::exception x)
    {
-        running = false;
+        __sync_lock_release(&running);
 
         // (debug) Log the exception, before calling the callback
         // clog << kLogErr << x.what() << endl;
@@ -96,17 +135,156 @@ void Thread::ThreadStarter()
    }
 }
 
-bool Thread::MakeRealtime()
+// Configured profiles by thread class, and the stack to prefault when memory is locked
+static pthread_mutex_t profileMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t profileStackKb = 0;
+
+static std::map<std::string, Thread::Profile> & profiles()
+{
+    static std::map<std::string, Thread::Profile> p;
+    if(p.empty())
+    {
+        // PWM threads run at the highest realtime priority unless configured otherwise
+        p["pwm"].policy = SCHED_FIFO;
+        p["pwm"].priority = sched_get_priority_max(SCHED_FIFO);
+    }
+    return p;
+}
+
+// Touch the pages of the stack below the caller, so they are mapped before they are needed
+static void __attribute__((noinline)) prefaultStack(uint32_t kb)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    volatile char * stack = (volatile char *)alloca(kb * 1024);
+    for(uint32_t i = 0; i < kb * 1024; i += pagesize)
+    {
+        stack[i] = 0;
+    }
+}
+
+void Thread::SetProfile(const std::string &threadClass, const Profile &profile)
+{
+    pthread_mutex_lock(&profileMutex);
+    profiles()[threadClass] = profile;
+    pthread_mutex_unlock(&profileMutex);
+}
+
+bool Thread::LockMemory(uint32_t prefaultStackKb)
+{
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        clog << kLogWarning << "Unsuccessful in locking memory: " << strerror(errno) << endl; 
+        return false;
+    }
+    
+    pthread_mutex_lock(&profileMutex);
+    profileStackKb = prefaultStackKb;
+    pthread_mutex_unlock(&profileMutex);
+    return true;
+}
+
+void Thread::InitMutex(pthread_mutex_t *mutex, bool recursive)
+{
+    pthread_mutexattr_t attr;
+    
+    pthread_mutexattr_init(&attr);
+    if(recursive)
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+bool Thread::ApplyProfile(const std::string &threadClass)
 {
+    Profile profile;
+    uint32_t stackKb;
+    bool found;
+    bool ok = true;
+    
+    pthread_mutex_lock(&profileMutex);
+    std::map<std::string, Profile>::iterator it = profiles().find(threadClass);
+    found = (it != profiles().end());
+    if(found)
+        profile = it->second;
+    stackKb = profileStackKb;
+    pthread_mutex_unlock(&profileMutex);
+    
+    if(stackKb > 0)
+    {
+        // Never prefault beyond the stack of this thread
+        pthread_attr_t attr;
+        size_t stackSize = 0;
+        if(pthread_getattr_np(pthread_self(), &attr) == 0)
+        {
+            pthread_attr_getstacksize(&attr, &stackSize);
+            pthread_attr_destroy(&attr);
+        }
+        uint32_t maxKb = (stackSize / 1024 > PREFAULT_MARGIN_KB) ? (stackSize / 1024 - PREFAULT_MARGIN_KB) : 0;
+        if(stackKb > maxKb)
+        {
+            clog << kLogWarning << "Prefaulting " << maxKb << " kB instead of " << stackKb << " kB of stack for " << threadClass 
+                 << " thread, its stack is " << stackSize / 1024 << " kB" << endl;
+            stackKb = maxKb;
+        }
+        if(stackKb > 0)
+            prefaultStack(stackKb);
+    }
+    
+    if(!found)
+        return true;
+    
     struct sched_param params;
-    int32_t ret;
+    if(profile.policy == SCHED_FIFO || profile.policy == SCHED_RR)
+    {
+        params.sched_priority = profile.priority;
+        if(pthread_setschedparam(pthread_self(), profile.policy, &params) != 0)
+        {
+            clog << kLogWarning << "Unsuccessful in setting realtime priority " << profile.priority << " for " << threadClass << " thread" << endl; 
+            ok = false;
+        }
+    }
+    else
+    {
+        params.sched_priority = 0;
+        // On linux, the nice value applies to the calling thread only when given its thread id
+        if(pthread_setschedparam(pthread_self(), profile.policy, &params) != 0 
+           || setpriority(PRIO_PROCESS, (pid_t)syscall(SYS_gettid), profile.priority) != 0)
+        {
+            clog << kLogWarning << "Unsuccessful in setting scheduling for " << threadClass << " thread" << endl; 
+            ok = false;
+        }
+    }
+    
+    if(!profile.cpus.empty())
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for(std::vector<int>::iterator c = profile.cpus.begin(); c != profile.cpus.end(); ++c)
+        {
+            CPU_SET(*c, &cpus);
+        }
+        if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+        {
+            clog << kLogWarning << "Unsuccessful in setting cpu affinity for " << threadClass << " thread" << endl; 
+            ok = false;
+        }
+    }
     
-    params.sched_priority = sched_get_priority_max(SCHED_FIFO);
-    ret = pthread_setschedparam(wthread, SCHED_FIFO, &params); // This thread is always key->pwm_thread, and if not, then it should be  
+    return ok;
+}
+
+bool Thread::MakeLowPriority()
+{
+    int32_t ret;
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+
+    // On linux, the nice value applies to the calling thread only when given its thread id
+    ret = setpriority(PRIO_PROCESS, tid, 19);
 
     if (ret != 0) {
         // Print the error
-        clog << kLogWarning << "Unsuccessful in setting thread realtime priority" << endl; 
+        clog << kLogWarning << "Unsuccessful in setting thread low priority" << endl; 
         return false;
     }
     else
@@ -115,12 +293,12 @@ bool Thread::MakeRealtime()
 
 void Thread::ThreadLoop(void)
 {
-    usleep(25000);
+    ThreadSleep(25000);
 }
 
 void Thread::ThreadFunc(void)
 {
-    while(running)
+    while(ThreadRunning())
     {
         ThreadLoop();
     }
@@ -2,7 +2,9 @@
 #define __THREAD_HPP
 
 #include <pthread.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
 #include "../exception/baseexceptions.hpp"
 #include <boost/signals2.hpp>
 
@@ -23,24 +25,52 @@ class Thread
         ~Thread();
         boost::signals2::signal<void (Thread *, ThreadException)> onThreadError;
 
+        // Scheduling of a class of threads. Policy is a SCHED_* value, priority is the realtime priority for 
+        // SCHED_FIFO and SCHED_RR, or the nice value for the others. An empty cpu list allows all cpus
+        struct Profile
+        {
+            int policy;
+            int priority;
+            std::vector<int> cpus;
+        };
+        // Set the profile for a class of threads. Applies to threads of the class that start after this
+        static void SetProfile(const std::string &threadClass, const Profile &profile);
+        // Lock all current and future memory of the process, and prefault this many kB of stack in each 
+        // thread that applies a profile, so realtime threads do not stall on page faults
+        static bool LockMemory(uint32_t prefaultStackKb);
+        // Initialize a mutex with priority inheritance, so a realtime thread waiting for it is not held 
+        // up behind lower priority threads
+        static void InitMutex(pthread_mutex_t *mutex, bool recursive = false);
+
     protected:
         Thread();
 
         void ThreadStart();
         void ThreadStop();
         bool ThreadRunning();
+        // File descriptor that becomes readable when the thread is asked to stop, or -1 if there is none.
+        // Blocking loops should add it to their poll set, so a stop does not have to wait for a timeout
+        int ThreadWakeFd();
+        // Sleep for a number of microseconds. Returns false if the sleep was cut short by a stop request
+        bool ThreadSleep(uint32_t us);
+        // Called by ThreadStop to interrupt the thread. Signals the wakeup fd by default, override for 
+        // threads that block on something else
+        virtual void ThreadWake();
         void MutexLock();
         void MutexUnlock();
         
-        bool MakeRealtime();
+        // Apply the profile of a class of threads. Call from within the thread itself.
+        // Classes without a configured profile keep the scheduling they were started with
+        bool ApplyProfile(const std::string &threadClass);
+        bool MakeLowPriority();     // Call from within the thread itself
         virtual void ThreadFunc(void);  // Override this if you want the entire function custom
         virtual void ThreadLoop(); //
         
     private:
         pthread_t wthread;
         pthread_mutex_t mutex;
-        pthread_mutexattr_t mutexAttr;
-        bool running;
+        volatile int32_t running;
+        int wakeFd;
         void ThreadStarter();
 };
 
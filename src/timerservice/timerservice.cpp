@@ -0,0 +1,264 @@
+#include "timerservice.hpp"
+#include "../log/log.hpp"
+#include "../trace/trace.h"
+
+#include <time.h>
+
+using namespace std;
+
+TimerService & TimerService::Instance()
+{
+    static TimerService instance;
+    return instance;
+}
+
+TimerService::TimerService()
+{
+    pthread_condattr_t condAttr;
+    
+    this->lastId = 0;
+    this->dispatcher = NULL;
+    this->dispatchPipe = NULL;
+    this->dispatchPending = false;
+    this->timerOwner = NULL;
+    this->dispatchOwner = NULL;
+    
+    Thread::InitMutex(&this->mutex);
+    // Wait on the same clock the deadlines are in
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&this->wakeup, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+    pthread_cond_init(&this->callbackDone, NULL);
+    
+    ThreadStart();
+}
+
+TimerService::~TimerService()
+{
+    ThreadStop();
+    
+    pthread_cond_destroy(&this->callbackDone);
+    pthread_cond_destroy(&this->wakeup);
+    pthread_mutex_destroy(&this->mutex);
+}
+
+TimerService::TimerId TimerService::Schedule(uint32_t delay_ms, Callback callback, const void * owner, bool onDispatcher)
+{
+    Deadline d;
+    Timer t;
+    
+    t.callback = callback;
+    t.owner = owner;
+    t.onDispatcher = onDispatcher;
+    d.time = now_us() + ((uint64_t)delay_ms) * 1000;
+    
+    pthread_mutex_lock(&this->mutex);
+    d.id = ++this->lastId;
+    this->timers[d.id] = t;
+    
+    // Only wake the thread if it is waiting for a later deadline
+    if(this->deadlines.empty() || d.time < this->deadlines.top().time)
+    {
+        pthread_cond_signal(&this->wakeup);
+    }
+    this->deadlines.push(d);
+    pthread_mutex_unlock(&this->mutex);
+    
+    return d.id;
+}
+
+bool TimerService::Cancel(TimerId id)
+{
+    bool cancelled = false;
+    
+    pthread_mutex_lock(&this->mutex);
+    if(this->timers.erase(id) > 0)
+    {
+        cancelled = true;
+    }
+    else
+    {
+        for(std::deque<std::pair<TimerId, Timer> >::iterator it = this->dispatchQueue.begin(); it != this->dispatchQueue.end(); ++it)
+        {
+            if(it->first == id)
+            {
+                this->dispatchQueue.erase(it);
+                cancelled = true;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+    
+    return cancelled;
+}
+
+void TimerService::CancelAll(const void * owner)
+{
+    pthread_t self = pthread_self();
+    
+    pthread_mutex_lock(&this->mutex);
+    while(true)
+    {
+        for(std::map<TimerId, Timer>::iterator it = this->timers.begin(); it != this->timers.end(); )
+        {
+            if(it->second.owner == owner)
+                this->timers.erase(it++);
+            else
+                ++it;
+        }
+        for(std::deque<std::pair<TimerId, Timer> >::iterator it = this->dispatchQueue.begin(); it != this->dispatchQueue.end(); )
+        {
+            if(it->second.owner == owner)
+                it = this->dispatchQueue.erase(it);
+            else
+                ++it;
+        }
+        
+        // A running callback may schedule new timers, so look again once it is done
+        if((this->timerOwner == owner && !pthread_equal(this->timerThread, self)) 
+           || (this->dispatchOwner == owner && !pthread_equal(this->dispatchThread, self)))
+        {
+            pthread_cond_wait(&this->callbackDone, &this->mutex);
+        }
+        else
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void TimerService::Dispatcher(DBus::BusDispatcher * dispatcher)
+{
+    DBus::Pipe * oldPipe;
+    DBus::BusDispatcher * oldDispatcher;
+    DBus::Pipe * newPipe = (dispatcher != NULL) ? dispatcher->add_pipe(&TimerService::dispatchPipeHandler, this) : NULL;
+    
+    pthread_mutex_lock(&this->mutex);
+    oldPipe = this->dispatchPipe;
+    oldDispatcher = this->dispatcher;
+    this->dispatcher = dispatcher;
+    this->dispatchPipe = newPipe;
+    this->dispatchPending = false;
+    if(newPipe != NULL && !this->dispatchQueue.empty())
+    {
+        char c = 0;
+        this->dispatchPending = true;
+        newPipe->write(&c, 1);
+    }
+    pthread_mutex_unlock(&this->mutex);
+    
+    if(oldPipe != NULL)
+    {
+        oldDispatcher->del_pipe(oldPipe);
+    }
+}
+
+void TimerService::ThreadFunc()
+{
+    struct timespec deadline;
+    
+    ApplyProfile("timer");
+    
+    pthread_mutex_lock(&this->mutex);
+    while(ThreadRunning())
+    {
+        if(this->deadlines.empty())
+        {
+            // No timers, sleep until there are
+            pthread_cond_wait(&this->wakeup, &this->mutex);
+            continue;
+        }
+        
+        Deadline d = this->deadlines.top();
+        if(d.time > now_us())
+        {
+            deadline.tv_sec = d.time / 1000000;
+            deadline.tv_nsec = (d.time % 1000000) * 1000;
+            pthread_cond_timedwait(&this->wakeup, &this->mutex, &deadline);
+            continue;
+        }
+        
+        this->deadlines.pop();
+        
+        // Skip deadlines of cancelled timers
+        std::map<TimerId, Timer>::iterator it = this->timers.find(d.id);
+        if(it == this->timers.end())
+            continue;
+        
+        Timer t = it->second;
+        this->timers.erase(it);
+        
+        if(t.onDispatcher && this->dispatchPipe != NULL)
+        {
+            this->dispatchQueue.push_back(std::make_pair(d.id, t));
+            // Wake the dispatcher once, all timers that expire until it gets to them run together
+            if(!this->dispatchPending)
+            {
+                char c = 0;
+                this->dispatchPending = true;
+                this->dispatchPipe->write(&c, 1);
+            }
+        }
+        else
+        {
+            runCallback(t, this->timerOwner, this->timerThread);
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void TimerService::ThreadWake()
+{
+    // Taking the mutex makes sure the thread is either waiting, or will see the stop before it does
+    pthread_mutex_lock(&this->mutex);
+    pthread_cond_signal(&this->wakeup);
+    pthread_mutex_unlock(&this->mutex);
+}
+
+// Run a callback without holding the mutex, keeping track of which owner is running. Call with the mutex held
+void TimerService::runCallback(const Timer &timer, const void * &running, pthread_t &thread)
+{
+    running = timer.owner;
+    thread = pthread_self();
+    pthread_mutex_unlock(&this->mutex);
+    
+    try
+    {
+        TRACE_SCOPE("timer.callback");
+        timer.callback();
+    }
+    catch(std::exception x)
+    {
+        clog << kLogError << "Error in timer callback: " << x.what() << endl;
+    }
+    
+    pthread_mutex_lock(&this->mutex);
+    running = NULL;
+    pthread_cond_broadcast(&this->callbackDone);
+}
+
+void TimerService::dispatchPipeHandler(const void *data, void *buffer, unsigned int nbyte)
+{
+    TimerService * service = (TimerService *)data;
+    
+    pthread_mutex_lock(&service->mutex);
+    service->dispatchPending = false;
+    while(!service->dispatchQueue.empty())
+    {
+        Timer t = service->dispatchQueue.front().second;
+        service->dispatchQueue.pop_front();
+        service->runCallback(t, service->dispatchOwner, service->dispatchThread);
+    }
+    pthread_mutex_unlock(&service->mutex);
+}
+
+uint64_t TimerService::now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec)*1000000ULL + (now.tv_nsec/1000);
+}
@@ -0,0 +1,86 @@
+#ifndef __TIMERSERVICE_HPP
+#define __TIMERSERVICE_HPP
+
+#include "../thread/thread.hpp"
+#include <stdint.h>
+#include <pthread.h>
+#include <dbus-c++/dbus.h>
+#include <boost/function.hpp>
+
+#include <map>
+#include <queue>
+#include <deque>
+#include <vector>
+
+// Process wide timer service. All timers run on one thread, which sleeps until the earliest deadline.
+// Callbacks can also be passed to the dispatcher thread, once a dispatcher has been set.
+class TimerService : protected Thread
+{
+    public:
+        typedef boost::function<void ()> Callback;
+        typedef uint64_t TimerId;       // 0 is never a valid id
+        
+        static TimerService & Instance();
+        
+        //! Run callback once after delay_ms. Owner is used to cancel all timers of an object at once.
+        //! If onDispatcher is set, the callback runs on the dispatcher thread instead of the timer thread
+        TimerId Schedule(uint32_t delay_ms, Callback callback, const void * owner, bool onDispatcher = false);
+        //! Cancel a timer. Returns false if it already ran or is running. Does not wait for a running callback
+        bool Cancel(TimerId id);
+        //! Cancel all timers of an owner, and wait for any of its callbacks that are running on another thread.
+        //! Call this from the destructor of an owner, without holding locks its callbacks take
+        void CancelAll(const void * owner);
+        
+        //! Set the dispatcher that onDispatcher callbacks run on, or NULL to run them on the timer thread
+        void Dispatcher(DBus::BusDispatcher * dispatcher);
+    
+    protected:
+        virtual void ThreadFunc(void);
+        virtual void ThreadWake(void);
+    
+    private:
+        TimerService();
+        ~TimerService();
+        
+        struct Timer
+        {
+            Callback callback;
+            const void * owner;
+            bool onDispatcher;
+        };
+        
+        struct Deadline
+        {
+            uint64_t time;      // In microseconds
+            TimerId id;
+            bool operator>(const Deadline &other) const { return this->time > other.time; }
+        };
+        
+        // Timers that have not run yet, and their deadlines earliest first. Deadlines of cancelled timers 
+        // stay in the heap until they expire, and are then skipped
+        std::map<TimerId, Timer> timers;
+        std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline> > deadlines;
+        TimerId lastId;
+        
+        // Expired timers waiting for the dispatcher thread
+        std::deque<std::pair<TimerId, Timer> > dispatchQueue;
+        DBus::BusDispatcher * dispatcher;
+        DBus::Pipe * dispatchPipe;
+        bool dispatchPending;
+        
+        // The owner of the callback that is running on the timer and dispatcher thread, if any
+        const void * timerOwner;
+        const void * dispatchOwner;
+        pthread_t timerThread;
+        pthread_t dispatchThread;
+        
+        pthread_mutex_t mutex;
+        pthread_cond_t wakeup;          // Signalled when an earlier deadline is added, or on stop
+        pthread_cond_t callbackDone;    // Signalled when a callback finishes
+        
+        void runCallback(const Timer &timer, const void * &running, pthread_t &thread);
+        static void dispatchPipeHandler(const void *data, void *buffer, unsigned int nbyte);
+        static uint64_t now_us(void);
+};
+
+#endif//__TIMERSERVICE_HPP
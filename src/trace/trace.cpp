@@ -0,0 +1,224 @@
+#include "trace.h"
+
+#ifdef PIIO_TRACE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sstream>
+#include <iomanip>
+
+struct TraceEvent
+{
+    const char *name;
+    uint64_t ts;                // ns, CLOCK_MONOTONIC
+    uint64_t dur;               // ns, or ~0 for an instant event
+};
+
+// Written only by its own thread. Buffers are never freed. When a thread exits its buffer is kept, so 
+// its events can still be dumped, until a new thread takes it over. So there are never more buffers 
+// than threads that were running at the same time.
+struct TraceBuffer
+{
+    pid_t tid;
+    char name[16];
+    volatile uint32_t head;     // Number of events written, the last TRACE_BUFFER_LEN are kept
+    volatile uint32_t inUse;    // 0 once the thread exited, and the buffer can be taken over
+    TraceEvent events[TRACE_BUFFER_LEN];
+    TraceBuffer * next;
+};
+
+static TraceBuffer * volatile buffers = NULL;
+static __thread TraceBuffer * threadBuffer = NULL;
+static pthread_key_t bufferKey;
+static pthread_once_t bufferKeyOnce = PTHREAD_ONCE_INIT;
+
+// Called when a thread that traced exits
+static void releaseBuffer(void * buffer)
+{
+    TraceBuffer * b = (TraceBuffer *)buffer;
+    threadBuffer = NULL;
+    __sync_synchronize();
+    b->inUse = 0;
+}
+
+static void createBufferKey(void)
+{
+    pthread_key_create(&bufferKey, &releaseBuffer);
+}
+
+static TraceBuffer * traceBuffer(void)
+{
+    if(threadBuffer == NULL)
+    {
+        TraceBuffer * b;
+        pthread_once(&bufferKeyOnce, &createBufferKey);
+        
+        // Take over the buffer of a thread that exited, or add a new one
+        for(b = buffers; b != NULL; b = b->next)
+        {
+            if(b->inUse == 0 && __sync_bool_compare_and_swap(&b->inUse, 0, 1))
+                break;
+        }
+        
+        if(b != NULL)
+        {
+            // A dump that is reading it skips the events, since the head moved by more than it copied
+            b->head = 0;
+            __sync_synchronize();
+        }
+        else
+        {
+            b = (TraceBuffer *)calloc(1, sizeof(TraceBuffer));
+            if(b == NULL)
+                return NULL;
+            b->inUse = 1;
+            
+            // Push on the list of buffers without a lock
+            do
+            {
+                b->next = buffers;
+            }
+            while(!__sync_bool_compare_and_swap(&buffers, b->next, b));
+        }
+        
+        b->tid = (pid_t)syscall(SYS_gettid);
+        memset(b->name, 0, sizeof(b->name));
+        pthread_getname_np(pthread_self(), b->name, sizeof(b->name));
+        
+        pthread_setspecific(bufferKey, b);
+        threadBuffer = b;
+    }
+    return threadBuffer;
+}
+
+static inline void traceRecord(const char *name, uint64_t ts, uint64_t dur)
+{
+    TraceBuffer * b = traceBuffer();
+    if(b == NULL)
+        return;
+    
+    TraceEvent &e = b->events[b->head & (TRACE_BUFFER_LEN - 1)];
+    e.name = name;
+    e.ts = ts;
+    e.dur = dur;
+    // Publish the event before moving the head
+    __sync_synchronize();
+    b->head++;
+}
+
+uint64_t traceNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+void traceSpan(const char *name, uint64_t start_ns)
+{
+    uint64_t now = traceNow();
+    traceRecord(name, start_ns, now - start_ns);
+}
+
+void traceInstant(const char *name)
+{
+    traceRecord(name, traceNow(), ~0ULL);
+}
+
+bool Trace::Enabled()
+{
+    return true;
+}
+
+int32_t Trace::Dump(const std::string &path)
+{
+    std::ostringstream out;
+    int32_t count = 0;
+    pid_t pid = getpid();
+    const char * separator = "";
+    
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for(TraceBuffer * b = buffers; b != NULL; b = b->next)
+    {
+        out << separator << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << b->tid 
+            << ",\"args\":{\"name\":\"" << (b->name[0] ? b->name : "thread") << "\"}}";
+        separator = ",";
+        
+        // The thread keeps writing while we read. Events that were overwritten during the copy, or may
+        // be in the middle of it, are skipped
+        uint32_t head = b->head;
+        __sync_synchronize();
+        uint32_t n = (head < TRACE_BUFFER_LEN) ? head : TRACE_BUFFER_LEN;
+        TraceEvent * copy = new TraceEvent[n];
+        for(uint32_t i = 0; i < n; i++)
+        {
+            copy[i] = b->events[(head - n + i) & (TRACE_BUFFER_LEN - 1)];
+        }
+        __sync_synchronize();
+        uint32_t after = b->head;
+        uint32_t written = after - head + 1;
+        uint32_t skip = (written > TRACE_BUFFER_LEN - n) ? written - (TRACE_BUFFER_LEN - n) : 0;
+        if(skip > n)
+            skip = n;
+        
+        for(uint32_t i = skip; i < n; i++)
+        {
+            TraceEvent &e = copy[i];
+            out << ",\n{\"name\":\"" << e.name << "\",\"pid\":" << pid << ",\"tid\":" << b->tid 
+                << ",\"ts\":" << (e.ts / 1000.0);
+            if(e.dur == ~0ULL)
+                out << ",\"ph\":\"i\",\"s\":\"t\"}";
+            else
+                out << ",\"ph\":\"X\",\"dur\":" << (e.dur / 1000.0) << "}";
+        }
+        count += n - skip;
+        delete[] copy;
+    }
+    out << "\n]}\n";
+    
+    // Written next to the file and renamed over it, never following a link at either name
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if(fd < 0)
+        return -1;
+    
+    std::string data = out.str();
+    size_t done = 0;
+    while(done < data.size())
+    {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        done += n;
+    }
+    
+    if(close(fd) != 0 || done < data.size() || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        return -1;
+    }
+    return count;
+}
+
+#else
+
+bool Trace::Enabled()
+{
+    return false;
+}
+
+int32_t Trace::Dump(const std::string &path)
+{
+    return -1;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdint.h>
+
+// Tracing of the event pipeline, for finding out where the time between an input change and the signal 
+// on the bus goes. Spans and instant events are recorded in a ring buffer per thread, without locks, and 
+// dumped as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) with Trace::Dump.
+//
+// Only compiled in when configured with --enable-trace, which defines PIIO_TRACE. Otherwise all macros
+// are empty. Event names must be string literals, the buffers only keep the pointer.
+//
+//  TRACE_SCOPE("name");     Span from here to the end of the enclosing block
+//  TRACE_INSTANT("name");   Instant event
+
+#define TRACE_BUFFER_LEN    2048    // Events kept per thread (must be a power of two)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef PIIO_TRACE
+
+uint64_t traceNow(void);
+// Record a span from start_ns, a timestamp from traceNow, until now
+void traceSpan(const char *name, uint64_t start_ns);
+void traceInstant(const char *name);
+
+struct trace_scope
+{
+    const char *name;
+    uint64_t start;
+};
+
+static inline void traceScopeEnd(struct trace_scope *scope)
+{
+    traceSpan(scope->name, scope->start);
+}
+
+#define TRACE_INSTANT(name) traceInstant(name)
+
+#else
+
+#define TRACE_INSTANT(name)
+#define TRACE_SCOPE(name)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef PIIO_TRACE
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+
+#ifdef __cplusplus
+
+class TraceScope
+{
+public:
+    TraceScope(const char *name) : name(name), start(traceNow()) {}
+    ~TraceScope() { traceSpan(this->name, this->start); }
+private:
+    const char *name;
+    uint64_t start;
+};
+
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name) struct trace_scope TRACE_CONCAT(traceScope, __LINE__) __attribute__((cleanup(traceScopeEnd))) = { name, traceNow() }
+
+#endif
+
+#endif//PIIO_TRACE
+
+#ifdef __cplusplus
+
+#include <string>
+
+class Trace
+{
+public:
+    //! True if tracing is compiled in
+    static bool Enabled();
+    //! Write the events in all buffers to a file as Chrome trace JSON. Events are kept, so a later dump
+    //! has them again. The file is replaced atomically, through a temporary file next to it.
+    //! Returns the number of events written, or -1 on failure or if tracing is compiled out
+    static int32_t Dump(const std::string &path);
+};
+
+#endif
+
+#endif//__TRACE_H